@@ -23,10 +23,12 @@
     Rf_error("`" #arg "` can't be `NA`.");               \
   }
 
-SEXP ffi_mount_workerfs(SEXP source, SEXP mountpoint) {
+SEXP ffi_mount_workerfs(SEXP source, SEXP mountpoint, SEXP lazy, SEXP hash) {
 #ifdef __EMSCRIPTEN__
   CHECK_STRING(source);
   CHECK_STRING(mountpoint);
+  CHECK_LOGICAL(lazy);
+  CHECK_STRING(hash);
 
   EM_ASM({
     const source = UTF8ToString($0);
@@ -35,7 +37,7 @@ SEXP ffi_mount_workerfs(SEXP source, SEXP mountpoint) {
       if (ENVIRONMENT_IS_NODE && !/^https?:/.test(source)) {
         Module.mountImagePath(source, mountpoint);
       } else {
-        Module.mountImageUrl(source, mountpoint);
+        Module.mountImageUrl(source, mountpoint, !!$2, UTF8ToString($3));
       }
     } catch (e) {
       let msg = e.message;
@@ -45,7 +47,47 @@ SEXP ffi_mount_workerfs(SEXP source, SEXP mountpoint) {
       }
       Module._Rf_error(Module.allocateUTF8OnStack(msg));
     }
-  }, R_CHAR(STRING_ELT(source, 0)), R_CHAR(STRING_ELT(mountpoint, 0)));
+  }, R_CHAR(STRING_ELT(source, 0)), R_CHAR(STRING_ELT(mountpoint, 0)), LOGICAL(lazy)[0],
+     R_CHAR(STRING_ELT(hash, 0)));
+
+  return R_NilValue;
+#else
+  Rf_error("Function must be running under Emscripten.");
+#endif
+}
+
+SEXP ffi_prefetch_images(SEXP urls, SEXP hashes, SEXP concurrency) {
+#ifdef __EMSCRIPTEN__
+  if (!Rf_isString(urls) || !Rf_isString(hashes) || LENGTH(urls) != LENGTH(hashes)) {
+    Rf_error("`urls` and `hashes` must be character vectors of the same length.");
+  }
+  if (!Rf_isInteger(concurrency) || LENGTH(concurrency) != 1 ||
+      INTEGER(concurrency)[0] == NA_INTEGER || INTEGER(concurrency)[0] < 1) {
+    Rf_error("`concurrency` must be a positive integer.");
+  }
+
+  int n = LENGTH(urls);
+  const char **c_urls = (const char **) R_alloc(n, sizeof(char *));
+  const char **c_hashes = (const char **) R_alloc(n, sizeof(char *));
+  for (int i = 0; i < n; i++) {
+    SEXP hash = STRING_ELT(hashes, i);
+    c_urls[i] = R_CHAR(STRING_ELT(urls, i));
+    c_hashes[i] = hash == NA_STRING ? "" : R_CHAR(hash);
+  }
+
+  EM_ASM({
+    const urls = [];
+    const hashes = [];
+    for (let i = 0; i < $2; i++) {
+      urls.push(UTF8ToString(Module.HEAPU32[($0 >> 2) + i]));
+      hashes.push(UTF8ToString(Module.HEAPU32[($1 >> 2) + i]));
+    }
+    try {
+      Module.prefetchImageUrls(urls, hashes, $3);
+    } catch (e) {
+      Module._Rf_error(Module.allocateUTF8OnStack(e.message));
+    }
+  }, c_urls, c_hashes, n, INTEGER(concurrency)[0]);
 
   return R_NilValue;
 #else
@@ -53,6 +95,26 @@ SEXP ffi_mount_workerfs(SEXP source, SEXP mountpoint) {
 #endif
 }
 
+SEXP ffi_fetch_repo_metadata(SEXP url, SEXP path, SEXP force) {
+#ifdef __EMSCRIPTEN__
+  CHECK_STRING(url);
+  CHECK_STRING(path);
+  CHECK_LOGICAL(force);
+
+  int status = EM_ASM_INT({
+    try {
+      return Module.fetchRepoMetadata(UTF8ToString($0), UTF8ToString($1), !!$2);
+    } catch (e) {
+      return -1;
+    }
+  }, R_CHAR(STRING_ELT(url, 0)), R_CHAR(STRING_ELT(path, 0)), LOGICAL(force)[0]);
+
+  return Rf_ScalarInteger(status);
+#else
+  Rf_error("Function must be running under Emscripten.");
+#endif
+}
+
 SEXP ffi_mount_nodefs(SEXP source, SEXP mountpoint) {
 #ifdef __EMSCRIPTEN__
   CHECK_STRING(source);
@@ -0,0 +1,413 @@
+#define R_NO_REMAP
+
+#include <R.h>
+#include <Rinternals.h>
+#include <string.h>
+#include <stdint.h>
+
+/*
+ * Serialise an R object into the msgpack encoding of its `WebRDataJs` tree,
+ * as produced by the recursive `RObject.toJs()` methods on the worker thread.
+ *
+ * The SEXP tree is walked once and written directly into a growing raw
+ * vector, avoiding the creation of intermediate JS objects for every element.
+ *
+ * Objects that are not serialised in place are written as msgpack extension
+ * values holding an index into one of two lists of R objects:
+ *
+ * - `TOJS_EXT_REF`: The depth limit was reached, the object should be
+ *   returned as a reference to an R object.
+ * - `TOJS_EXT_FALLBACK`: The object type is not handled natively and should
+ *   be converted on the JS side.
+ *
+ * Returns a list containing the raw msgpack data, the referenced objects and
+ * the fallback objects.
+ */
+
+#define TOJS_EXT_REF 1
+#define TOJS_EXT_FALLBACK 2
+#define TOJS_INIT_SIZE 1024
+#define TOJS_INIT_REFS 8
+
+struct tojs_objects {
+  SEXP x;
+  PROTECT_INDEX idx;
+  R_xlen_t n;
+};
+
+struct tojs_encoder {
+  SEXP buf;
+  PROTECT_INDEX buf_idx;
+  R_xlen_t len;
+  struct tojs_objects refs;
+  struct tojs_objects fallback;
+  int max_depth;
+};
+
+static
+void tojs_reserve(struct tojs_encoder* enc, R_xlen_t n) {
+  R_xlen_t size = XLENGTH(enc->buf);
+  if (enc->len + n <= size) {
+    return;
+  }
+  while (enc->len + n > size) {
+    size *= 2;
+  }
+  SEXP buf = Rf_allocVector(RAWSXP, size);
+  memcpy(RAW(buf), RAW(enc->buf), enc->len);
+  REPROTECT(enc->buf = buf, enc->buf_idx);
+}
+
+static inline
+void tojs_put(struct tojs_encoder* enc, const void* data, R_xlen_t n) {
+  tojs_reserve(enc, n);
+  memcpy(RAW(enc->buf) + enc->len, data, n);
+  enc->len += n;
+}
+
+static inline
+void tojs_byte(struct tojs_encoder* enc, uint8_t x) {
+  tojs_put(enc, &x, 1);
+}
+
+static inline
+void tojs_be16(struct tojs_encoder* enc, uint8_t tag, uint16_t x) {
+  uint8_t b[3] = { tag, x >> 8, x };
+  tojs_put(enc, b, 3);
+}
+
+static inline
+void tojs_be32(struct tojs_encoder* enc, uint8_t tag, uint32_t x) {
+  uint8_t b[5] = { tag, x >> 24, x >> 16, x >> 8, x };
+  tojs_put(enc, b, 5);
+}
+
+static inline
+void tojs_nil(struct tojs_encoder* enc) {
+  tojs_byte(enc, 0xc0);
+}
+
+static inline
+void tojs_bool(struct tojs_encoder* enc, int x) {
+  tojs_byte(enc, x ? 0xc3 : 0xc2);
+}
+
+static inline
+void tojs_int(struct tojs_encoder* enc, int x) {
+  if (x >= 0 && x < 128) {
+    tojs_byte(enc, x);
+  } else {
+    tojs_be32(enc, 0xd2, (uint32_t) x);
+  }
+}
+
+static inline
+void tojs_double(struct tojs_encoder* enc, double x) {
+  uint64_t bits;
+  memcpy(&bits, &x, sizeof(bits));
+  uint8_t b[9] = { 0xcb };
+  for (int i = 0; i < 8; ++i) {
+    b[i + 1] = bits >> (56 - 8 * i);
+  }
+  tojs_put(enc, b, 9);
+}
+
+static
+void tojs_str(struct tojs_encoder* enc, const char* str) {
+  size_t n = strlen(str);
+  if (n < 32) {
+    tojs_byte(enc, 0xa0 | n);
+  } else if (n < 256) {
+    uint8_t b[2] = { 0xd9, n };
+    tojs_put(enc, b, 2);
+  } else if (n < 65536) {
+    tojs_be16(enc, 0xda, n);
+  } else {
+    tojs_be32(enc, 0xdb, n);
+  }
+  tojs_put(enc, str, n);
+}
+
+static
+void tojs_array(struct tojs_encoder* enc, R_xlen_t n) {
+  if (n < 16) {
+    tojs_byte(enc, 0x90 | n);
+  } else if (n < 65536) {
+    tojs_be16(enc, 0xdc, n);
+  } else {
+    tojs_be32(enc, 0xdd, n);
+  }
+}
+
+static
+void tojs_map(struct tojs_encoder* enc, int n) {
+  tojs_byte(enc, 0x80 | n);
+}
+
+static
+void tojs_charsxp(struct tojs_encoder* enc, SEXP x) {
+  if (x == NA_STRING) {
+    tojs_nil(enc);
+  } else {
+    const void* vmax = vmaxget();
+    tojs_str(enc, Rf_translateCharUTF8(x));
+    vmaxset(vmax);
+  }
+}
+
+static
+void tojs_ext(struct tojs_encoder* enc, int8_t type, SEXP x) {
+  struct tojs_objects* objs = type == TOJS_EXT_REF ? &enc->refs : &enc->fallback;
+  if (objs->n == XLENGTH(objs->x)) {
+    REPROTECT(objs->x = Rf_xlengthgets(objs->x, 2 * objs->n), objs->idx);
+  }
+  SET_VECTOR_ELT(objs->x, objs->n, x);
+
+  // fixext 4, holding the big-endian index into the list of objects
+  uint32_t i = objs->n++;
+  uint8_t b[6] = { 0xd6, (uint8_t) type, i >> 24, i >> 16, i >> 8, i };
+  tojs_put(enc, b, 6);
+}
+
+static
+void tojs_names(struct tojs_encoder* enc, SEXP x) {
+  SEXP names = Rf_getAttrib(x, R_NamesSymbol);
+  if (names == R_NilValue) {
+    tojs_nil(enc);
+    return;
+  }
+  PROTECT(names);
+  R_xlen_t n = XLENGTH(names);
+  tojs_array(enc, n);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    tojs_charsxp(enc, STRING_ELT(names, i));
+  }
+  UNPROTECT(1);
+}
+
+static
+void tojs_encode(struct tojs_encoder* enc, SEXP x, int depth);
+
+static
+void tojs_child(struct tojs_encoder* enc, SEXP x, int depth) {
+  if (enc->max_depth && depth >= enc->max_depth) {
+    tojs_ext(enc, TOJS_EXT_REF, x);
+  } else {
+    tojs_encode(enc, x, depth + 1);
+  }
+}
+
+static
+void tojs_atomic(struct tojs_encoder* enc, SEXP x) {
+  R_xlen_t n = XLENGTH(x);
+
+  tojs_map(enc, 3);
+  tojs_str(enc, "type");
+  tojs_str(enc, Rf_type2char(TYPEOF(x)));
+  tojs_str(enc, "names");
+  tojs_names(enc, x);
+  tojs_str(enc, "values");
+  tojs_array(enc, n);
+
+  switch (TYPEOF(x)) {
+  case LGLSXP: {
+    const int* v = LOGICAL_RO(x);
+    for (R_xlen_t i = 0; i < n; ++i) {
+      if (v[i] == NA_LOGICAL) {
+        tojs_nil(enc);
+      } else {
+        tojs_bool(enc, v[i]);
+      }
+    }
+    break;
+  }
+  case INTSXP: {
+    const int* v = INTEGER_RO(x);
+    for (R_xlen_t i = 0; i < n; ++i) {
+      if (v[i] == NA_INTEGER) {
+        tojs_nil(enc);
+      } else {
+        tojs_int(enc, v[i]);
+      }
+    }
+    break;
+  }
+  case REALSXP: {
+    const double* v = REAL_RO(x);
+    for (R_xlen_t i = 0; i < n; ++i) {
+      if (ISNAN(v[i])) {
+        tojs_nil(enc);
+      } else {
+        tojs_double(enc, v[i]);
+      }
+    }
+    break;
+  }
+  case CPLXSXP: {
+    const Rcomplex* v = COMPLEX_RO(x);
+    for (R_xlen_t i = 0; i < n; ++i) {
+      if (ISNAN(v[i].r) || ISNAN(v[i].i)) {
+        tojs_nil(enc);
+      } else {
+        tojs_map(enc, 2);
+        tojs_str(enc, "re");
+        tojs_double(enc, v[i].r);
+        tojs_str(enc, "im");
+        tojs_double(enc, v[i].i);
+      }
+    }
+    break;
+  }
+  case STRSXP:
+    for (R_xlen_t i = 0; i < n; ++i) {
+      tojs_charsxp(enc, STRING_ELT(x, i));
+    }
+    break;
+  case RAWSXP: {
+    const Rbyte* v = RAW_RO(x);
+    for (R_xlen_t i = 0; i < n; ++i) {
+      tojs_int(enc, v[i]);
+    }
+    break;
+  }
+  default:
+    Rf_error("Unexpected atomic vector type.");
+  }
+}
+
+static
+void tojs_list(struct tojs_encoder* enc, SEXP x, int depth) {
+  R_xlen_t n = XLENGTH(x);
+
+  tojs_map(enc, 3);
+  tojs_str(enc, "type");
+  tojs_str(enc, "list");
+  tojs_str(enc, "names");
+  tojs_names(enc, x);
+  tojs_str(enc, "values");
+  tojs_array(enc, n);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    tojs_child(enc, VECTOR_ELT(x, i), depth);
+  }
+}
+
+static
+void tojs_pairlist(struct tojs_encoder* enc, SEXP x, int depth) {
+  R_xlen_t n = Rf_xlength(x);
+  int has_names = 0;
+
+  tojs_map(enc, 3);
+  tojs_str(enc, "type");
+  tojs_str(enc, "pairlist");
+  tojs_str(enc, "names");
+
+  for (SEXP node = x; node != R_NilValue; node = CDR(node)) {
+    has_names = has_names || TAG(node) != R_NilValue;
+  }
+  if (has_names) {
+    tojs_array(enc, n);
+    for (SEXP node = x; node != R_NilValue; node = CDR(node)) {
+      SEXP tag = TAG(node);
+      tojs_charsxp(enc, tag == R_NilValue ? R_BlankString : PRINTNAME(tag));
+    }
+  } else {
+    tojs_nil(enc);
+  }
+
+  tojs_str(enc, "values");
+  tojs_array(enc, n);
+  for (SEXP node = x; node != R_NilValue; node = CDR(node)) {
+    tojs_child(enc, CAR(node), depth);
+  }
+}
+
+static
+void tojs_environment(struct tojs_encoder* enc, SEXP x, int depth) {
+  SEXP names = PROTECT(R_lsInternal3(x, TRUE, TRUE));
+  R_xlen_t n = XLENGTH(names);
+
+  tojs_map(enc, 3);
+  tojs_str(enc, "type");
+  tojs_str(enc, "environment");
+  tojs_str(enc, "names");
+  tojs_array(enc, n);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    tojs_charsxp(enc, STRING_ELT(names, i));
+  }
+
+  tojs_str(enc, "values");
+  tojs_array(enc, n);
+  for (R_xlen_t i = 0; i < n; ++i) {
+    SEXP sym = Rf_installTrChar(STRING_ELT(names, i));
+    SEXP value = PROTECT(R_getVar(sym, x, FALSE));
+    tojs_child(enc, value, depth);
+    UNPROTECT(1);
+  }
+
+  UNPROTECT(1);
+}
+
+static
+void tojs_encode(struct tojs_encoder* enc, SEXP x, int depth) {
+  R_CheckStack();
+
+  switch (TYPEOF(x)) {
+  case NILSXP:
+    tojs_map(enc, 1);
+    tojs_str(enc, "type");
+    tojs_str(enc, "null");
+    break;
+  case CHARSXP:
+    tojs_map(enc, 2);
+    tojs_str(enc, "type");
+    tojs_str(enc, "string");
+    tojs_str(enc, "value");
+    tojs_charsxp(enc, x);
+    break;
+  case LGLSXP:
+  case INTSXP:
+  case REALSXP:
+  case CPLXSXP:
+  case STRSXP:
+  case RAWSXP:
+    tojs_atomic(enc, x);
+    break;
+  case VECSXP:
+    tojs_list(enc, x, depth);
+    break;
+  case LISTSXP:
+    tojs_pairlist(enc, x, depth);
+    break;
+  case ENVSXP:
+    tojs_environment(enc, x, depth);
+    break;
+  default:
+    tojs_ext(enc, TOJS_EXT_FALLBACK, x);
+  }
+}
+
+SEXP ffi_tojs_encode(SEXP x, SEXP depth) {
+  if (!Rf_isNumeric(depth) || LENGTH(depth) != 1) {
+    Rf_error("`depth` must be a number.");
+  }
+
+  struct tojs_encoder enc = { .len = 0, .refs = { .n = 0 }, .fallback = { .n = 0 } };
+  enc.max_depth = Rf_asInteger(depth);
+  if (enc.max_depth == NA_INTEGER || enc.max_depth < 0) {
+    enc.max_depth = 0;
+  }
+
+  PROTECT_WITH_INDEX(enc.buf = Rf_allocVector(RAWSXP, TOJS_INIT_SIZE), &enc.buf_idx);
+  PROTECT_WITH_INDEX(enc.refs.x = Rf_allocVector(VECSXP, TOJS_INIT_REFS), &enc.refs.idx);
+  PROTECT_WITH_INDEX(enc.fallback.x = Rf_allocVector(VECSXP, TOJS_INIT_REFS), &enc.fallback.idx);
+
+  tojs_encode(&enc, x, 1);
+
+  SEXP out = PROTECT(Rf_allocVector(VECSXP, 3));
+  SET_VECTOR_ELT(out, 0, Rf_xlengthgets(enc.buf, enc.len));
+  SET_VECTOR_ELT(out, 1, Rf_xlengthgets(enc.refs.x, enc.refs.n));
+  SET_VECTOR_ELT(out, 2, Rf_xlengthgets(enc.fallback.x, enc.fallback.n));
+
+  UNPROTECT(4);
+  return out;
+}
@@ -8,8 +8,7 @@
 #include <emscripten.h>
 #endif
 
-#define BUFSIZE 64
-SEXP ffi_eval_js(SEXP code, SEXP await) {
+SEXP ffi_eval_js(SEXP code, SEXP await, SEXP args) {
 #ifdef __EMSCRIPTEN__
   if (!Rf_isString(code) || LENGTH(code) != 1) {
     Rf_error("`code` must be a character string.");
@@ -27,10 +26,15 @@ SEXP ffi_eval_js(SEXP code, SEXP await) {
     Rf_error("`await` can't be `NA`.");
   }
 
-  const char *eval_template = "globalThis.Module.webr.evalJs(%p, %d)";
-  char eval_script[BUFSIZE];
-  snprintf(eval_script, BUFSIZE, eval_template, R_CHAR(STRING_ELT(code, 0)), LOGICAL(await)[0]);
-  return (SEXP) emscripten_run_script_int(eval_script);
+  if (!Rf_isNull(args) && TYPEOF(args) != VECSXP) {
+    Rf_error("`args` must be a list.");
+  }
+
+  // Call into the worker directly, rather than building a script to be
+  // evaluated by `emscripten_run_script_int()`
+  return (SEXP) EM_ASM_INT({
+    return Module.webr.evalJs($0, $1, $2);
+  }, R_CHAR(STRING_ELT(code, 0)), LOGICAL(await)[0], Rf_isNull(args) ? NULL : args);
 #else
     Rf_error("Function must be running under Emscripten.");
 #endif
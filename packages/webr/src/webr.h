@@ -3,7 +3,7 @@
 
 #include <Rinternals.h>
 
-SEXP ffi_eval_js(SEXP code, SEXP await);
+SEXP ffi_eval_js(SEXP code, SEXP await, SEXP args);
 SEXP ffi_safe_eval(SEXP call, SEXP env);
 
 #endif
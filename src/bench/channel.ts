@@ -0,0 +1,64 @@
+/**
+ * Latency and throughput benchmarks for the webR communication channels.
+ *
+ * Run from the `src` directory after building webR, with `make bench`.
+ */
+import { WebR, ChannelType } from '../webR/webr-main';
+
+const channels = {
+  SharedArrayBuffer: ChannelType.SharedArrayBuffer,
+  RingBuffer: ChannelType.RingBuffer,
+  PostMessage: ChannelType.PostMessage,
+};
+
+const ROUND_TRIPS = 2000;
+const TRANSFER_SIZE = 32 * 1024 * 1024;
+const TRANSFERS = 8;
+
+function quantile(sorted: number[], q: number) {
+  return sorted[Math.min(sorted.length - 1, Math.floor(q * sorted.length))];
+}
+
+async function bench(channelType: (typeof channels)[keyof typeof channels]) {
+  const webR = new WebR({ channelType, baseUrl: '../dist/', RArgs: ['--quiet'] });
+  await webR.init();
+
+  // Round trip latency of a minimal request
+  const times: number[] = [];
+  for (let i = 0; i < ROUND_TRIPS; i++) {
+    const start = performance.now();
+    await webR.evalRVoid('NULL');
+    times.push(performance.now() - start);
+  }
+  times.sort((a, b) => a - b);
+
+  // Throughput of large messages in each direction
+  const data = new Uint8Array(TRANSFER_SIZE).map((_, i) => i & 255);
+  let start = performance.now();
+  for (let i = 0; i < TRANSFERS; i++) {
+    await webR.FS.writeFile('/tmp/bench', data);
+  }
+  const toWorker = (TRANSFERS * TRANSFER_SIZE) / (performance.now() - start) / 1000;
+
+  start = performance.now();
+  for (let i = 0; i < TRANSFERS; i++) {
+    await webR.FS.readFile('/tmp/bench');
+  }
+  const toMain = (TRANSFERS * TRANSFER_SIZE) / (performance.now() - start) / 1000;
+
+  webR.close();
+  return {
+    'p50 (µs)': Math.round(quantile(times, 0.5) * 1000),
+    'p99 (µs)': Math.round(quantile(times, 0.99) * 1000),
+    'to worker (MB/s)': Math.round(toWorker),
+    'to main (MB/s)': Math.round(toMain),
+  };
+}
+
+void (async () => {
+  const results: { [channel: string]: Awaited<ReturnType<typeof bench>> } = {};
+  for (const [name, channelType] of Object.entries(channels)) {
+    results[name] = await bench(channelType);
+  }
+  console.table(results);
+})();
@@ -0,0 +1,71 @@
+/**
+ * Mount time and worker memory use for gzip compressed filesystem images.
+ *
+ * Run from the `src` directory after building webR, with `make bench`.
+ */
+import fs from 'fs';
+import os from 'os';
+import path from 'path';
+import zlib from 'zlib';
+import { WebR } from '../webR/webr-main';
+
+const MiB = 1024 * 1024;
+const sizes = [16, 64, 128];
+const FILE_SIZE = MiB;
+
+// Write a legacy format image of `size` bytes of CSV data, split into files
+function writeImage(dir: string, size: number) {
+  const rows: string[] = [];
+  let length = 0;
+  for (let i = 0; length < size; i++) {
+    const row = `${i},${(i * 7919) % 9973},${Math.sin(i).toFixed(6)}\n`;
+    rows.push(row);
+    length += row.length;
+  }
+  const data = Buffer.from(rows.join('')).subarray(0, size);
+  const files = [...Array(Math.ceil(size / FILE_SIZE)).keys()].map((i) => ({
+    filename: `/file${i}.csv`,
+    start: i * FILE_SIZE,
+    end: Math.min((i + 1) * FILE_SIZE, size),
+  }));
+  fs.writeFileSync(path.join(dir, 'image.data.gz'), zlib.gzipSync(data));
+  fs.writeFileSync(path.join(dir, 'image.js.metadata'), JSON.stringify({ files, gzip: true }));
+}
+
+async function bench(size: number) {
+  const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-bench-'));
+  writeImage(dir, size * MiB);
+
+  const webR = new WebR({ baseUrl: '../dist/', RArgs: ['--quiet'] });
+  await webR.init();
+  await webR.evalRVoid('dir.create("/mnt")');
+
+  // Memory use as reported by the worker thread's V8 isolate
+  const memory = async (type: 'heapUsed' | 'external') => {
+    return await webR.evalRNumber(`webr::eval_js("process.memoryUsage().${type}")`) / MiB;
+  };
+  const heap = await memory('heapUsed');
+  const external = await memory('external');
+
+  const start = performance.now();
+  await webR.evalRVoid(`webr::mount("/mnt", "${dir}/image.data.gz")`);
+  const time = performance.now() - start;
+
+  const result = {
+    'mount (ms)': Math.round(time),
+    'MB/s': Math.round((size * MiB) / time / 1000),
+    'heap (MiB)': Math.round(await memory('heapUsed') - heap),
+    'external (MiB)': Math.round(await memory('external') - external),
+  };
+  webR.close();
+  fs.rmSync(dir, { recursive: true });
+  return result;
+}
+
+void (async () => {
+  const results: { [size: string]: Awaited<ReturnType<typeof bench>> } = {};
+  for (const size of sizes) {
+    results[`${size} MiB`] = await bench(size);
+  }
+  console.table(results);
+})();
@@ -0,0 +1,43 @@
+/**
+ * Throughput benchmarks for independent R evaluations with a webR pool.
+ *
+ * Run from the `src` directory after building webR, with `make bench`.
+ */
+import { WebRPool } from '../webR/webr-main';
+
+const sizes = [1, 2, 4, 8];
+const TASKS = 64;
+
+// A CPU bound evaluation taking roughly 100ms
+const code = 'sum(sort(runif(2e5)))';
+
+async function bench(size: number) {
+  const pool = new WebRPool({ size, baseUrl: '../dist/', RArgs: ['--quiet'] });
+  await pool.init();
+
+  const start = performance.now();
+  await Promise.all([...Array(TASKS).keys()].map(() => {
+    return pool.run((webR) => webR.evalRNumber(code));
+  }));
+  const seconds = (performance.now() - start) / 1000;
+  const stats = pool.stats();
+
+  pool.close();
+  return {
+    'tasks/s': Math.round(TASKS / seconds),
+    stolen: stats.stolen,
+    utilisation: Number(stats.utilisation.toFixed(2)),
+  };
+}
+
+void (async () => {
+  const results: { [size: string]: Awaited<ReturnType<typeof bench>> } = {};
+  for (const size of sizes) {
+    results[`size ${size}`] = await bench(size);
+  }
+  const base = results['size 1']['tasks/s'];
+  for (const result of Object.values(results)) {
+    Object.assign(result, { speedup: Number((result['tasks/s'] / base).toFixed(2)) });
+  }
+  console.table(results);
+})();
@@ -0,0 +1,72 @@
+/**
+ * Throughput benchmarks for WebSockets proxied from the webR worker thread.
+ *
+ * Run from the `src` directory after building webR, with `make bench`.
+ */
+import { WebSocketServer } from 'ws';
+import { WebR, ChannelType } from '../webR/webr-main';
+
+const channels = {
+  SharedArrayBuffer: ChannelType.SharedArrayBuffer,
+  RingBuffer: ChannelType.RingBuffer,
+};
+
+const workloads = {
+  small: { size: 64, count: 20000 },
+  large: { size: 1024 * 1024, count: 64 },
+};
+
+const PORT = 7790;
+
+// Echo every message back to the client
+const server = new WebSocketServer({ port: PORT });
+server.on('connection', (ws) => {
+  ws.on('message', (data, isBinary) => ws.send(data, { binary: isBinary }));
+});
+
+async function bench(channelType: (typeof channels)[keyof typeof channels]) {
+  const webR = new WebR({ channelType, baseUrl: '../dist/', RArgs: ['--quiet'] });
+  await webR.init();
+
+  const results: { [name: string]: number } = {};
+  for (const [name, { size, count }] of Object.entries(workloads)) {
+    const start = performance.now();
+    await webR.evalRVoid(`
+      webr::eval_js('
+        globalThis.benchDone = null;
+        const client = new WebSocket("ws://localhost:${PORT}");
+        let received = 0;
+        client.onopen = () => {
+          const data = new Uint8Array(${size});
+          for (let i = 0; i < ${count}; i++) {
+            client.send(data);
+          }
+        };
+        client.onmessage = () => {
+          if (++received === ${count}) {
+            client.close();
+            globalThis.benchDone = true;
+          }
+        };
+      ')
+      while (is.na(webr::eval_js("globalThis.benchDone"))) {
+        Sys.sleep(0.01)
+      }
+    `);
+    const seconds = (performance.now() - start) / 1000;
+    results[`${name} (msg/s)`] = Math.round(count / seconds);
+    results[`${name} (MB/s)`] = Math.round((2 * size * count) / seconds / 1e6);
+  }
+
+  webR.close();
+  return results;
+}
+
+void (async () => {
+  const results: { [channel: string]: Awaited<ReturnType<typeof bench>> } = {};
+  for (const [name, channelType] of Object.entries(channels)) {
+    results[name] = await bench(channelType);
+  }
+  console.table(results);
+  server.close();
+})();
@@ -65,6 +65,7 @@ const outputs = [
   build('repl/App.tsx', { outfile: '../dist/repl.js', platform: 'browser', format: 'iife', target: ['es2022'], minify: prod }), // browser, script
   build('webR/webr-main.ts', { outfile: '../dist/webr.mjs', platform: 'browser', format: 'esm', target: ['es2022'], minify: prod }), // browser, script, type="module"
   build('webR/webr-worker.ts', { outfile: '../dist/webr-worker.js', platform: 'neutral', format: 'iife', minify: prod }), // neutral: browser & node, worker script
+  build('webR/webr-cluster-worker.ts', { outfile: '../dist/webr-cluster-worker.js', platform: 'neutral', format: 'iife', minify: prod }), // neutral: browser & node, cluster node worker script
   // These node outputs are built into `webr/src/dist` for npm distribution
   // The browser's `main.mjs` is also copied to `webr/src/dist/webr.js` for web bundlers
   build('webR/webr-main.ts', { outfile: './dist/webr.cjs', platform: 'node', format: 'cjs', minify: prod }), // node, cjs
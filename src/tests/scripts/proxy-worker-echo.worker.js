@@ -0,0 +1,5 @@
+const { parentPort } = require('node:worker_threads');
+
+parentPort.onmessage = (ev) => {
+  parentPort.postMessage(ev.data);
+};
@@ -0,0 +1,46 @@
+import { WebR } from '../../../webR/webr-main';
+import { Message } from '../../../webR/chan/message';
+import { ChannelType } from '../../../webR/chan/channel-common';
+
+const webR = new WebR({
+  channelType: ChannelType.RingBuffer,
+  baseUrl: '../dist/',
+  RArgs: ['--quiet'],
+});
+
+describe('Test communication works with ring buffer based channel', () => {
+  test('Initialises successfully', async () => {
+    await expect(webR.init()).resolves.not.toThrow();
+  });
+
+  test('Wait for a prompt', async () => {
+    let msg: Message = await webR.read();
+    while (msg.type !== 'prompt') {
+      msg = await webR.read();
+    }
+    expect(msg.data).toBe('> ');
+  });
+
+  test('Write an R command to the console', () => {
+    expect(() => webR.writeConsole('42\n')).not.toThrow();
+  });
+
+  test('Read result line from stdout', async () => {
+    expect((await webR.read()).data).toBe('[1] 42');
+  });
+
+  test('Evaluate R code and return results', async () => {
+    expect(await webR.evalRNumber('1 + 2')).toBe(3);
+    const data = new Uint8Array(4 * 1024 * 1024).map((_, i) => i & 255);
+    await webR.FS.writeFile('/tmp/ring', data);
+    expect(await webR.FS.readFile('/tmp/ring')).toEqual(data);
+  });
+
+  test('Synchronous requests are answered over the ring buffer', async () => {
+    expect(await webR.evalRNumber('webr::eval_js("Promise.resolve(1 + 2)", await = TRUE)')).toBe(3);
+  });
+});
+
+afterAll(() => {
+  return webR.close();
+});
@@ -11,6 +11,13 @@ wss.on('connection', function connection(ws) {
   });
 });
 
+const echo = new WebSocketServer({ port: 7781 });
+echo.on('connection', function connection(ws) {
+  ws.on('message', function message(data, isBinary) {
+    ws.send(data, { binary: isBinary });
+  });
+});
+
 const webR = new WebR({
   channelType: ChannelType.SharedArrayBuffer,
   baseUrl: '../dist/',
@@ -43,9 +50,47 @@ describe('Communicate over WebSocket proxy', () => {
     `)) as RRaw;
     expect(await res.toNumber()).toEqual(42);
   });
+
+  test('Stream many binary and text messages in order', async () => {
+    const res = await webR.evalRString(`
+      webr::eval_js('
+        const client = new WebSocket("ws://localhost:7781");
+        const received = [];
+        client.onopen = () => {
+          for (let i = 0; i < 500; i++) {
+            client.send(new Uint8Array(1000).fill(i & 255));
+            client.send("msg" + i);
+          }
+          client.send(new Uint8Array(3 * 1024 * 1024).fill(7));
+        };
+        client.onmessage = (ev) => {
+          received.push(ev.data);
+          if (received.length === 1001) {
+            const text = received.filter((d) => typeof d === "string");
+            const ordered = received.slice(0, 1000).every((d, i) => (i % 2)
+              ? d === "msg" + ((i - 1) / 2)
+              : d.length === 1000 && d[0] === ((i / 2) & 255));
+            const large = received[1000];
+            globalThis.streamResult = [
+              text.length, ordered, large.length, large[large.length - 1]
+            ].join(",");
+            client.close();
+          }
+        };
+        globalThis.streamResult = null;
+      ')
+
+      while (is.na(webr::eval_js("globalThis.streamResult"))) {
+        Sys.sleep(0.1)
+      }
+      webr::eval_js("globalThis.streamResult")
+    `);
+    expect(res).toEqual(`500,true,${3 * 1024 * 1024},7`);
+  });
 });
 
 afterAll(() => {
   wss.close();
+  echo.close();
   return webR.close();
 });
@@ -31,6 +31,41 @@ describe('Communicate over Worker proxy', () => {
     `));
     expect(res).toEqual("pong");
   });
+
+  test('Post R vectors to a Worker as typed arrays', async () => {
+    const res = await webR.evalR(`
+      x <- as.raw(0:255)
+      y <- c(1.5, NA, -Inf)
+      webr::eval_js('
+        var echo = new Worker("./tests/scripts/proxy-worker-echo.worker.js");
+        echo.onmessage = (ev) => globalThis.echoed.push(ev.data);
+        globalThis.echoed = [];
+        echo.postMessage(objs.globalEnv.get("x"));
+        echo.postMessage({ y: objs.globalEnv.get("y"), n: 1 });
+        echo.postMessage("done");
+      ')
+
+      while (webr::eval_js("globalThis.echoed.length") < 3) {
+        Sys.sleep(0.1)
+      }
+
+      webr::eval_js("echo.terminate()")
+      list(
+        x = webr::eval_js("new RRaw(echoed[0])"),
+        y = webr::eval_js("new RDouble(echoed[1].y)"),
+        n = webr::eval_js("echoed[1].n"),
+        done = webr::eval_js("echoed[2]")
+      )
+    `);
+    expect(await res.toJs()).toEqual(expect.objectContaining({
+      values: [
+        expect.objectContaining({ type: 'raw', values: [...Array(256).keys()] }),
+        expect.objectContaining({ type: 'double', values: [1.5, null, -Infinity] }),
+        expect.objectContaining({ values: [1] }),
+        expect.objectContaining({ values: ['done'] }),
+      ],
+    }));
+  });
 });
 
 afterAll(() => {
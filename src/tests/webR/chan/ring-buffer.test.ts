@@ -0,0 +1,152 @@
+import { RingBuffer } from '../../../webR/chan/ring-buffer';
+import {
+  encodeMessage,
+  decodeMessage,
+  encodeShared,
+  writeShared,
+  decodeShared,
+  UnencodableError,
+} from '../../../webR/chan/codec';
+
+function bytes(length: number, seed = 0) {
+  return new Uint8Array(length).map((_, i) => (i + seed) & 255);
+}
+
+describe('Ring buffer', () => {
+  test('Capacity is rounded up to a power of two', () => {
+    expect(new RingBuffer(100).capacity).toBe(1024);
+    expect(new RingBuffer(5000).capacity).toBe(8192);
+  });
+
+  test('Frames are read in the order they were written', () => {
+    const ring = new RingBuffer(1024);
+    expect(ring.tryPop()).toBeNull();
+    expect(ring.tryPush(bytes(3, 1))).toBe(true);
+    expect(ring.tryPush(bytes(0))).toBe(true);
+    expect(ring.tryPush(bytes(10, 2))).toBe(true);
+    expect(ring.tryPop()).toEqual(bytes(3, 1));
+    expect(ring.tryPop()).toEqual(bytes(0));
+    expect(ring.tryPop()).toEqual(bytes(10, 2));
+    expect(ring.tryPop()).toBeNull();
+    expect(ring.isEmpty()).toBe(true);
+  });
+
+  test('Writes fail when the buffer is full', () => {
+    const ring = new RingBuffer(1024);
+    expect(ring.tryPush(bytes(ring.maxFragment))).toBe(true);
+    expect(ring.tryPush(bytes(ring.maxFragment))).toBe(true);
+    expect(ring.tryPush(bytes(1))).toBe(false);
+    expect(ring.tryPop()).toEqual(bytes(ring.maxFragment));
+    expect(ring.tryPush(bytes(1))).toBe(true);
+  });
+
+  test('Frames wrap around the end of the buffer', () => {
+    const ring = new RingBuffer(1024);
+    for (let i = 0; i < 100; i++) {
+      expect(ring.tryPush(bytes(301, i))).toBe(true);
+      expect(ring.tryPop()).toEqual(bytes(301, i));
+    }
+  });
+
+  test('Large messages are split into fragments and reassembled', () => {
+    const ring = new RingBuffer(1024);
+    const message = bytes(1000, 7);
+    const fragments = ring.fragment(message);
+    expect(fragments.length).toBe(2);
+    expect(fragments.map(([, more]) => more)).toEqual([true, false]);
+
+    expect(ring.tryPush(...fragments[0])).toBe(true);
+    expect(ring.tryPop()).toBeNull();
+    expect(ring.tryPush(...fragments[1])).toBe(true);
+    expect(ring.tryPop()).toEqual(message);
+  });
+
+  test('Rings can be shared by wrapping the same buffer', () => {
+    const producer = new RingBuffer(1024);
+    const consumer = new RingBuffer(producer.buffer);
+    producer.push(bytes(900, 3));
+    expect(consumer.tryPop()).toEqual(bytes(900, 3));
+  });
+
+  test('Message flags are read back with the message', () => {
+    const ring = new RingBuffer(1024);
+    ring.push(bytes(10), true);
+    ring.push(bytes(10));
+    expect(ring.tryPop()).toEqual(bytes(10));
+    expect(ring.flag).toBe(true);
+    expect(ring.tryPop()).toEqual(bytes(10));
+    expect(ring.flag).toBe(false);
+  });
+
+  test('Queued messages are written in order once there is space', async () => {
+    const ring = new RingBuffer(1024);
+    const first = ring.enqueue(bytes(900, 1));
+    const second = ring.enqueue(bytes(900, 2));
+    await first;
+    expect(ring.tryPop()).toEqual(bytes(900, 1));
+    await second;
+    expect(ring.tryPop()).toEqual(bytes(900, 2));
+  });
+
+  test('Consumers ask to be woken when the buffer is empty', () => {
+    const ring = new RingBuffer(1024);
+    expect(ring.requestWake()).toBe(true);
+    ring.push(bytes(4));
+    expect(ring.wake()).toBe(true);
+    expect(ring.wake()).toBe(false);
+    expect(ring.requestWake()).toBe(false);
+  });
+});
+
+describe('Ring buffer message codec', () => {
+  test('Typed arrays keep their type', () => {
+    const msg = {
+      type: 'test',
+      data: {
+        double: new Float64Array([1.5, -2, NaN]),
+        int: new Int32Array([1, 2, 3]),
+        raw: new Uint8Array([4, 5]),
+        buf: new Uint16Array([1, 2]).buffer,
+      },
+    };
+    const decoded = decodeMessage(encodeMessage(msg));
+    expect(decoded.data.double).toBeInstanceOf(Float64Array);
+    expect(decoded.data.double).toEqual(msg.data.double);
+    expect(decoded.data.int).toEqual(msg.data.int);
+    expect(decoded.data.raw).toEqual(msg.data.raw);
+    expect(decoded.data.buf).toBeInstanceOf(ArrayBuffer);
+    expect(new Uint16Array(decoded.data.buf as ArrayBuffer)).toEqual(new Uint16Array([1, 2]));
+  });
+
+  test('Values requiring structured cloning are rejected', () => {
+    expect(() => encodeMessage({ type: 'test', data: new Error('error') })).toThrow(UnencodableError);
+  });
+});
+
+describe('Shared data buffer codec', () => {
+  test('Large typed arrays are decoded as views of the shared buffer', () => {
+    const double = new Float64Array(1000).map((_, i) => i / 2);
+    const small = new Int32Array([1, 2, 3]);
+    const encoded = encodeShared({ double, small, raw: new Uint8Array(5000).fill(9) });
+    const buffer = new Uint8Array(new SharedArrayBuffer(encoded.size));
+    writeShared(buffer, encoded);
+
+    const { value, shared } = decodeShared(buffer, encoded.header.length);
+    expect(shared).toBe(true);
+    expect(value.double).toBeInstanceOf(Float64Array);
+    expect(value.double.buffer).toBe(buffer.buffer);
+    expect(value.double).toEqual(double);
+    expect(value.small).toEqual(small);
+    expect(value.raw.buffer).toBe(buffer.buffer);
+    expect(value.raw).toEqual(new Uint8Array(5000).fill(9));
+  });
+
+  test('Values without large typed arrays do not use the shared buffer', () => {
+    const encoded = encodeShared({ type: 'test', data: [1, 'a', null] });
+    const buffer = new Uint8Array(new SharedArrayBuffer(encoded.size));
+    writeShared(buffer, encoded);
+    const { value, shared } = decodeShared(buffer, encoded.header.length);
+    expect(shared).toBe(false);
+    expect(value).toEqual({ type: 'test', data: [1, 'a', null] });
+  });
+});
@@ -0,0 +1,67 @@
+import { WebR } from '../../webR/webr-main';
+import { ChannelType } from '../../webR/chan/channel-common';
+
+const webR = new WebR({
+  channelType: ChannelType.SharedArrayBuffer,
+  baseUrl: '../dist/',
+  RArgs: ['--quiet'],
+});
+
+beforeAll(async () => {
+  await webR.init();
+});
+
+describe('Use webR workers with the parallel package', () => {
+  test('Evaluate closures across a webR cluster', async () => {
+    const result = await webR.evalRNumber(`
+      cl <- webr::make_cluster(2)
+      offset <- 10
+      f <- function(x) x^2 + offset
+      parallel::clusterExport(cl, "offset")
+      res <- parallel::parLapply(cl, 1:6, f)
+      parallel::stopCluster(cl)
+      sum(unlist(res))
+    `);
+    expect(result).toEqual(91 + 60);
+  });
+
+  test('Errors in cluster nodes are reported', async () => {
+    const throws = webR.evalRVoid(`
+      cl <- webr::make_cluster(1)
+      on.exit(parallel::stopCluster(cl))
+      parallel::clusterEvalQ(cl, stop("node failure"))
+    `);
+    await expect(throws).rejects.toThrow('node failure');
+  });
+
+  test('makeCluster and mclapply use webR workers', async () => {
+    const result = await webR.evalRRaw(`
+      webr::parallel_install()
+      cl <- parallel::makeCluster(2)
+      types <- class(cl)
+      parallel::stopCluster(cl)
+      squares <- parallel::mclapply(1:4, function(x) x^2, mc.cores = 2)
+      c(types[1], as.character(unlist(squares)))
+    `, 'string[]');
+    expect(result).toEqual(['webrcluster', '1', '4', '9', '16']);
+  });
+
+  test('mclapply gives reproducible random number streams', async () => {
+    const result = await webR.evalRRaw(`
+      webr::parallel_install()
+      RNGkind("L'Ecuyer-CMRG")
+      draw <- function() {
+        set.seed(123)
+        res <- parallel::mclapply(1:4, function(x) runif(1), mc.cores = 2)
+        unlist(res)
+      }
+      first <- draw()
+      c(identical(first, draw()), length(unique(first)) == 4)
+    `, 'boolean[]');
+    expect(result).toEqual([true, true]);
+  });
+});
+
+afterAll(() => {
+  return webR.close();
+});
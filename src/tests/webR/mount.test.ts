@@ -1,5 +1,11 @@
 import { FSMetaData, WebR } from '../../webR/webr-main';
 import fs from 'fs';
+import os from 'os';
+import path from 'path';
+import http from 'http';
+import zlib from 'zlib';
+import { execFileSync } from 'child_process';
+import type { AddressInfo } from 'net';
 
 const webR = new WebR({
   baseUrl: '../dist/',
@@ -23,6 +29,19 @@ async function cleanupMnt() {
   }
 }
 
+// The number of open file descriptors for `file` in this process, which
+// includes the webR worker thread
+function openFiles(file: string) {
+  const target = fs.realpathSync(file);
+  return fs.readdirSync('/proc/self/fd').filter((fd) => {
+    try {
+      return fs.readlinkSync(`/proc/self/fd/${fd}`) === target;
+    } catch {
+      return false;
+    }
+  }).length;
+}
+
 describe('Mount filesystem using R API', () => {
   test('Mount v1.0 filesystem image', async () => {
     await expect(webR.evalRVoid(
@@ -51,6 +70,109 @@ describe('Mount filesystem using R API', () => {
     await cleanupMnt();
   });
 
+  test('Mount v2.0 filesystem image compressed as several gzip members', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-gzip-'));
+    const tar = zlib.gunzipSync(fs.readFileSync('tests/webR/data/test_image.tar.gz'));
+    const half = Math.floor(tar.length / 2);
+    fs.writeFileSync(path.join(dir, 'multi.tar.gz'), Buffer.concat([
+      zlib.gzipSync(tar.subarray(0, half)),
+      zlib.gzipSync(tar.subarray(half)),
+    ]));
+    await expect(webR.evalRVoid(
+      `webr::mount("/mnt", "${dir}/multi.tar.gz", "workerfs")`
+    )).resolves.not.toThrow();
+    expect(await webR.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+    await cleanupMnt();
+    fs.rmSync(dir, { recursive: true });
+  });
+
+  test('Mounting a truncated gzip compressed filesystem image fails', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-gzip-'));
+    const data = fs.readFileSync('tests/webR/data/test_image.tar.gz');
+    fs.writeFileSync(path.join(dir, 'truncated.tar.gz'), data.subarray(0, data.length - 64));
+    await expect(webR.evalRVoid(
+      `webr::mount("/mnt", "${dir}/truncated.tar.gz", "workerfs")`
+    )).rejects.toThrow("Can't decompress filesystem image");
+    await cleanupMnt();
+    fs.rmSync(dir, { recursive: true });
+  });
+
+  // `test_image.vfs` holds the files `abc/bar.csv` and `abc/foo.csv` of
+  // `test_image.tar.gz`, in 16 byte blocks, created with:
+  //   Rscript tools/blockfs.R -b 16B -o src/tests/webR/data/test_image.vfs <dir>
+  test('Mount block-compressed filesystem image', async () => {
+    await expect(webR.evalRVoid(
+      'webr::mount("/mnt", "tests/webR/data/test_image.vfs", "workerfs")'
+    )).resolves.not.toThrow();
+    expect(await webR.evalRString("list.files('/mnt/abc')[2]")).toEqual("foo.csv");
+    expect(await webR.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+    expect(await webR.evalRString("readLines('/mnt/abc/foo.csv')[3]")).toEqual("7, 8, 9");
+    await cleanupMnt();
+  });
+
+  test('Mount block-compressed filesystem image created by blockfs', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-blockfs-'));
+    const files: { [name: string]: string } = {
+      'abc/bar.csv': 'a, b, c\n9, 8, 7\n4, 5, 6\n',
+      'abc/foo.csv': 'x, y, z\n1, 2, 3\n7, 8, 9\n',
+      'empty.txt': '',
+    };
+    fs.mkdirSync(path.join(dir, 'src', 'abc'), { recursive: true });
+    for (const [name, contents] of Object.entries(files)) {
+      fs.writeFileSync(path.join(dir, 'src', name), contents);
+    }
+
+    // Blocks given in bytes span file boundaries
+    const image = path.join(dir, 'test_image.vfs');
+    execFileSync('Rscript', ['../tools/blockfs.R', '-b', '16B', '-o', image, path.join(dir, 'src')]);
+    const trailer = fs.readFileSync(image).subarray(-16);
+    const offset = trailer.readInt32BE(8);
+    const metadata = JSON.parse(
+      fs.readFileSync(image).subarray(offset, offset + trailer.readInt32BE(12)).toString()
+    ) as FSMetaData;
+    expect(metadata.blocks?.size).toEqual(16);
+    expect(metadata.blocks?.offsets.length).toEqual(4);
+
+    await webR.evalRVoid(`webr::mount("/mnt", "${image}", "workerfs")`);
+    for (const [name, contents] of Object.entries(files)) {
+      const read = await webR.evalRString(
+        `rawToChar(readBin('/mnt/${name}', 'raw', file.size('/mnt/${name}')))`
+      );
+      expect(read).toEqual(contents);
+    }
+    await cleanupMnt();
+    fs.rmSync(dir, { recursive: true });
+  });
+
+  test('Mount uncompressed v2.0 filesystem image, reading files from disk', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-mount-'));
+    const tar = path.join(dir, 'test_image.tar');
+    fs.writeFileSync(tar, zlib.gunzipSync(fs.readFileSync('tests/webR/data/test_image.tar.gz')));
+    await expect(webR.evalRVoid(`webr::mount("/mnt", "${tar}", "workerfs")`)).resolves.not.toThrow();
+    expect(await webR.evalRString("list.files('/mnt/abc')[2]")).toEqual("foo.csv");
+    expect(await webR.evalRString("readLines('/mnt/abc/foo.csv')[2]")).toEqual("1, 2, 3");
+    expect(openFiles(tar)).toEqual(1);
+    await cleanupMnt();
+    expect(openFiles(tar)).toEqual(0);
+
+    // Streams left open when the image is unmounted can no longer read from it
+    await webR.evalRVoid(`webr::mount("/mnt", "${tar}", "workerfs")`);
+    await webR.evalRVoid("con <- file('/mnt/abc/foo.csv', 'rb')");
+    await cleanupMnt();
+    expect(openFiles(tar)).toEqual(0);
+    expect(await webR.evalRNumber("length(readBin(con, 'raw', 100))")).toEqual(0);
+    await webR.evalRVoid("close(con)");
+
+    // Images without a metadata hint are read in full, and not kept open
+    const noHint = path.join(dir, 'test_image_no_hint.tar');
+    fs.writeFileSync(noHint, zlib.gunzipSync(fs.readFileSync('tests/webR/data/test_image_no_hint.tgz')));
+    await expect(webR.evalRVoid(`webr::mount("/mnt", "${noHint}", "workerfs")`)).resolves.not.toThrow();
+    expect(await webR.evalRString("readLines('/mnt/abc/foo.csv')[2]")).toEqual("1, 2, 3");
+    expect(openFiles(noHint)).toEqual(0);
+    await cleanupMnt();
+    fs.rmSync(dir, { recursive: true });
+  });
+
   test('Mount filesystem image from URL', async () => {
     const url = "https://repo.r-wasm.org/bin/emscripten/contrib/4.4/cli_3.6.3.js.metadata";
     await expect(webR.evalRVoid(`
@@ -102,3 +224,147 @@ describe('Mount filesystem using JS API', () => {
     await cleanupMnt();
   });
 });
+
+describe('Lazily mount filesystem images over HTTP', () => {
+  const requests: { url?: string; range?: string; etag?: string }[] = [];
+  let server: http.Server;
+  let baseUrl: string;
+
+  // A static file server supporting single `Range` requests
+  beforeAll(async () => {
+    const files: { [name: string]: Buffer } = {
+      '/test_image.data': fs.readFileSync('tests/webR/data/test_image.data'),
+      '/test_image.js.metadata': fs.readFileSync('tests/webR/data/test_image.js.metadata'),
+      '/test_image.tar': zlib.gunzipSync(fs.readFileSync('tests/webR/data/test_image.tar.gz')),
+      '/test_image.tgz': fs.readFileSync('tests/webR/data/test_image.tar.gz'),
+      '/test_image.vfs': fs.readFileSync('tests/webR/data/test_image.vfs'),
+      '/repo/PACKAGES': Buffer.from([
+        'Package: foo\nVersion: 1.0.0\nDepends: R (>= 4.0.0), bar\nMD5sum: abc123\n',
+        'Package: bar\nVersion: 2.1\nImports: stats,\n    utils (>= 4.0)\n',
+      ].join('\n')),
+    };
+    server = http.createServer((req, res) => {
+      const etag = req.headers['if-none-match'];
+      requests.push({ url: req.url, range: req.headers.range, etag });
+      const file = files[req.url ?? ''];
+      if (!file) {
+        res.writeHead(404).end();
+        return;
+      }
+      const match = /^bytes=(\d*)-(\d*)$/.exec(req.headers.range ?? '');
+      if (!match) {
+        res.writeHead(etag === '"v1"' ? 304 : 200, { ETag: '"v1"' }).end(etag ? undefined : file);
+        return;
+      }
+      const start = match[1] ? Number(match[1]) : Math.max(0, file.length - Number(match[2]));
+      const end = match[1] && match[2] ? Math.min(Number(match[2]) + 1, file.length) : file.length;
+      res.writeHead(206, { 'Content-Range': `bytes ${start}-${end - 1}/${file.length}` });
+      res.end(file.subarray(start, end));
+    });
+    await new Promise<void>((resolve) => server.listen(0, '127.0.0.1', resolve));
+    baseUrl = `http://127.0.0.1:${(server.address() as AddressInfo).port}`;
+  });
+
+  beforeEach(() => {
+    requests.length = 0;
+  });
+
+  afterAll(() => {
+    server.close();
+  });
+
+  test('Mount v1.0 filesystem image, reading files on demand', async () => {
+    await webR.evalRVoid(`webr::mount("/mnt", "${baseUrl}/test_image.data", lazy = TRUE)`);
+    expect(requests).toEqual([{ url: '/test_image.js.metadata', range: undefined }]);
+
+    expect(await webR.evalRString("list.files('/mnt/abc')[2]")).toEqual("foo.csv");
+    expect(await webR.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+    expect(await webR.evalRString("readLines('/mnt/abc/foo.csv')[2]")).toEqual("1, 2, 3");
+    expect(requests.slice(1)).toEqual([{ url: '/test_image.data', range: 'bytes=0-65535' }]);
+    await cleanupMnt();
+    expect(await webR.evalRNumber("length(list.files('/mnt'))")).toEqual(0);
+  });
+
+  test('Mount v2.0 uncompressed filesystem image with metadata hint', async () => {
+    await webR.evalRVoid(`webr::mount("/mnt", "${baseUrl}/test_image.tar", lazy = TRUE)`);
+    expect(requests.every((req) => req.range)).toBe(true);
+    expect(await webR.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+    await cleanupMnt();
+  });
+
+  test('Mount block-compressed filesystem image, reading blocks on demand', async () => {
+    await webR.evalRVoid(`webr::mount("/mnt", "${baseUrl}/test_image.vfs", lazy = TRUE)`);
+    expect(requests.every((req) => req.range)).toBe(true);
+    expect(await webR.evalRString("readLines('/mnt/abc/foo.csv')[2]")).toEqual("1, 2, 3");
+    await cleanupMnt();
+  });
+
+  test('Mount filesystem images from the persistent package cache', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-packages-'));
+    const mountImages = async (cached: WebR) => {
+      await cached.init();
+      await cached.evalRVoid('dir.create("/mnt")');
+      for (const image of ['test_image.data', 'test_image.tar', 'test_image.vfs']) {
+        await cached.evalRVoid(`webr::mount("/mnt", "${baseUrl}/${image}")`);
+        expect(await cached.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+        await cached.FS.unmount('/mnt');
+      }
+      cached.close();
+    };
+
+    await mountImages(new WebR({ baseUrl: '../dist/', RArgs: ['--quiet'], packageCache: { dir } }));
+    const downloads = requests.length;
+    expect(downloads).toBeGreaterThan(0);
+    // Images without a known hash are cached along with their ETag
+    expect(fs.readdirSync(dir).length).toEqual(2 * downloads);
+
+    // A new session revalidates the cached images, rather than downloading them
+    requests.length = 0;
+    await mountImages(new WebR({ baseUrl: '../dist/', RArgs: ['--quiet'], packageCache: { dir } }));
+    expect(requests.length).toEqual(downloads);
+    expect(requests.every((req) => req.etag === '"v1"')).toBe(true);
+    fs.rmSync(dir, { recursive: true });
+  });
+
+  test('Prefetched images are cached as served, and mounted from the cache', async () => {
+    const dir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-packages-'));
+    const cached = new WebR({ baseUrl: '../dist/', RArgs: ['--quiet'], packageCache: { dir } });
+    await cached.init();
+    await cached.evalRVoid(`
+      .Call(webr:::ffi_prefetch_images, "${baseUrl}/test_image.tgz", "abc123", 2L)
+    `);
+    const entries = fs.readdirSync(dir);
+    expect(entries.length).toEqual(1);
+    expect(fs.readFileSync(path.join(dir, entries[0])))
+      .toEqual(fs.readFileSync('tests/webR/data/test_image.tar.gz'));
+
+    requests.length = 0;
+    await cached.evalRVoid('dir.create("/mnt")');
+    await cached.evalRVoid(`
+      .Call(webr:::ffi_mount_workerfs, "${baseUrl}/test_image.tgz", "/mnt", FALSE, "abc123")
+    `);
+    expect(await cached.evalRString("readLines('/mnt/abc/bar.csv')[1]")).toEqual("a, b, c");
+    expect(requests).toEqual([]);
+    cached.close();
+    fs.rmSync(dir, { recursive: true });
+  });
+
+  test('Index repo metadata, revalidating it with the ETag', async () => {
+    await webR.evalRVoid(`index <- webr:::repo_index("${baseUrl}/repo")`);
+    expect(await webR.evalRString('index$foo$version')).toEqual('1.0.0');
+    expect(await webR.evalRString('index$foo$hash')).toEqual('abc123');
+    expect(await webR.evalRString('index$foo$repository')).toEqual(`${baseUrl}/repo`);
+    expect(await webR.evalRString('paste(index$bar$deps, collapse = " ")')).toEqual('stats utils');
+
+    // The unchanged index is reused, without downloading the metadata again
+    await webR.evalRVoid(`
+      assign("foo", list(version = "cached"), envir = webr:::repo_state[["${baseUrl}/repo"]])
+    `);
+    await webR.evalRVoid(`index <- webr:::repo_index("${baseUrl}/repo")`);
+    expect(await webR.evalRString('index$foo$version')).toEqual('cached');
+    expect(requests).toEqual([
+      { url: '/repo/PACKAGES', range: undefined, etag: undefined },
+      { url: '/repo/PACKAGES', range: undefined, etag: '"v1"' },
+    ]);
+  });
+});
@@ -1,5 +1,5 @@
 import { WebR } from '../../webR/webr-main';
-import { RDouble, RFunction, RList } from '../../webR/robj-main';
+import { isRObject, RCharacter, RDouble, REnvironment, RFunction, RList } from '../../webR/robj-main';
 import util from 'util';
 
 const webR = new WebR({
@@ -74,6 +74,36 @@ test('R atomic vector objects can be iterated over with `for await`', async () =
   expect(result).toEqual([6, 10, 12, 14, 18, 20, 22, 24, 26]);
 });
 
+test('R atomic vector objects can be iterated over in chunks', async () => {
+  const vec = (await webR.evalR('as.double(1:10)')) as RDouble;
+  const result: Float64Array[] = [];
+  for await (const chunk of vec.chunks({ size: 4 })) {
+    result.push(chunk as Float64Array);
+  }
+  expect(result.map((c) => Array.from(c))).toEqual([[1, 2, 3, 4], [5, 6, 7, 8], [9, 10]]);
+});
+
+test('R character vectors can be iterated over in chunks', async () => {
+  const vec = (await webR.evalR('c("a", NA, "c")')) as RCharacter;
+  const result: (string | null)[][] = [];
+  for await (const chunk of vec.chunks({ size: 2 })) {
+    result.push(chunk as (string | null)[]);
+  }
+  expect(result).toEqual([['a', null], ['c']]);
+});
+
+test('R list objects can be iterated over in chunks', async () => {
+  const list = (await webR.evalR('list(1, "b", TRUE)')) as RList;
+  const result: unknown[] = [];
+  for await (const chunk of list.chunks({ size: 2 })) {
+    expect(chunk.length).toBeLessThanOrEqual(2);
+    for (const elem of chunk) {
+      result.push((await elem.toJs()).values[0]);
+    }
+  }
+  expect(result).toEqual([1, 'b', true]);
+});
+
 test('Other R objects cannot use the apply hook', async () => {
   const notFn = await webR.evalR('123');
   // @ts-expect-error Deliberate type error to test Error thrown
@@ -81,6 +111,59 @@ test('Other R objects cannot use the apply hook', async () => {
   expect(() => notFn(8)).toThrow('is not a function');
 });
 
+test('Piped method calls are evaluated in a single request', async () => {
+  const model = (await webR.evalR('list(coefficients = c(a = 1.5, b = 2.5))')) as RList;
+  const before = (await webR.metrics()).main.requests.callRObjectMethod?.total.count ?? 0;
+  const value = await model.pipe().get('coefficients').get(2).toNumber();
+  const after = (await webR.metrics()).main.requests.callRObjectMethod.total.count;
+  expect(value).toEqual(2.5);
+  expect(after - before).toEqual(1);
+});
+
+test('Each piped method call is evaluated exactly once', async () => {
+  await webR.evalR('n <- 0; f <- function() { n <<- n + 1; list(a = 1, b = 2) }');
+  const fn = (await webR.evalR('f')) as RFunction;
+  const res = fn.pipe().exec();
+  const values = await Promise.all([res.get('a').toNumber(), res.get('b').toNumber()]);
+  expect(values).toEqual([1, 2]);
+  expect(isRObject(await res)).toBe(true);
+  expect(await res.get('a').toNumber()).toEqual(1);
+  expect(await webR.evalRNumber('n')).toEqual(1);
+});
+
+test('Piped method calls can end with a conversion on the main thread', async () => {
+  const obj = (await webR.evalR('list(x = list(a = 1, b = "c"))')) as RList;
+  expect(await obj.pipe().get('x').toJs()).toEqual(
+    expect.objectContaining({ type: 'list', names: ['a', 'b'] })
+  );
+  const chunks = await obj.pipe().get('x').chunks({ size: 1 });
+  let count = 0;
+  for await (const _chunk of chunks) {
+    count++;
+  }
+  expect(count).toEqual(2);
+});
+
+test('Piped method calls on values that are not R objects are rejected', async () => {
+  const model = (await webR.evalR('list(a = 1)')) as RList;
+  // @ts-expect-error Deliberate type error to test Error thrown
+  // eslint-disable-next-line @typescript-eslint/no-unsafe-call
+  await expect(model.pipe().get('a').toNumber().get(1)).rejects.toThrow('not an R object');
+});
+
+test('Method calls return promises', async () => {
+  const obj = (await webR.evalR('list(a = 1)')) as RList;
+  const res = obj.get('a');
+  expect(res).toBeInstanceOf(Promise);
+  await res;
+});
+
+test('Unawaited method calls are sent in order with other requests', async () => {
+  const env = (await webR.evalR('new.env()')) as REnvironment;
+  void env.bind('x', 42);
+  expect(await webR.evalRNumber('x', { env })).toEqual(42);
+});
+
 afterAll(() => {
   return webR.close();
 });
@@ -1,6 +1,7 @@
 /* eslint-disable @typescript-eslint/await-thenable */
 import { WebR } from '../../webR/webr-main';
 import * as RMain from '../../webR/robj-main';
+import { WebRDataJsNode } from '../../webR/robj';
 import {
   RCharacter,
   RComplex,
@@ -16,6 +17,12 @@ import {
   RRaw,
   RSymbol,
 } from '../../webR/robj-main';
+import v8 from 'v8';
+import vm from 'vm';
+
+// Expose the garbage collector, as with `node --expose-gc`
+v8.setFlagsFromString('--expose-gc');
+const gc = vm.runInNewContext('gc') as () => void;
 
 const webR = new WebR({
   baseUrl: '../dist/',
@@ -419,6 +426,67 @@ describe('Working with R lists and vectors', () => {
     convert = await result.toJs({ depth: 1 });
     expect(RMain.isRObject(convert.values[0])).toEqual(true);
   });
+
+  test('Convert a deeply nested R list to JS', async () => {
+    const result = (await webR.evalR(`
+      list(
+        a = list(b = list(c(1.5, NA, NaN), c(x = 1L, NA)), d = c(TRUE, NA)),
+        e = list("abc", NA_character_, as.raw(c(0, 255)), c(1+2i, NA)),
+        f = pairlist(g = quote(sym), 2L),
+        NULL
+      )
+    `)) as RList;
+    const convert = await result.toJs();
+    expect(convert).toEqual({
+      type: 'list',
+      names: ['a', 'e', 'f', ''],
+      values: [
+        {
+          type: 'list',
+          names: ['b', 'd'],
+          values: [
+            {
+              type: 'list',
+              names: null,
+              values: [
+                { type: 'double', names: null, values: [1.5, null, null] },
+                { type: 'integer', names: ['x', ''], values: [1, null] },
+              ],
+            },
+            { type: 'logical', names: null, values: [true, null] },
+          ],
+        },
+        {
+          type: 'list',
+          names: null,
+          values: [
+            { type: 'character', names: null, values: ['abc'] },
+            { type: 'character', names: null, values: [null] },
+            { type: 'raw', names: null, values: [0, 255] },
+            { type: 'complex', names: null, values: [{ re: 1, im: 2 }, null] },
+          ],
+        },
+        {
+          type: 'pairlist',
+          names: ['g', ''],
+          values: [
+            expect.objectContaining({ type: 'symbol', printname: 'sym' }),
+            { type: 'integer', names: null, values: [2] },
+          ],
+        },
+        { type: 'null' },
+      ],
+    });
+  });
+
+  test('Convert a deeply nested R list to JS with a given depth', async () => {
+    const result = (await webR.evalR('list(a = list(b = list(1), c = 2))')) as RList;
+    const convert = await result.toJs({ depth: 2 });
+    const inner = convert.values[0] as WebRDataJsNode;
+    expect(inner.names).toEqual(['b', 'c']);
+    expect(RMain.isRObject(inner.values[0])).toEqual(true);
+    expect(await (inner.values[1] as RDouble).toNumber()).toEqual(2);
+  });
 });
 
 describe('Working with R environments', () => {
@@ -671,6 +739,64 @@ describe('Garbage collection', () => {
     expect(await shelter.size()).toEqual(0);
   });
 
+  test('Objects destroyed in a batch', async () => {
+    const shelter = await new webR.Shelter();
+    const objs = await Promise.all([...Array(100).keys()].map((i) => shelter.evalR(`${i}`)));
+    expect(await shelter.size()).toEqual(100);
+
+    await shelter.destroy(objs.slice(0, 50));
+    expect(await shelter.size()).toEqual(50);
+
+    // Released slots are reused, but stale references remain invalid
+    const x = await shelter.evalR('1');
+    expect(await shelter.size()).toEqual(51);
+    await expect(shelter.destroy(objs[0])).rejects.toThrow("Can't find object in shelter");
+    expect(await shelter.size()).toEqual(51);
+
+    await shelter.destroy([x, ...objs.slice(50)]);
+    expect(await shelter.size()).toEqual(0);
+
+    await shelter.evalR('1');
+    await shelter.purge();
+    expect(await shelter.size()).toEqual(0);
+    await expect(shelter.destroy(x)).rejects.toThrow("Can't find object in shelter");
+  });
+
+  test('Live objects are counted per shelter', async () => {
+    const shelter = await new webR.Shelter();
+    expect(shelter.stats()).toEqual({ live: 0, pending: 0, released: 0 });
+
+    const x = await shelter.evalR('1');
+    const y = await new shelter.RDouble(2);
+    const z = await shelter.captureR('3');
+    expect(shelter.stats().live).toEqual(3);
+
+    await shelter.destroy([x, y]);
+    expect(shelter.stats().live).toEqual(1);
+
+    await shelter.purge();
+    expect(shelter.stats().live).toEqual(0);
+    expect(z.result).toBeDefined();
+  });
+
+  test('Live objects are released once their proxies are garbage collected', async () => {
+    const shelter = await new webR.Shelter();
+    // The proxy is not reachable once the function returns
+    await (async () => {
+      await shelter.evalR('1');
+    })();
+    expect(shelter.stats().live).toEqual(1);
+
+    // Finalizers run some time after the proxy has been collected
+    for (let i = 0; i < 50 && shelter.stats().live > 0; i++) {
+      gc();
+      await new Promise((resolve) => setTimeout(resolve, 10));
+    }
+    const stats = shelter.stats();
+    expect(stats.live).toEqual(0);
+    expect(stats.pending + stats.released).toEqual(1);
+  });
+
   test('Shelter.CaptureR() protects', async () => {
     const shelter = await new webR.Shelter();
 
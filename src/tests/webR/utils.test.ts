@@ -1,5 +1,47 @@
-import { sleep } from '../../webR/utils';
+import { fetchAll, sleep } from '../../webR/utils';
+import http from 'http';
+import zlib from 'zlib';
+import type { AddressInfo } from 'net';
 
 test('Utils sleep', async () => {
   await expect(sleep(100)).resolves.not.toThrow();
 });
+
+test('Download and decompress files concurrently', async () => {
+  const content = Buffer.from([...Array(512 * 1024).keys()].map((i) => (i * 7) % 251));
+  const half = content.length / 2;
+  const files: { [url: string]: Buffer } = {
+    '/single.tgz': zlib.gzipSync(content),
+    '/multi.tgz': Buffer.concat([
+      zlib.gzipSync(content.subarray(0, half)),
+      zlib.gzipSync(content.subarray(half)),
+    ]),
+    '/truncated.tgz': zlib.gzipSync(content).subarray(0, 1024),
+    '/plain.tar': content,
+  };
+  const server = http.createServer((req, res) => {
+    const file = files[req.url ?? ''];
+    if (file) {
+      res.writeHead(200, { 'Content-Length': file.length }).end(file);
+    } else {
+      res.writeHead(404).end();
+    }
+  });
+  await new Promise<void>((resolve) => server.listen(0, '127.0.0.1', resolve));
+  const baseUrl = `http://127.0.0.1:${(server.address() as AddressInfo).port}`;
+
+  const paths = ['/single.tgz', '/multi.tgz', '/truncated.tgz', '/plain.tar', '/missing.tgz'];
+  const results = await fetchAll(paths.map((path) => `${baseUrl}${path}`), 2, true);
+  server.close();
+
+  // Without DecompressionStream, compressed images are returned as received
+  const decompress = 'DecompressionStream' in globalThis;
+  const gunzip = (data: Buffer) => decompress ? zlib.gunzipSync(data) : data;
+  expect(Buffer.from(results[0]!)).toEqual(gunzip(files['/single.tgz']));
+  expect(Buffer.from(results[1]!)).toEqual(gunzip(files['/multi.tgz']));
+  if (decompress) {
+    expect(results[2]).toBeNull();
+  }
+  expect(Buffer.from(results[3]!)).toEqual(content);
+  expect(results[4]).toBeNull();
+});
@@ -45,6 +45,26 @@ describe('Test webR simple console input/output', () => {
   test('Read result line from stdout', async () => {
     expect((await webR.read()).data).toBe('[1] 42');
   });
+
+  test('Read many lines of interleaved output in order', async () => {
+    let msg = await webR.read();
+    while (msg.type !== 'prompt') {
+      msg = await webR.read();
+    }
+    webR.writeConsole('for (i in 1:5000) { cat(i, "\\n"); if (i %% 1000 == 0) message(i) }');
+    const output: Message[] = [];
+    msg = await webR.read();
+    while (msg.type !== 'prompt') {
+      output.push(msg);
+      msg = await webR.read();
+    }
+    expect(output.length).toBe(5005);
+    expect(output.filter((m) => m.type === 'stdout').map((m) => m.data)).toEqual(
+      Array.from({ length: 5000 }, (_, i) => `${i + 1} `)
+    );
+    expect(output[1000]).toEqual({ type: 'stderr', data: '1000' });
+    expect(output[5004]).toEqual({ type: 'stderr', data: '5000' });
+  });
 });
 
 describe('Evaluate R code', () => {
@@ -249,6 +269,30 @@ describe('Evaluate R code', () => {
     expect(result.images.length).toBeGreaterThan(0);
     void shelter.purge();
   });
+
+  test('Pass R vectors as arguments to webr::eval_js', async () => {
+    const result = await webR.evalRNumber(`
+      total <- 0
+      for (i in 1:100) {
+        total <- total + webr::eval_js(
+          "x.reduce((a, b) => a + b, 0) + y.length + z.length + i[0]",
+          args = list(x = c(1, 2, 3), y = as.raw(1:4), z = 1:5, i = i)
+        )
+      }
+      total
+    `);
+    expect(result).toEqual(100 * (6 + 4 + 5) + 5050);
+  });
+
+  test('Statements and expressions both evaluate with webr::eval_js', async () => {
+    const result = await webR.evalRNumber(`
+      webr::eval_js("var evalJsTest = 40; evalJsTest + 1")
+      webr::eval_js("evalJsTest + 2")
+    `);
+    expect(result).toEqual(42);
+    const throws = webR.evalRVoid('webr::eval_js("x; y", args = list(x = 1))');
+    await expect(throws).rejects.toThrow('single JavaScript expression');
+  });
 });
 
 describe('Create R objects using serialised form', () => {
@@ -982,6 +1026,37 @@ describe('Interrupt execution', () => {
     setTimeout(() => webR.interrupt(), 100);
     await expect(loop).rejects.toThrow('A non-local transfer of control occurred');
   });
+
+  test('Interrupt R code waiting in Sys.sleep', async () => {
+    const sleep = webR.evalRVoid('Sys.sleep(60)');
+    setTimeout(() => webR.interrupt(), 100);
+    await expect(sleep).rejects.toThrow('A non-local transfer of control occurred');
+    const stats = webR.eventStats();
+    expect(stats.pending).toEqual(0);
+    expect(stats.delivered).toBeGreaterThan(0);
+    expect(stats.maxLatency).toBeGreaterThanOrEqual(stats.meanLatency);
+  });
+});
+
+test('Report communication channel metrics', async () => {
+  await webR.evalRVoid('Sys.sleep(0.1)');
+  const metrics = await webR.metrics();
+  const evalR = metrics.main.requests.evalRRaw;
+  expect(evalR.total.count).toBeGreaterThan(0);
+  expect(evalR.execution.max).toBeGreaterThanOrEqual(100);
+  expect(evalR.total.mean).toBeGreaterThanOrEqual(evalR.execution.mean);
+  expect(metrics.main.sent.evalRRaw).toEqual(evalR.total.count);
+  expect(metrics.main.bytesSent).toBeGreaterThan(0);
+  expect(metrics.worker.syncRequests.read.count).toBeGreaterThan(0);
+});
+
+test('Small synchronous requests after a large one reuse pooled buffers', async () => {
+  await webR.evalRVoid('webr::eval_js("new Uint8Array(8 * 1024 * 1024)", await = TRUE)');
+  await webR.evalRVoid('webr::eval_js("1", await = TRUE)');
+  const before = (await webR.metrics()).worker.syncBufferAllocations;
+  await webR.evalRVoid('webr::eval_js("2", await = TRUE)');
+  const after = (await webR.metrics()).worker.syncBufferAllocations;
+  expect(after).toEqual(before);
 });
 
 test('Invoke a wasm function from the main thread', async () => {
@@ -1080,6 +1155,91 @@ test('WebR starts and is usable without lazy filesystem entries', async () => {
   tempR.close();
 });
 
+test('Session state does not leak across a rollback', async () => {
+  const tempR = new WebR({ baseUrl: '../dist/', RArgs: ['--quiet'] });
+  await tempR.init();
+  await tempR.evalRVoid(`
+    y <- "before"
+    writeLines("original", "existing.txt")
+  `);
+  await tempR.checkpoint();
+
+  for (let i = 0; i < 2; i++) {
+    await tempR.evalRVoid(`
+      x <- 1
+      y <- "after"
+      options(webr.checkpoint.test = TRUE)
+      Sys.setenv(WEBR_CHECKPOINT_TEST = "1")
+      library(splines)
+      setwd(tempdir())
+      writeLines("changed", "~/existing.txt")
+      writeLines("new", "~/new.txt")
+      dir.create("~/newdir")
+      con <- file("~/newdir/open.txt", "w")
+      dir.create(file.path(.libPaths()[1], "leaked"))
+      writeLines("Package: leaked", file.path(.libPaths()[1], "leaked", "DESCRIPTION"))
+    `);
+    await tempR.FS.mkdir('/home/web_user/mnt');
+    await tempR.FS.mount('MEMFS', {}, '/home/web_user/mnt');
+    await tempR.rollback();
+
+    const state = await tempR.evalRRaw(`c(
+      exists("x"),
+      y == "before",
+      is.null(getOption("webr.checkpoint.test")),
+      nzchar(Sys.getenv("WEBR_CHECKPOINT_TEST")),
+      "package:splines" %in% search(),
+      "splines" %in% loadedNamespaces(),
+      getwd() == path.expand("~"),
+      readLines("existing.txt") == "original",
+      file.exists("new.txt"),
+      dir.exists("newdir"),
+      nrow(showConnections()) > 0,
+      dir.exists("mnt"),
+      dir.exists(file.path(.libPaths()[1], "leaked")),
+      dir.exists(file.path(.libPaths()[1], "base"))
+    )`, 'boolean[]');
+    expect(state).toEqual([
+      false, true, true, false, false, false, true, true, false, false, false, false, false, true,
+    ]);
+  }
+  tempR.close();
+});
+
+test('WebR restores a cached warm-up snapshot', async () => {
+  const fs = await import('fs');
+  const os = await import('os');
+  const path = await import('path');
+  const cacheDir = fs.mkdtempSync(path.join(os.tmpdir(), 'webr-snapshot-'));
+  const warmup = {
+    script: `
+      library(tools)
+      options(webr.snapshot.test = 'warm')
+      dir.create('data')
+      writeLines('hello', 'data/greeting.txt')
+      x <- runif(1)
+    `,
+    paths: ['/home/web_user/data'],
+    cacheDir,
+  };
+
+  const firstR = new WebR({ baseUrl: '../dist/', warmup });
+  await firstR.init();
+  const x = await firstR.evalRNumber('x');
+  firstR.close();
+  expect(fs.readdirSync(cacheDir)).toHaveLength(1);
+
+  // A new instance restores the snapshot, rather than running the script
+  const tempR = new WebR({ baseUrl: '../dist/', warmup });
+  await tempR.init();
+  expect(await tempR.evalRNumber('x')).toEqual(x);
+  expect(await tempR.evalRBoolean('"package:tools" %in% search()')).toEqual(true);
+  expect(await tempR.evalRString('getOption("webr.snapshot.test")')).toEqual('warm');
+  expect(await tempR.evalRString('readLines("data/greeting.txt")')).toEqual('hello');
+  tempR.close();
+  fs.rmSync(cacheDir, { recursive: true });
+});
+
 test('Async generator streams worker messages', async () => {
   const tempR = new WebR({ baseUrl: '../dist/' });
   await tempR.init();
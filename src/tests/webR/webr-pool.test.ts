@@ -0,0 +1,121 @@
+import { WebRPool } from '../../webR/webr-main';
+import { RDouble } from '../../webR/robj-main';
+
+const pool = new WebRPool({
+  size: 2,
+  baseUrl: '../dist/',
+  RArgs: ['--quiet'],
+  mounts: [{ type: 'NODEFS', options: { root: 'tests/webR/data/testing' }, mountpoint: '/mnt/testing' }],
+});
+
+beforeAll(async () => {
+  await pool.init();
+});
+
+describe('Run tasks with a pool of webR instances', () => {
+  test('Evaluate R code across the pool', async () => {
+    const results = await Promise.all([...Array(8).keys()].map(async (i) => {
+      const result = await pool.evalR(`${i} * 2`) as RDouble;
+      const value = await result.toNumber();
+      await pool.destroy(result);
+      return value;
+    }));
+    expect(results).toEqual([0, 2, 4, 6, 8, 10, 12, 14]);
+  });
+
+  test('Tasks are balanced across instances', async () => {
+    const before = pool.stats().instances.map((stats) => stats.completed);
+    await Promise.all([...Array(8).keys()].map(() => {
+      return pool.run((webR) => webR.evalRVoid('Sys.sleep(0.2)'));
+    }));
+    const completed = pool.stats().instances.map((stats, i) => stats.completed - before[i]);
+    expect(completed[0]).toBeGreaterThanOrEqual(1);
+    expect(completed[1]).toBeGreaterThanOrEqual(1);
+    expect(completed[0] + completed[1]).toEqual(8);
+  });
+
+  test('Idle instances steal queued tasks', async () => {
+    const before = pool.stats().stolen;
+    // Tasks queued behind a slow session task are taken by the other instance
+    const slow = pool.run((webR) => webR.evalRVoid('Sys.sleep(1)'), { session: 'slow' });
+    await Promise.all([...Array(10).keys()].map(() => {
+      return pool.run((webR) => webR.evalRVoid('Sys.sleep(0.05)'));
+    }));
+    await slow;
+    pool.endSession('slow');
+    expect(pool.stats().stolen).toBeGreaterThan(before);
+  });
+
+  test('Tasks in a session keep R state', async () => {
+    await pool.run((webR) => webR.evalRVoid('x <- 1'), { session: 'counter' });
+    for (let i = 0; i < 4; i++) {
+      await pool.run((webR) => webR.evalRVoid('x <- x + 1'), { session: 'counter' });
+    }
+    const x = await pool.run((webR) => webR.evalRNumber('x'), { session: 'counter' });
+    expect(x).toEqual(5);
+    pool.endSession('counter');
+  });
+
+  test('Capture output with an instance from the pool', async () => {
+    const { result, output } = await pool.captureR('print(123); 456');
+    expect(await (result as RDouble).toNumber()).toEqual(456);
+    expect(output).toEqual([{ type: 'stdout', data: '[1] 123' }]);
+    await pool.destroy(result);
+  });
+
+  test('Filesystems are mounted in every instance', async () => {
+    // Each session is assigned to a different instance, as the least loaded
+    const before = pool.stats().instances.map((stats) => stats.completed);
+    const found = await Promise.all(['mount-a', 'mount-b'].map((session) => {
+      return pool.run((webR) => webR.evalRBoolean('dir.exists("/mnt/testing")'), { session });
+    }));
+    const completed = pool.stats().instances.map((stats, i) => stats.completed - before[i]);
+    pool.endSession('mount-a');
+    pool.endSession('mount-b');
+    expect(completed).toEqual([1, 1]);
+    expect(found).toEqual([true, true]);
+  });
+
+  test('Report queue depth and utilisation', async () => {
+    const stats = pool.stats();
+    expect(stats.instances.length).toEqual(2);
+    expect(stats.queued).toEqual(0);
+    expect(stats.completed).toBeGreaterThan(20);
+    expect(stats.utilisation).toBeGreaterThan(0);
+    expect(stats.utilisation).toBeLessThanOrEqual(1);
+  });
+});
+
+describe('Close a pool of webR instances', () => {
+  test('Running and queued tasks are rejected', async () => {
+    const closing = new WebRPool({ size: 1, baseUrl: '../dist/', RArgs: ['--quiet'] });
+    await closing.init();
+    const running = closing.run((webR) => webR.evalRVoid('Sys.sleep(10)'));
+    const queued = closing.run((webR) => webR.evalRVoid('1'), { session: 'queued' });
+    expect(closing.stats().running).toEqual(1);
+    closing.close();
+    await expect(running).rejects.toThrow('The webR pool has been closed.');
+    await expect(queued).rejects.toThrow('The webR pool has been closed.');
+  });
+
+  test('Tasks for an instance that failed to start are rejected', async () => {
+    const failing = new WebRPool({
+      size: 1,
+      baseUrl: '../dist/',
+      RArgs: ['--quiet'],
+      mounts: [{ type: 'NODEFS', options: { root: 'tests/webR/data/missing' }, mountpoint: '/mnt/missing' }],
+    });
+    const pinned = failing.run((webR) => webR.evalRNumber('1'), { session: 'pinned' });
+    const shared = failing.run((webR) => webR.evalRNumber('1'));
+    await expect(failing.init()).rejects.toThrow();
+    await expect(pinned).rejects.toThrow('failed to start');
+    await expect(shared).rejects.toThrow('failed to start');
+    await expect(failing.evalR('1')).rejects.toThrow('No webR instance in the pool');
+    failing.close();
+  });
+});
+
+afterAll(async () => {
+  pool.close();
+  await expect(pool.evalR('1')).rejects.toThrow('The webR pool has been closed.');
+});
@@ -1,8 +1,10 @@
 import { WebR } from '../../webR/webr-main';
 import { RInteger, RLogical, RRaw } from '../../webR/robj-main';
-import { mkdtemp, rmdir, unlink, writeFile } from 'fs/promises';
+import { mkdtemp, readFile, rm, rmdir, unlink, writeFile } from 'fs/promises';
 import * as path from 'node:path';
 import * as os from 'node:os';
+import * as http from 'node:http';
+import type { AddressInfo } from 'node:net';
 
 const webR = new WebR({
   baseUrl: '../dist/',
@@ -43,6 +45,69 @@ describe('Download and install binary webR packages', () => {
     warnSpy.mockRestore();
   });
 
+  test('Install a package and its dependencies concurrently', async () => {
+    const warnSpy = jest.spyOn(console, 'warn').mockImplementation(() => null);
+    await webR.evalR('webr::install("tibble", mount = TRUE, quiet = TRUE)');
+    const pkg = (await webR.evalR('"tibble" %in% library(tibble)')) as RLogical;
+    expect(await pkg.toBoolean()).toEqual(true);
+    const deps = (await webR.evalR(
+      'all(c("pillar", "vctrs", "rlang") %in% rownames(installed.packages()))'
+    )) as RLogical;
+    expect(await deps.toBoolean()).toEqual(true);
+    warnSpy.mockRestore();
+  });
+
+  test('Install dependencies first, with bounded concurrent downloads', async () => {
+    // A local repo of packages `a` -> `b`, `c` -> `d`, each a filesystem image
+    const image = await readFile('tests/webR/data/test_image.tar.gz');
+    const packages = [
+      'Package: a\nVersion: 1.0\nDepends: R (>= 4.0), b\nImports: c\n',
+      'Package: b\nVersion: 1.0\nImports: d\n',
+      'Package: c\nVersion: 1.0\nImports: d\n',
+      'Package: d\nVersion: 1.0\n',
+    ].join('\n');
+    let inFlight = 0;
+    let maxInFlight = 0;
+    const server = http.createServer((req, res) => {
+      if (req.url?.endsWith('/PACKAGES')) {
+        res.end(packages);
+      } else if (req.url?.endsWith('_1.0.tgz')) {
+        maxInFlight = Math.max(maxInFlight, ++inFlight);
+        setTimeout(() => {
+          inFlight--;
+          res.end(image);
+        }, 200);
+      } else {
+        res.writeHead(404).end();
+      }
+    });
+    await new Promise<void>((resolve) => server.listen(0, '127.0.0.1', resolve));
+    const repo = `http://127.0.0.1:${(server.address() as AddressInfo).port}`;
+
+    const order = await webR.evalRRaw(`
+      options(webr_download_concurrency = 2)
+      order <- character(0)
+      withCallingHandlers(
+        webr::install("a", repos = "${repo}", lib = "/tmp/lib-order"),
+        message = function(m) {
+          order <<- c(order, trimws(sub("Downloading webR package:", "", conditionMessage(m))))
+          invokeRestart("muffleMessage")
+        }
+      )
+      options(webr_download_concurrency = NULL)
+      stopifnot(all(dir.exists(file.path("/tmp/lib-order", order))))
+      order
+    `, 'string[]');
+    server.close();
+
+    expect([...order].sort()).toEqual(['a', 'b', 'c', 'd']);
+    expect(order.indexOf('d')).toBeLessThan(order.indexOf('b'));
+    expect(order.indexOf('d')).toBeLessThan(order.indexOf('c'));
+    expect(order.indexOf('b')).toBeLessThan(order.indexOf('a'));
+    expect(order.indexOf('c')).toBeLessThan(order.indexOf('a'));
+    expect(maxInFlight).toEqual(2);
+  });
+
   test('Install packages via API', async () => {
     const warnSpy = jest.spyOn(console, 'warn').mockImplementation(() => null);
     await webR.installPackages(['MASS'], { mount: false });
@@ -145,6 +210,70 @@ describe('Test webR virtual filesystem', () => {
     expect(fileContents).toStrictEqual(testFileContents);
   });
 
+  test('Upload and download a large file', async () => {
+    const contents = new Uint8Array(16 * 1024 * 1024).map((_, i) => (i * 7) & 255);
+    await webR.FS.writeFile('/tmp/largeFile', contents);
+    expect(await webR.evalRNumber('file.size("/tmp/largeFile")')).toEqual(contents.length);
+    expect(await webR.FS.readFile('/tmp/largeFile')).toStrictEqual(contents);
+    await webR.FS.unlink('/tmp/largeFile');
+  });
+
+  test('Stream a large file to and from the VFS in chunks', async () => {
+    const contents = new Uint8Array(5 * 1024 * 1024 + 123).map((_, i) => (i * 11) & 255);
+    const chunkSize = 1024 * 1024;
+
+    const writer = webR.FS.createWriteStream('/tmp/streamFile', { chunkSize }).getWriter();
+    await writer.write(contents.subarray(0, 3 * 1024 * 1024));
+    await writer.write(contents.subarray(3 * 1024 * 1024));
+    await writer.close();
+    expect(await webR.evalRNumber('file.size("/tmp/streamFile")')).toEqual(contents.length);
+
+    const chunks: Uint8Array[] = [];
+    const reader = webR.FS.createReadStream('/tmp/streamFile', { chunkSize }).getReader();
+    for (;;) {
+      const { done, value } = await reader.read();
+      if (done) {
+        break;
+      }
+      chunks.push(value);
+    }
+    expect(chunks.map((chunk) => chunk.length)).toEqual([...Array(5).fill(chunkSize), 123]);
+    const received = new Uint8Array(contents.length);
+    let offset = 0;
+    for (const chunk of chunks) {
+      received.set(chunk, offset);
+      offset += chunk.length;
+    }
+    expect(received).toStrictEqual(contents);
+
+    // Append to the file, then stop reading part way through
+    const appender = webR.FS.createWriteStream('/tmp/streamFile', { flags: 'a' }).getWriter();
+    await appender.write(new Uint8Array([1, 2, 3]));
+    await appender.close();
+    expect(await webR.evalRNumber('file.size("/tmp/streamFile")')).toEqual(contents.length + 3);
+    const partial = webR.FS.createReadStream('/tmp/streamFile', { chunkSize }).getReader();
+    expect((await partial.read()).value).toStrictEqual(contents.subarray(0, chunkSize));
+    await partial.cancel();
+    await webR.FS.unlink('/tmp/streamFile');
+  });
+
+  test('Stream a file into a NODEFS mount on the host', async () => {
+    const contents = new Uint8Array(3 * 1024 * 1024 + 45).map((_, i) => (i * 13) & 255);
+    const tmpDir = await mkdtemp(path.join(os.tmpdir(), 'temp-'));
+    await webR.FS.mkdir('/nodefs');
+    await webR.FS.mount('NODEFS', { root: tmpDir }, '/nodefs');
+
+    const writer = webR.FS.createWriteStream('/nodefs/streamed.dat', { chunkSize: 1024 * 1024 })
+      .getWriter();
+    await writer.write(contents);
+    await writer.close();
+    expect(new Uint8Array(await readFile(path.join(tmpDir, 'streamed.dat')))).toStrictEqual(contents);
+
+    await webR.FS.unmount('/nodefs');
+    await webR.FS.rmdir('/nodefs');
+    await rm(tmpDir, { recursive: true });
+  });
+
   test('Receive information about a file on the VFS', async () => {
     const fileInfo = await webR.FS.lookupPath('/tmp/testFile');
     expect(fileInfo).toHaveProperty('name', 'testFile');
@@ -1,16 +1,18 @@
 import { SharedBufferChannelMain, SharedBufferChannelWorker } from './channel-shared';
 import { PostMessageChannelMain, PostMessageChannelWorker } from './channel-postmessage';
+import { RingBufferChannelInit, RingBufferChannelMain, RingBufferChannelWorker } from './channel-ring';
 import { WebROptions } from '../webr-main';
 import { WebRChannelError } from '../error';
 
-// This file refers to objects imported from `./channel-shared` and
-// `./channel-service.` These can't be included in `./channel` as this
-// causes a circular dependency issue.
+// This file refers to objects imported from `./channel-shared`,
+// `./channel-ring` and `./channel-service.` These can't be included in
+// `./channel` as this causes a circular dependency issue.
 
 export const ChannelType = {
   Automatic: 0,
   SharedArrayBuffer: 1,
   PostMessage: 3,
+  RingBuffer: 4,
 } as const;
 
 export type ChannelInitMessage = {
@@ -23,6 +25,7 @@ export type ChannelInitMessage = {
     >;
     clientId?: string;
     location?: string;
+    ring?: RingBufferChannelInit;
   };
 };
 
@@ -32,6 +35,8 @@ export function newChannelMain(data: Required<WebROptions>) {
       return new SharedBufferChannelMain(data);
     case ChannelType.PostMessage:
       return new PostMessageChannelMain(data);
+    case ChannelType.RingBuffer:
+      return new RingBufferChannelMain(data);
     case ChannelType.Automatic:
     default:
       if (typeof SharedArrayBuffer !== 'undefined') {
@@ -48,6 +53,11 @@ export function newChannelWorker(msg: ChannelInitMessage) {
       return new SharedBufferChannelWorker();
     case ChannelType.PostMessage:
       return new PostMessageChannelWorker();
+    case ChannelType.RingBuffer:
+      if (!msg.data.ring) {
+        throw new WebRChannelError('Ring buffer channel initialised without shared buffers');
+      }
+      return new RingBufferChannelWorker(msg.data.ring);
     default:
       throw new WebRChannelError('Unknown worker channel type received');
   }
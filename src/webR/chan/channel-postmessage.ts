@@ -4,6 +4,8 @@ import { Endpoint } from './task-common';
 import { ChannelType } from './channel-common';
 import { WebROptions } from '../webr-main';
 import { ChannelMain } from './channel';
+import { WorkerChannelMetrics, WorkerMetricsCollector } from './metrics';
+import { OutputBuffer } from './output';
 import { WebRChannelError, WebRWorkerError } from '../error';
 
 import { IN_NODE } from '../compat';
@@ -86,6 +88,7 @@ export class PostMessageChannelMain extends ChannelMain {
     if (!message || !message.type) {
       return;
     }
+    this.collector.received(message);
 
     switch (message.type) {
       case 'resolve':
@@ -101,7 +104,7 @@ export class PostMessageChannelMain extends ChannelMain {
         return;
 
       default:
-        this.outputQueue.put(message);
+        this.putOutput(message);
         return;
 
       case 'request': {
@@ -142,6 +145,8 @@ export class PostMessageChannelWorker {
   #parked = new Map<string, ResolveFn<Message>>();
   #dispatch: (msg: Message) => void = () => 0;
   #promptDepth = 0;
+  #collector = new WorkerMetricsCollector();
+  #output = new OutputBuffer((msg) => this.write(msg));
   
   // Main thread proxies only work with SharedBufferChannelWorker for now
   WebSocketProxy = IN_NODE ? undefined : WebSocket;
@@ -156,10 +161,20 @@ export class PostMessageChannelWorker {
   }
 
   write(msg: Message, transfer?: [Transferable]) {
+    this.flushOutput();
     this.#ep.postMessage(msg, transfer);
   }
 
+  writeOutput(type: 'stdout' | 'stderr', text: string) {
+    this.#output.add(type, text);
+  }
+
+  flushOutput(dueOnly = false) {
+    this.#output.flush(dueOnly);
+  }
+
   writeSystem(msg: Message, transfer?: [Transferable]) {
+    this.flushOutput();
     this.#ep.postMessage({ type: 'system', data: msg }, transfer);
   }
 
@@ -215,8 +230,11 @@ export class PostMessageChannelWorker {
     const { resolve: resolve, promise: prom } = promiseHandles<Message>();
     this.#parked.set(req.data.uuid, resolve);
 
+    const start = performance.now();
     this.write(req, transferables);
-    return prom;
+    const response = await prom;
+    this.#collector.syncRequest(msg, performance.now() - start);
+    return response;
   }
 
   syncRequest(): Message {
@@ -224,7 +242,11 @@ export class PostMessageChannelWorker {
   }
 
   setInterrupt() { return; }
-  handleEvents() { return; }
+  handleEvents() { return 0; }
+
+  metrics(): WorkerChannelMetrics {
+    return this.#collector.summary();
+  }
 
   resolveRequest(message: Message) {
     const msg = message as Response;
@@ -0,0 +1,279 @@
+import { Message, Response } from './message';
+import { ChannelType } from './channel-common';
+import { SharedBufferChannelMain, SharedBufferChannelWorker } from './channel-shared';
+import { RingBuffer } from './ring-buffer';
+import { encodeMessage, decodeMessage, UnencodableError } from './codec';
+import { AsyncQueue } from './queue';
+import { WebROptions } from '../webr-main';
+import { WebRChannelError } from '../error';
+
+// The ring buffer channel builds on the `SharedBufferChannel`, replacing
+// the per-message `postMessage()` and `SyncTask` round trips with a pair of
+// single-producer single-consumer ring buffers in shared memory:
+//
+// - Main to worker: inputs, events and responses to synchronous requests.
+//   Inputs are written eagerly, tagged with an epoch that is advanced on
+//   interrupt. The worker discards inputs from a previous epoch, so that
+//   pending inputs are dropped as with `inputQueue.reset()`.
+//
+// - Worker to main: outputs, responses, system messages and synchronous
+//   requests. The main thread reads from the buffer in an async loop.
+//
+// Messages are msgpack encoded. Messages that can only be sent by
+// structured cloning are sent with `postMessage()`, leaving a placeholder in
+// the buffer so that message order is preserved.
+
+const RING_CAPACITY = 1024 * 1024;
+
+// Maximum time the main thread waits for data before checking if the
+// channel has been closed
+const RECEIVE_TIMEOUT = 1000;
+
+/** @internal */
+export type RingBufferChannelInit = {
+  toWorker: SharedArrayBuffer;
+  toMain: SharedArrayBuffer;
+};
+
+// Main ----------------------------------------------------------------
+
+export class RingBufferChannelMain extends SharedBufferChannelMain {
+  #toWorker: RingBuffer;
+  #toMain: RingBuffer;
+  #posted = new AsyncQueue<Message>();
+  #epoch = 0;
+  #closed = false;
+
+  constructor(config: Required<WebROptions>) {
+    const toWorker = new RingBuffer(RING_CAPACITY);
+    const toMain = new RingBuffer(RING_CAPACITY);
+    super(config, ChannelType.RingBuffer, {
+      ring: { toWorker: toWorker.buffer, toMain: toMain.buffer },
+    });
+    this.#toWorker = toWorker;
+    this.#toMain = toMain;
+    void this.#receive();
+  }
+
+  write(msg: Message): void {
+    if (this.#closed) {
+      throw new WebRChannelError("The webR communication channel has been closed.");
+    }
+    this.collector.sent(msg);
+    this.#send({ type: 'input', data: { epoch: this.#epoch, msg } });
+  }
+
+  emit(msg: Message): void {
+    this.collector.sent(msg);
+    this.#send({ type: 'event', data: { msg } });
+  }
+
+  interrupt() {
+    this.#epoch++;
+    this.emit({ type: 'interrupt' });
+  }
+
+  protected putClosedMessage(): void {
+    this.#closed = true;
+    this.#toWorker.cancel();
+    super.putClosedMessage();
+  }
+
+  protected async onMessageFromWorker(worker: Worker, message: Message) {
+    if (!message || !message.type) {
+      return;
+    }
+
+    switch (message.type) {
+      case 'resolve':
+        this.resolve();
+        return;
+      case 'ring-doorbell':
+        this.#toMain.doorbell();
+        return;
+      case 'ring-posted':
+        this.#posted.put(message.data as Message);
+        return;
+      default:
+        return super.onMessageFromWorker(worker, message);
+    }
+  }
+
+  #send(msg: Message) {
+    if (!this.#closed) {
+      const bytes = encodeMessage(msg);
+      this.collector.bytesSent(bytes.length);
+      void this.#toWorker.enqueue(bytes);
+    }
+  }
+
+  async #receive() {
+    while (!this.#closed) {
+      const bytes = this.#toMain.tryPop();
+      if (!bytes) {
+        await this.#toMain.waitForData(RECEIVE_TIMEOUT);
+        continue;
+      }
+
+      let message = decodeMessage(bytes);
+      if (message.type === 'ring-posted') {
+        message = await this.#posted.get();
+      }
+      this.collector.received(message, bytes.length);
+
+      switch (message.type) {
+        case 'response':
+          this.resolveResponse(message as Response);
+          break;
+        case 'system':
+          this.systemQueue.put(message.data as Message);
+          break;
+        case 'ring-sync-request': {
+          const { id, msg } = message.data as { id: number; msg: Message };
+          void this.handleSyncRequest(msg, (resp: Message) => {
+            try {
+              this.#send({ type: 'sync-response', data: { id, resp } });
+            } catch (e) {
+              // Report values that can't be sent back as an error, rather
+              // than leaving the worker blocked
+              const data = { error: e instanceof Error ? e.message : String(e) };
+              this.#send({ type: 'sync-response', data: { id, resp: { type: resp.type, data } } });
+            }
+          });
+          break;
+        }
+        default:
+          this.putOutput(message);
+      }
+    }
+  }
+}
+
+// Worker --------------------------------------------------------------
+
+export class RingBufferChannelWorker extends SharedBufferChannelWorker {
+  #toWorker: RingBuffer;
+  #toMain: RingBuffer;
+  #inputs: Message[] = [];
+  #events: Message[] = [];
+  #responses = new Map<number, Message>();
+  #epoch = 0;
+  #requestId = 0;
+
+  constructor(init: RingBufferChannelInit) {
+    super();
+    this.#toWorker = new RingBuffer(init.toWorker);
+    this.#toMain = new RingBuffer(init.toMain);
+  }
+
+  resolve() {
+    super.write({ type: 'resolve' });
+  }
+
+  write(msg: Message, transfer?: Transferable[]) {
+    this.flushOutput();
+    let bytes: Uint8Array | undefined;
+    // Messages with a transfer list are posted, so that the transferred
+    // objects are moved rather than copied through the ring
+    if (!transfer?.length) {
+      try {
+        bytes = encodeMessage(msg);
+      } catch (e) {
+        if (!(e instanceof UnencodableError)) {
+          throw e;
+        }
+      }
+    }
+    if (!bytes) {
+      super.write({ type: 'ring-posted', data: msg }, transfer);
+      bytes = encodeMessage({ type: 'ring-posted' });
+    }
+    this.#toMain.push(bytes);
+    if (this.#toMain.wake()) {
+      super.write({ type: 'ring-doorbell' });
+    }
+  }
+
+  writeSystem(msg: Message, transfer?: Transferable[]) {
+    this.write({ type: 'system', data: msg }, transfer);
+  }
+
+  syncRequest(msg: Message, transfer?: Transferable[]): Message {
+    const start = performance.now();
+    const id = ++this.#requestId;
+    this.write({ type: 'ring-sync-request', data: { id, msg } }, transfer);
+    while (!this.#responses.has(id)) {
+      this.#receive();
+    }
+    const response = this.#responses.get(id)!;
+    this.#responses.delete(id);
+    this.collector.syncRequest(msg, performance.now() - start);
+    return response;
+  }
+
+  read(): Message {
+    this.flushOutput();
+    for (; ;) {
+      this.handleEvents();
+      const input = this.#inputs.shift();
+      if (input) {
+        return input;
+      }
+      this.#receive();
+    }
+  }
+
+  handleEvents(): number {
+    const start = performance.now();
+    while (!this.#toWorker.isEmpty()) {
+      this.#receive(0);
+    }
+    const events = this.#events;
+    if (events.length === 0) {
+      return 0;
+    }
+    this.#events = [];
+    for (const event of events) {
+      this.handleEvent(event);
+    }
+    this.collector.eventPoll(events.length, performance.now() - start);
+    return events.length;
+  }
+
+  // Read a message from the main thread, blocking until one is available,
+  // and sort it into the local queues
+  #receive(timeout?: number) {
+    const bytes = this.#toWorker.pop(timeout);
+    if (!bytes) {
+      return;
+    }
+
+    const message = decodeMessage(bytes);
+    switch (message.type) {
+      case 'input': {
+        const { epoch, msg } = message.data as { epoch: number; msg: Message };
+        if (epoch === this.#epoch) {
+          this.#inputs.push(msg);
+        }
+        break;
+      }
+      case 'event': {
+        const msg = message.data.msg as Message;
+        if (msg.type === 'interrupt') {
+          // Inputs sent before the interrupt are discarded
+          this.#epoch++;
+          this.#inputs = [];
+        }
+        this.#events.push(msg);
+        break;
+      }
+      case 'sync-response': {
+        const { id, resp } = message.data as { id: number; resp: Message };
+        this.#responses.set(id, resp);
+        break;
+      }
+      default:
+        throw new WebRChannelError(`Unsupported ring buffer message type '${message.type}'.`);
+    }
+  }
+}
@@ -1,9 +1,11 @@
-import { promiseHandles, newCrossOriginWorker, isCrossOrigin } from '../utils';
-import { EventMessage, Message, PostMessageWorkerMessage, Response, SyncRequest, WebSocketCloseMessage, WebSocketMessage, WebSocketOpenMessage, WorkerErrorMessage, WorkerMessage, WorkerMessageErrorMessage } from './message';
+import { promiseHandles, newCrossOriginWorker, isCrossOrigin, evalJs } from '../utils';
+import { CacheGetMessage, EvalAwaitRequest, EventMessage, Message, PostMessageWorkerMessage, PrefetchMessage, Response, SyncRequest, WebSocketCloseMessage, WebSocketDataMessage, WebSocketMessage, WebSocketOpenMessage, WorkerErrorMessage, WorkerMessageErrorMessage, WorkerMessagesMessage } from './message';
 import { Endpoint } from './task-common';
 import { syncResponse } from './task-main';
 import { ChannelMain, ChannelWorker } from './channel';
-import { ChannelType } from './channel-common';
+import { ChannelInitMessage, ChannelType } from './channel-common';
+import { WorkerChannelMetrics, WorkerMetricsCollector } from './metrics';
+import { OutputBuffer } from './output';
 import { WebROptions } from '../webr-main';
 import { WebRChannelError, WebRWorkerError } from '../error';
 
@@ -23,7 +25,11 @@ export class SharedBufferChannelMain extends ChannelMain {
   reject: (message: string | Error) => void;
   close = () => { return; };
 
-  constructor(config: Required<WebROptions>) {
+  constructor(
+    config: Required<WebROptions>,
+    channelType: ChannelInitMessage['data']['channelType'] = ChannelType.SharedArrayBuffer,
+    initData: Partial<ChannelInitMessage['data']> = {},
+  ) {
     super();
     ({ resolve: this.resolve, reject: this.reject, promise: this.initialised } = promiseHandles());
 
@@ -35,7 +41,7 @@ export class SharedBufferChannelMain extends ChannelMain {
       };
       const msg = {
         type: 'init',
-        data: { config, channelType: ChannelType.SharedArrayBuffer },
+        data: { ...initData, config, channelType },
       } as Message;
       worker.postMessage(msg);
     };
@@ -58,8 +64,19 @@ export class SharedBufferChannelMain extends ChannelMain {
     if (!this.#eventBuffer) {
       throw new WebRChannelError('Failed attempt to interrupt before initialising interruptBuffer');
     }
-    this.eventQueue.push({ type: 'event', data: { msg } });
-    this.#eventBuffer[0] = 1;
+    this.queueEvent(msg);
+    Atomics.store(this.#eventBuffer, 0, 1);
+  }
+
+  emitBatched(type: string, item: unknown): void {
+    // Events are held until the worker collects them, so add to the last
+    // queued event if it is of the same type
+    const last = this.eventQueue[this.eventQueue.length - 1];
+    if (last && last.data.msg.type === type) {
+      (last.data.msg.data as unknown[]).push(item);
+      return;
+    }
+    super.emitBatched(type, item);
   }
 
   interrupt() {
@@ -70,7 +87,7 @@ export class SharedBufferChannelMain extends ChannelMain {
   #handleEventsFromWorker(worker: Worker) {
     if (IN_NODE) {
       (worker as unknown as NodeWorker).on('message', (message: Message) => {
-        void this.#onMessageFromWorker(worker, message);
+        void this.onMessageFromWorker(worker, message);
       });
       (worker as unknown as NodeWorker).on('error', (ev: Event) => {
         const message = ev instanceof Error ? ev.message : String(ev);
@@ -81,7 +98,7 @@ export class SharedBufferChannelMain extends ChannelMain {
       });
     } else {
       worker.onmessage = (ev: MessageEvent) =>
-        this.#onMessageFromWorker(worker, ev.data as Message);
+        this.onMessageFromWorker(worker, ev.data as Message);
       worker.onerror = (ev) => {
         const message = ev instanceof Error ? ev.message : String(ev);
         console.error(message);
@@ -92,10 +109,11 @@ export class SharedBufferChannelMain extends ChannelMain {
     }
   }
 
-  #onMessageFromWorker = async (worker: Worker, message: Message) => {
+  protected async onMessageFromWorker(worker: Worker, message: Message) {
     if (!message || !message.type) {
       return;
     }
+    this.collector.received(message);
 
     switch (message.type) {
       case 'resolve':
@@ -112,63 +130,15 @@ export class SharedBufferChannelMain extends ChannelMain {
         return;
 
       default:
-        this.outputQueue.put(message);
+        this.putOutput(message);
         return;
 
       case 'sync-request': {
         const msg = message as SyncRequest;
-        const payload = msg.data.msg;
         const reqData = msg.data.reqData;
-
-        switch (payload.type) {
-          case 'read': {
-            const response = await this.inputQueue.get();
-            await syncResponse(worker, reqData, response);
-            break;
-          }
-          case 'event': {
-            const response = this.eventQueue.shift();
-            await syncResponse(worker, reqData, response);
-            break;
-          }
-          case 'eval-await': {
-            const src = payload.data as string;
-            const data = {} as { result?: any; error?: string };
-            try {
-              data.result = await (0, eval)(src) as unknown;
-              if (typeof data.result === 'function') {
-                // Don't try to transfer a function back to the worker thread
-                data.result = String(data.result);
-              }
-            } catch (_error) {
-              const error = _error as Error;
-              data.error = error.message;
-            }
-            await syncResponse(worker, reqData, { type: 'eval-response', data });
-            break;
-          }
-          case 'post-message-worker': {
-            const message = payload.data as PostMessageWorkerMessage['data'];
-            message.handles = promiseHandles();
-            this.systemQueue.put({ type: 'postMessageWorker', data: message });
-
-            if (message.async) {
-              await syncResponse(worker, reqData, { type: 'post-message-response' });
-            } else {
-              message.handles.promise.then(
-                (value) => {
-                  void syncResponse(worker, reqData, { type: 'post-message-response', data: { result: value } });
-                },
-                (error) => {
-                  void syncResponse(worker, reqData, { type: 'post-message-response', data: { error: String(error) } });
-                }
-              );
-            }
-            break;
-          }
-          default:
-            throw new WebRChannelError(`Unsupported request type '${payload.type}'.`);
-        }
+        await this.handleSyncRequest(msg.data.msg, async (response) => {
+          this.collector.bytesSent(await syncResponse(worker, reqData, response));
+        });
         return;
       }
       case 'request':
@@ -176,12 +146,93 @@ export class SharedBufferChannelMain extends ChannelMain {
           "Can't send messages of type 'request' from a worker. Please Use 'sync-request' instead."
         );
     }
-  };
+  }
+
+  protected async handleSyncRequest(
+    payload: Message,
+    respond: (response: any) => Promise<void> | void,
+  ) {
+    switch (payload.type) {
+      case 'read': {
+        const response = await this.inputQueue.get();
+        await respond(response);
+        break;
+      }
+      case 'event': {
+        const response = this.takeEvents(1)[0];
+        await respond(response);
+        break;
+      }
+      case 'events': {
+        await respond(this.takeEvents());
+        break;
+      }
+      case 'eval-await': {
+        const { code, args } = (payload as EvalAwaitRequest).data;
+        const data = {} as { result?: any; error?: string };
+        try {
+          data.result = await evalJs(code, args);
+          if (typeof data.result === 'function') {
+            // Don't try to transfer a function back to the worker thread
+            data.result = String(data.result);
+          }
+        } catch (_error) {
+          const error = _error as Error;
+          data.error = error.message;
+        }
+        await respond({ type: 'eval-response', data });
+        break;
+      }
+      case 'post-message-worker': {
+        const message = payload.data as PostMessageWorkerMessage['data'];
+        message.handles = promiseHandles();
+        this.systemQueue.put({ type: 'postMessageWorker', data: message });
+
+        if (message.async) {
+          await respond({ type: 'post-message-response' });
+        } else {
+          message.handles.promise.then(
+            (value) => {
+              void respond({ type: 'post-message-response', data: { result: value } });
+            },
+            (error) => {
+              void respond({ type: 'post-message-response', data: { error: String(error) } });
+            }
+          );
+        }
+        break;
+      }
+      case 'cache-get': {
+        const message = payload.data as CacheGetMessage['data'];
+        message.handles = promiseHandles();
+        this.systemQueue.put({ type: 'cacheGet', data: message });
+        const data = await message.handles.promise.catch(() => null);
+        await respond({ type: 'cache-response', data });
+        break;
+      }
+      case 'prefetch': {
+        const message = payload.data as PrefetchMessage['data'];
+        message.handles = promiseHandles();
+        this.systemQueue.put({ type: 'prefetch', data: message });
+        const data = await message.handles.promise.catch(() => message.urls.map(() => null));
+        await respond({ type: 'prefetch-response', data });
+        break;
+      }
+      default:
+        throw new WebRChannelError(`Unsupported request type '${payload.type}'.`);
+    }
+  }
 }
 
 // Worker --------------------------------------------------------------
 
-import { setEventBuffer, setEventsHandler, SyncTask } from './task-worker';
+import {
+  setEventBuffer,
+  setEventsHandler,
+  syncBufferAllocations,
+  syncBufferResizes,
+  SyncTask,
+} from './task-worker';
 import { Module } from '../emscripten';
 import { WebSocketProxy, WebSocketProxyFactory } from './proxy-websocket';
 import { WorkerProxy, WorkerProxyFactory } from './proxy-worker';
@@ -195,6 +246,8 @@ export class SharedBufferChannelWorker implements ChannelWorker {
   #dispatch: (msg: Message) => void = () => 0;
   #eventBuffer = new Int32Array(new SharedArrayBuffer(4));
   #interrupt = () => { return; };
+  protected readonly collector = new WorkerMetricsCollector();
+  #output = new OutputBuffer((msg) => this.write(msg));
   resolveRequest: (msg: Message) => void = () => { return; };
 
   constructor() {
@@ -214,16 +267,35 @@ export class SharedBufferChannelWorker implements ChannelWorker {
   }
 
   write(msg: Message, transfer?: Transferable[]) {
+    this.flushOutput();
     this.#ep.postMessage(msg, transfer);
   }
 
+  writeOutput(type: 'stdout' | 'stderr', text: string) {
+    this.#output.add(type, text);
+  }
+
+  flushOutput(dueOnly = false) {
+    this.#output.flush(dueOnly);
+  }
+
   writeSystem(msg: Message, transfer?: Transferable[]) {
+    this.flushOutput();
     this.#ep.postMessage({ type: 'system', data: msg }, transfer);
   }
 
   syncRequest(msg: Message, transfer?: Transferable[]): Message {
+    // Output must be received before blocking, e.g. for input at a prompt
+    this.flushOutput();
+    const start = performance.now();
     const task = new SyncTask(this.#ep, msg, transfer);
-    return task.syncify() as Message;
+    const response = task.syncify() as Message;
+    this.collector.syncRequest(msg, performance.now() - start);
+    return response;
+  }
+
+  metrics(): WorkerChannelMetrics {
+    return this.collector.summary(syncBufferResizes(), syncBufferAllocations());
   }
 
   read(): Message {
@@ -256,55 +328,71 @@ export class SharedBufferChannelWorker implements ChannelWorker {
     }
   }
 
-  handleEvents() {
-    if (this.#eventBuffer[0] !== 0) {
-      for (; ;) {
-        const response = this.syncRequest({ type: 'event' }) as EventMessage | undefined;
-        if (!response) break;
-        switch (response.data.msg.type) {
-          case 'interrupt':
-            this.#interrupt();
-            break;
-          case 'websocket-open': {
-            const message = response.data.msg as WebSocketOpenMessage;
-            this.ws.get(message.data.uuid)?._accept();
-            break;
-          }
-          case 'websocket-message': {
-            const message = response.data.msg as WebSocketMessage;
-            this.ws.get(message.data.uuid)?._recieve(message.data.data);
-            break;
-          }
-          case 'websocket-close': {
-            const message = response.data.msg as WebSocketCloseMessage;
-            this.ws.get(message.data.uuid)?._close(message.data.code, message.data.reason);
-            break;
-          }
-          case 'websocket-error': {
-            const message = response.data.msg as WebSocketMessage;
-            this.ws.get(message.data.uuid)?._error();
-            break;
-          }
-          case 'worker-message': {
-            const message = response.data.msg as WorkerMessage;
-            this.workers.get(message.data.uuid)?._message(message.data.data);
-            break;
-          }
-          case 'worker-messageerror': {
-            const message = response.data.msg as WorkerMessageErrorMessage;
-            this.workers.get(message.data.uuid)?._messageerror(message.data.data);
-            break;
-          }
-          case 'worker-error': {
-            const message = response.data.msg as WorkerErrorMessage;
-            this.workers.get(message.data.uuid)?._error();
-            break;
-          }
-          default:
-            throw new Error(`Unsupported event type '${response.data.msg.type}'.`);
+  handleEvents(): number {
+    if (Atomics.load(this.#eventBuffer, 0) === 0) {
+      return 0;
+    }
+    // Clear the flag before collecting events, so that any emitted while
+    // this batch is handled are collected on the next call
+    Atomics.store(this.#eventBuffer, 0, 0);
+    const start = performance.now();
+    const events = this.syncRequest({ type: 'events' }) as unknown as EventMessage[];
+    for (const event of events) {
+      this.handleEvent(event.data.msg);
+    }
+    this.collector.eventPoll(events.length, performance.now() - start);
+    return events.length;
+  }
+
+  protected handleEvent(msg: Message) {
+    switch (msg.type) {
+      case 'interrupt':
+        this.#interrupt();
+        break;
+      case 'websocket-open': {
+        const message = msg as WebSocketOpenMessage;
+        this.ws.get(message.data.uuid)?._accept();
+        break;
+      }
+      case 'websocket-message': {
+        const message = msg as WebSocketMessage;
+        this.ws.get(message.data.uuid)?._recieve(message.data.data);
+        break;
+      }
+      case 'websocket-data': {
+        const message = msg as WebSocketDataMessage;
+        this.ws.get(message.data.uuid)?._drain();
+        break;
+      }
+      case 'websocket-close': {
+        const message = msg as WebSocketCloseMessage;
+        this.ws.get(message.data.uuid)?._close(message.data.code, message.data.reason);
+        break;
+      }
+      case 'websocket-error': {
+        const message = msg as WebSocketMessage;
+        this.ws.get(message.data.uuid)?._error();
+        break;
+      }
+      case 'worker-messages': {
+        const message = msg as WorkerMessagesMessage;
+        for (const { uuid, data } of message.data) {
+          this.workers.get(uuid)?._message(data);
         }
+        break;
       }
-      this.#eventBuffer[0] = 0;
+      case 'worker-messageerror': {
+        const message = msg as WorkerMessageErrorMessage;
+        this.workers.get(message.data.uuid)?._messageerror(message.data.data);
+        break;
+      }
+      case 'worker-error': {
+        const message = msg as WorkerErrorMessage;
+        this.workers.get(message.data.uuid)?._error();
+        break;
+      }
+      default:
+        throw new Error(`Unsupported event type '${msg.type}'.`);
     }
   }
 
@@ -8,6 +8,8 @@ import { AsyncQueue } from './queue';
 import { EventMessage, Message, newRequest, Response } from './message';
 import { WebRPayload, WebRPayloadWorker, webRPayloadAsError } from '../payload';
 import { WebRChannelError } from '../error';
+import { ChannelMetrics, ChannelMetricsCollector, WorkerChannelMetrics } from './metrics';
+import { expandOutput } from './output';
 
 // The channel structure is asymmetric:
 //
@@ -29,14 +31,37 @@ import { WebRChannelError } from '../error';
 //   serialised. There is no structured cloning involved, and
 //   ArrayBuffers can't be transferred, only copied.
 
+/**
+ * Statistics for events emitted from the main thread to the worker.
+ */
+export interface EventStats {
+  /** Events waiting to be collected by the worker. */
+  pending: number;
+  /** The largest number of events that have been waiting at once. */
+  maxPending: number;
+  /** Events collected by the worker. */
+  delivered: number;
+  /** Mean time between an event being emitted and collected, in ms. */
+  meanLatency: number;
+  /** Longest time between an event being emitted and collected, in ms. */
+  maxLatency: number;
+}
+
 export abstract class ChannelMain {
   inputQueue = new AsyncQueue<Message>();
   outputQueue = new AsyncQueue<Message>();
   systemQueue = new AsyncQueue<Message>();
   eventQueue = new Array<EventMessage>;
 
-  #parked = new Map<string, { resolve: ResolveFn<any>; reject: RejectFn }>();
+  #parked = new Map<string, {
+    resolve: ResolveFn<any>;
+    reject: RejectFn;
+    type: string;
+    start: number;
+  }>();
   #closed = false;
+  #eventStats = { maxPending: 0, delivered: 0, totalLatency: 0, maxLatency: 0 };
+  protected readonly collector = new ChannelMetricsCollector();
 
   abstract initialised: Promise<unknown>;
   abstract close(): void;
@@ -48,11 +73,7 @@ export abstract class ChannelMain {
   }
 
   async flush(): Promise<Message[]> {
-    const msg: Message[] = [];
-    while (!this.outputQueue.isEmpty()) {
-      msg.push(await this.read());
-    }
-    return msg;
+    return Promise.resolve(this.outputQueue.drain());
   }
 
   async readSystem(): Promise<Message> {
@@ -63,6 +84,7 @@ export abstract class ChannelMain {
     if (this.#closed) {
       throw new WebRChannelError("The webR communication channel has been closed.");
     }
+    this.collector.sent(msg);
     this.inputQueue.put(msg);
   }
 
@@ -70,12 +92,74 @@ export abstract class ChannelMain {
     const req = newRequest(msg, transferables);
 
     const { resolve, reject, promise } = promiseHandles<WebRPayload>();
-    this.#parked.set(req.data.uuid, { resolve, reject });
+    this.#parked.set(req.data.uuid, { resolve, reject, type: msg.type, start: performance.now() });
 
     this.write(req);
     return promise;
   }
 
+  /**
+   * Emit an event carrying a list of items, e.g. messages received from a
+   * proxied Worker.
+   *
+   * Channels that hold events until they are collected by the worker add the
+   * item to a matching event that is still waiting, rather than emitting
+   * another event.
+   * @param {string} type The event type.
+   * @param {unknown} item The item to add to the event's list.
+   */
+  emitBatched(type: string, item: unknown) {
+    this.emit({ type, data: [item] });
+  }
+
+  /**
+   * Report statistics for events emitted to the worker.
+   * @returns {EventStats} Event queue depth and latency.
+   */
+  eventStats(): EventStats {
+    const { maxPending, delivered, totalLatency, maxLatency } = this.#eventStats;
+    return {
+      pending: this.eventQueue.length,
+      maxPending,
+      delivered,
+      meanLatency: delivered ? totalLatency / delivered : 0,
+      maxLatency,
+    };
+  }
+
+  /**
+   * Report metrics collected by the main thread side of the channel.
+   * @returns {ChannelMetrics} Message counts, payload sizes and latencies.
+   */
+  metrics(): ChannelMetrics {
+    return this.collector.summary(this.eventStats());
+  }
+
+  protected queueEvent(msg: Message) {
+    this.collector.sent(msg);
+    this.eventQueue.push({ type: 'event', data: { msg, time: performance.now() } });
+    this.#eventStats.maxPending = Math.max(this.#eventStats.maxPending, this.eventQueue.length);
+  }
+
+  protected takeEvents(count = this.eventQueue.length): EventMessage[] {
+    const events = this.eventQueue.splice(0, count);
+    const now = performance.now();
+    for (const event of events) {
+      const latency = now - (event.data.time ?? now);
+      this.#eventStats.delivered++;
+      this.#eventStats.totalLatency += latency;
+      this.#eventStats.maxLatency = Math.max(this.#eventStats.maxLatency, latency);
+      this.collector.event(latency);
+    }
+    return events;
+  }
+
+  // Output from the worker is received in batches of lines, but read one
+  // line per message
+  protected putOutput(msg: Message) {
+    expandOutput(msg, (line) => this.outputQueue.put(line));
+  }
+
   protected putClosedMessage(): void {
     this.#closed = true;
     this.outputQueue.put({ type: 'closed' });
@@ -88,6 +172,7 @@ export abstract class ChannelMain {
     if (handles) {
       const payload = msg.data.resp.data as WebRPayloadWorker;
       this.#parked.delete(uuid);
+      this.collector.request(handles.type, performance.now() - handles.start, msg.data.time);
 
       if (payload.payloadType === 'err') {
         handles.reject(webRPayloadAsError(payload));
@@ -105,10 +190,13 @@ export interface ChannelWorker {
   WorkerProxy: typeof Worker | undefined;
   resolve(): void;
   write(msg: Message, transfer?: [Transferable]): void;
+  writeOutput(type: 'stdout' | 'stderr', text: string): void;
+  flushOutput(dueOnly?: boolean): void;
   writeSystem(msg: Message, transfer?: [Transferable]): void;
   syncRequest(msg: Message, transfer?: [Transferable]): Message;
   read(): Message;
-  handleEvents(): void;
+  handleEvents(): number;
+  metrics(): WorkerChannelMetrics;
   setInterrupt(interrupt: () => void): void;
   run(args: string[]): void;
   inputOrDispatch: () => number;
@@ -0,0 +1,225 @@
+/**
+ * Serialisation of channel messages written to shared memory.
+ * @module Codec
+ */
+import { encode, decode, ExtensionCodec } from '@msgpack/msgpack';
+import { Message } from './message';
+
+// Typed arrays are encoded with a leading byte identifying their constructor,
+// so that they are decoded to the same type. `Uint8Array` uses msgpack's own
+// binary type, unless it is written as a shared view.
+const EXT_TYPED_ARRAY = 0x10;
+const EXT_SHARED_VIEW = 0x11;
+
+// Typed arrays at least this large are written as shared views
+const SHARED_VIEW_THRESHOLD = 1024;
+
+const typedArrayTypes = [
+  ArrayBuffer,
+  Uint8Array,
+  Int8Array,
+  Uint8ClampedArray,
+  Int16Array,
+  Uint16Array,
+  Int32Array,
+  Uint32Array,
+  Float32Array,
+  Float64Array,
+  DataView,
+] as const;
+
+type ViewConstructor = {
+  new (buffer: ArrayBufferLike, byteOffset?: number, length?: number): ArrayBufferView;
+  BYTES_PER_ELEMENT?: number;
+};
+
+/**
+ * Thrown when a message contains a value that can only be sent using
+ * structured cloning, e.g. an `ImageBitmap` or an `Error`.
+ */
+export class UnencodableError extends Error {
+  name = 'UnencodableError';
+  message = 'Message contains a value that must be sent using structured cloning.';
+}
+
+function isUnencodable(obj: unknown): boolean {
+  return obj instanceof Error
+    || (typeof Blob !== 'undefined' && obj instanceof Blob)
+    || (typeof ImageBitmap !== 'undefined' && obj instanceof ImageBitmap)
+    || (typeof MessagePort !== 'undefined' && obj instanceof MessagePort)
+    || (typeof SharedArrayBuffer !== 'undefined' && obj instanceof SharedArrayBuffer);
+}
+
+function typedArrayKind(obj: unknown): number {
+  return typedArrayTypes.findIndex((type) => obj instanceof type);
+}
+
+function bytesOf(obj: ArrayBufferView | ArrayBuffer): Uint8Array {
+  return ArrayBuffer.isView(obj)
+    ? new Uint8Array(obj.buffer, obj.byteOffset, obj.byteLength)
+    : new Uint8Array(obj);
+}
+
+function encodeTypedArray(obj: unknown): Uint8Array | null {
+  const kind = typedArrayKind(obj);
+  if (kind < 0 || obj instanceof Uint8Array) {
+    return null;
+  }
+  const bytes = bytesOf(obj as ArrayBufferView | ArrayBuffer);
+  const out = new Uint8Array(bytes.length + 1);
+  out[0] = kind;
+  out.set(bytes, 1);
+  return out;
+}
+
+function decodeTypedArray(data: Uint8Array): unknown {
+  // Copy into a new buffer, aligned for the element type
+  const buffer = data.slice(1).buffer;
+  if (data[0] === 0) {
+    return buffer;
+  }
+  const type = typedArrayTypes[data[0]] as ViewConstructor;
+  return new type(buffer);
+}
+
+export const extensionCodec = new ExtensionCodec();
+
+extensionCodec.register({
+  type: EXT_TYPED_ARRAY,
+  encode: (obj: unknown) => {
+    if (isUnencodable(obj)) {
+      throw new UnencodableError();
+    }
+    return encodeTypedArray(obj);
+  },
+  decode: decodeTypedArray,
+});
+
+/**
+ * Encode a channel message for writing to shared memory.
+ * @param {Message} msg The message to encode.
+ * @returns {Uint8Array} The encoded message.
+ * @throws {UnencodableError} If the message must be sent using `postMessage()`.
+ */
+export function encodeMessage(msg: Message): Uint8Array {
+  return encode(msg, { extensionCodec, ignoreUndefined: true });
+}
+
+/**
+ * Decode a channel message read from shared memory.
+ * @param {Uint8Array} bytes The encoded message.
+ * @returns {Message} The decoded message.
+ */
+export function decodeMessage(bytes: Uint8Array): Message {
+  return decode(bytes, { extensionCodec }) as Message;
+}
+
+// Shared views --------------------------------------------------------
+//
+// Responses to synchronous requests are written into a shared data buffer
+// as a msgpack encoded header, followed by the contents of any large typed
+// arrays. The header refers to each array by its type, offset and length,
+// and the array is decoded as a view of the shared buffer without copying.
+
+type SharedViewContext = {
+  views: Uint8Array[];
+  offsets: number[];
+  size: number;
+  buffer?: Uint8Array;
+  base?: number;
+};
+
+const align = (n: number) => (n + 7) & ~7;
+
+const sharedViewCodec = new ExtensionCodec<SharedViewContext>();
+
+sharedViewCodec.register({
+  type: EXT_SHARED_VIEW,
+  encode: (obj: unknown, context: SharedViewContext) => {
+    if (!ArrayBuffer.isView(obj) || obj.byteLength < SHARED_VIEW_THRESHOLD) {
+      return null;
+    }
+    const offset = context.size;
+    context.views.push(bytesOf(obj));
+    context.offsets.push(offset);
+    context.size = align(offset + obj.byteLength);
+
+    const out = new DataView(new ArrayBuffer(9));
+    out.setUint8(0, typedArrayKind(obj));
+    out.setUint32(1, offset);
+    out.setUint32(5, obj.byteLength);
+    return new Uint8Array(out.buffer);
+  },
+  decode: (data: Uint8Array, _type: number, context: SharedViewContext) => {
+    const ext = new DataView(data.buffer, data.byteOffset, data.byteLength);
+    const type = typedArrayTypes[ext.getUint8(0)] as ViewConstructor;
+    const offset = context.base! + ext.getUint32(1);
+    const length = ext.getUint32(5) / (type.BYTES_PER_ELEMENT ?? 1);
+    context.views.push(data);
+    return new type(context.buffer!.buffer, offset, length);
+  },
+});
+
+sharedViewCodec.register({
+  type: EXT_TYPED_ARRAY,
+  encode: encodeTypedArray,
+  decode: decodeTypedArray,
+});
+
+/** @internal */
+export type SharedEncoding = {
+  header: Uint8Array;
+  views: Uint8Array[];
+  offsets: number[];
+  size: number;
+};
+
+/**
+ * Encode a value for writing into a shared data buffer.
+ * @param {any} value The value to encode.
+ * @returns {SharedEncoding} The encoded header and the typed arrays to be
+ * written after it, along with the total size required.
+ */
+export function encodeShared(value: any): SharedEncoding {
+  const context: SharedViewContext = { views: [], offsets: [], size: 0 };
+  const header = encode(value, { extensionCodec: sharedViewCodec, context });
+  return {
+    header,
+    views: context.views,
+    offsets: context.offsets,
+    size: align(header.length) + context.size,
+  };
+}
+
+/**
+ * Write an encoded value into a shared data buffer, which must be at least
+ * `encoded.size` bytes long.
+ * @param {Uint8Array} buffer The shared data buffer.
+ * @param {SharedEncoding} encoded The encoded value.
+ */
+export function writeShared(buffer: Uint8Array, encoded: SharedEncoding) {
+  const base = align(encoded.header.length);
+  buffer.set(encoded.header);
+  encoded.views.forEach((view, i) => buffer.set(view, base + encoded.offsets[i]));
+}
+
+/**
+ * Decode a value from a shared data buffer. Large typed arrays are returned
+ * as views of the buffer, in which case the buffer must not be reused.
+ * @param {Uint8Array} buffer The shared data buffer.
+ * @param {number} headerSize The length of the msgpack encoded header.
+ * @returns {{ value: any, shared: boolean }} The decoded value, and whether
+ * it contains views of the shared buffer.
+ */
+export function decodeShared(buffer: Uint8Array, headerSize: number): { value: any; shared: boolean } {
+  const context: SharedViewContext = {
+    views: [], offsets: [], size: 0, buffer, base: align(headerSize),
+  };
+  // The header is copied out of shared memory, since `TextDecoder` does not
+  // accept views of shared buffers
+  const value = decode(buffer.slice(0, headerSize), {
+    extensionCodec: sharedViewCodec,
+    context,
+  }) as unknown;
+  return { value, shared: context.views.length > 0 };
+}
@@ -4,6 +4,7 @@
  */
 import { PromiseHandles } from '../utils';
 import { generateUUID, transfer, UUID } from './task-common';
+import type { WebSocketStreams } from './proxy-websocket';
 
 /** A webR communication channel message. */
 export interface Message {
@@ -25,6 +26,7 @@ export interface EventMessage {
   type: 'event';
   data: {
     msg: Message;
+    time?: number;
   };
 }
 
@@ -34,6 +36,8 @@ export interface Response {
   data: {
     uuid: UUID;
     resp: Message;
+    /** Time spent by the worker handling the request, in milliseconds. */
+    time?: number;
   };
 }
 
@@ -75,6 +79,17 @@ function newRequestResponseMessage<T>(msg: T, transferables?: [Transferable]): T
   return msg;
 }
 
+/** A webR communication channel `eval-await` request.
+ * @internal
+ */
+export interface EvalAwaitRequest {
+  type: 'eval-await';
+  data: {
+    code: string;
+    args?: { [name: string]: unknown };
+  };
+}
+
 /** A webR communication channel `eval-response` message.
  * @internal
  */
@@ -95,6 +110,17 @@ export interface ProxyWebSocketMessage {
     uuid: string;
     url: string;
     protocol?: string;
+    streams?: WebSocketStreams;
+  };
+}
+
+/** A webR communication channel `websocketDoorbell` message.
+ * @internal
+ */
+export interface WebSocketDoorbellMessage {
+  type: 'websocketDoorbell';
+  data: {
+    uuid: string;
   };
 }
 
@@ -132,6 +158,16 @@ export interface WebSocketMessage {
   };
 }
 
+/** A webR communication channel `websocket-data` message.
+ * @internal
+ */
+export interface WebSocketDataMessage {
+  type: 'websocket-data';
+  data: {
+    uuid: string;
+  };
+}
+
 /** A webR communication channel `websocket-open` message.
  * @internal
  */
@@ -190,15 +226,54 @@ export interface TerminateWorkerMessage {
   };
 }
 
-/** A webR communication channel `worker-message` message.
+/** A webR communication channel `cacheGet` message, looking up a cached
+ * filesystem image on behalf of the worker.
  * @internal
  */
-export interface WorkerMessage {
-  type: 'worker-message';
+export interface CacheGetMessage {
+  type: 'cacheGet';
+  data: {
+    key: string;
+    handles?: PromiseHandles<Uint8Array | null>;
+  };
+}
+
+/** A webR communication channel `cachePut` message, adding a downloaded
+ * filesystem image to the cache.
+ * @internal
+ */
+export interface CachePutMessage {
+  type: 'cachePut';
+  data: {
+    key: string;
+    data: Uint8Array;
+  };
+}
+
+/** A webR communication channel `prefetch` message, downloading filesystem
+ * images concurrently on behalf of the worker.
+ * @internal
+ */
+export interface PrefetchMessage {
+  type: 'prefetch';
+  data: {
+    urls: string[];
+    concurrency: number;
+    gunzip: boolean;
+    handles?: PromiseHandles<(Uint8Array | null)[]>;
+  };
+}
+
+/** A webR communication channel `worker-messages` message, holding messages
+ * received from proxied Workers in the order they arrived.
+ * @internal
+ */
+export interface WorkerMessagesMessage {
+  type: 'worker-messages';
   data: {
     uuid: string;
     data: any;
-  };
+  }[];
 }
 
 /** A webR communication channel `worker-messageerror` message.
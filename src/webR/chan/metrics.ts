@@ -0,0 +1,233 @@
+/**
+ * Instrumentation of the webR communication channels.
+ * @module Metrics
+ */
+import { Message } from './message';
+import type { EventStats } from './channel';
+
+/**
+ * Upper bounds, in milliseconds, of the buckets used by latency histograms.
+ * A final bucket counts values larger than the last bound.
+ */
+export const HISTOGRAM_BOUNDS = [
+  0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000,
+];
+
+/** A summary of a latency histogram. Times are in milliseconds. */
+export interface HistogramSummary {
+  count: number;
+  mean: number;
+  max: number;
+  /** Percentiles, estimated as the upper bound of the containing bucket. */
+  p50: number;
+  p90: number;
+  p99: number;
+  /** Counts for each bucket, with upper bounds given by `HISTOGRAM_BOUNDS`. */
+  buckets: number[];
+}
+
+/** Latency of requests of a given type, sent from the main thread. */
+export interface RequestMetrics {
+  /** Time from the request being sent until its response is received. */
+  total: HistogramSummary;
+  /** Time spent by the worker thread handling the request. */
+  execution: HistogramSummary;
+  /**
+   * Time spent waiting for the worker thread to read the request, and
+   * transferring the request and its response.
+   */
+  queue: HistogramSummary;
+}
+
+/** Metrics collected by the main thread side of a communication channel. */
+export interface ChannelMetrics {
+  /** Messages sent to the worker, by type. Requests are counted by their content type. */
+  sent: { [type: string]: number };
+  /** Messages received from the worker, by type. System messages are counted by their content type. */
+  received: { [type: string]: number };
+  /**
+   * Bytes sent to the worker. Only messages serialised by the channel itself
+   * are counted, rather than those sent with structured cloning.
+   */
+  bytesSent: number;
+  /** Bytes received from the worker, counted as for `bytesSent`. */
+  bytesReceived: number;
+  /** Request latency, by request type. */
+  requests: { [type: string]: RequestMetrics };
+  /** Events emitted to the worker, with a histogram of delivery latency. */
+  events: EventStats & { latency: HistogramSummary };
+}
+
+/** Metrics collected by the worker thread side of a communication channel. */
+export interface WorkerChannelMetrics {
+  /**
+   * Latency of synchronous requests made to the main thread, by type. For
+   * `read` requests this includes time spent waiting for input.
+   */
+  syncRequests: { [type: string]: HistogramSummary };
+  /** Synchronous responses that required a second round trip to grow the data buffer. */
+  syncBufferResizes: number;
+  /** Data buffers allocated for synchronous responses, rather than reused. */
+  syncBufferAllocations: number;
+  /** Times events were collected from the main thread. */
+  eventPolls: number;
+  /** Events handled by the worker. */
+  eventsHandled: number;
+  /** Time taken to collect and handle events. */
+  eventPoll: HistogramSummary;
+}
+
+/** Metrics for both sides of the webR communication channel. */
+export interface WebRMetrics {
+  main: ChannelMetrics;
+  worker: WorkerChannelMetrics;
+}
+
+export class Histogram {
+  #buckets: number[] = new Array<number>(HISTOGRAM_BOUNDS.length + 1).fill(0);
+  #count = 0;
+  #sum = 0;
+  #max = 0;
+
+  record(value: number) {
+    let i = 0;
+    while (i < HISTOGRAM_BOUNDS.length && value > HISTOGRAM_BOUNDS[i]) {
+      i++;
+    }
+    this.#buckets[i]++;
+    this.#count++;
+    this.#sum += value;
+    this.#max = Math.max(this.#max, value);
+  }
+
+  #quantile(q: number): number {
+    let seen = 0;
+    for (let i = 0; i < HISTOGRAM_BOUNDS.length; i++) {
+      seen += this.#buckets[i];
+      if (seen >= q * this.#count) {
+        return Math.min(HISTOGRAM_BOUNDS[i], this.#max);
+      }
+    }
+    return this.#max;
+  }
+
+  summary(): HistogramSummary {
+    return {
+      count: this.#count,
+      mean: this.#count ? this.#sum / this.#count : 0,
+      max: this.#max,
+      p50: this.#quantile(0.5),
+      p90: this.#quantile(0.9),
+      p99: this.#quantile(0.99),
+      buckets: [...this.#buckets],
+    };
+  }
+}
+
+function summarise<T>(map: Map<string, T>, fn: (value: T) => any) {
+  return Object.fromEntries([...map].map(([key, value]) => [key, fn(value) as unknown]));
+}
+
+// Requests and system messages are counted by the type of their content
+function messageType(msg: Message): string {
+  switch (msg.type) {
+    case 'request':
+    case 'sync-request':
+    case 'ring-sync-request':
+      return (msg.data?.msg as Message | undefined)?.type ?? msg.type;
+    case 'system':
+      return (msg.data as Message | undefined)?.type ?? msg.type;
+    default:
+      return msg.type;
+  }
+}
+
+export class ChannelMetricsCollector {
+  #sent = new Map<string, number>();
+  #received = new Map<string, number>();
+  #bytesSent = 0;
+  #bytesReceived = 0;
+  #requests = new Map<string, { total: Histogram; execution: Histogram; queue: Histogram }>();
+  #eventLatency = new Histogram();
+
+  sent(msg: Message, bytes = 0) {
+    const type = messageType(msg);
+    this.#sent.set(type, (this.#sent.get(type) ?? 0) + 1);
+    this.#bytesSent += bytes;
+  }
+
+  received(msg: Message, bytes = 0) {
+    const type = messageType(msg);
+    this.#received.set(type, (this.#received.get(type) ?? 0) + 1);
+    this.#bytesReceived += bytes;
+  }
+
+  bytesSent(bytes: number) {
+    this.#bytesSent += bytes;
+  }
+
+  request(type: string, total: number, execution?: number) {
+    let request = this.#requests.get(type);
+    if (!request) {
+      request = { total: new Histogram(), execution: new Histogram(), queue: new Histogram() };
+      this.#requests.set(type, request);
+    }
+    request.total.record(total);
+    if (execution !== undefined) {
+      request.execution.record(execution);
+      request.queue.record(Math.max(0, total - execution));
+    }
+  }
+
+  event(latency: number) {
+    this.#eventLatency.record(latency);
+  }
+
+  summary(events: EventStats): ChannelMetrics {
+    return {
+      sent: summarise(this.#sent, (n) => n),
+      received: summarise(this.#received, (n) => n),
+      bytesSent: this.#bytesSent,
+      bytesReceived: this.#bytesReceived,
+      requests: summarise(this.#requests, (request) => ({
+        total: request.total.summary(),
+        execution: request.execution.summary(),
+        queue: request.queue.summary(),
+      })),
+      events: { ...events, latency: this.#eventLatency.summary() },
+    };
+  }
+}
+
+export class WorkerMetricsCollector {
+  #syncRequests = new Map<string, Histogram>();
+  #eventPoll = new Histogram();
+  #eventPolls = 0;
+  #eventsHandled = 0;
+
+  syncRequest(msg: Message, time: number) {
+    let histogram = this.#syncRequests.get(msg.type);
+    if (!histogram) {
+      histogram = new Histogram();
+      this.#syncRequests.set(msg.type, histogram);
+    }
+    histogram.record(time);
+  }
+
+  eventPoll(handled: number, time: number) {
+    this.#eventPolls++;
+    this.#eventsHandled += handled;
+    this.#eventPoll.record(time);
+  }
+
+  summary(syncBufferResizes = 0, syncBufferAllocations = 0): WorkerChannelMetrics {
+    return {
+      syncRequests: summarise(this.#syncRequests, (histogram) => histogram.summary()),
+      syncBufferResizes,
+      syncBufferAllocations,
+      eventPolls: this.#eventPolls,
+      eventsHandled: this.#eventsHandled,
+      eventPoll: this.#eventPoll.summary(),
+    };
+  }
+}
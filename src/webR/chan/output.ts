@@ -0,0 +1,96 @@
+/**
+ * Coalescing of standard stream output written by the webR worker thread.
+ * @module Output
+ */
+import { Message } from './message';
+
+// Buffered output is sent once it reaches this many characters, or once the
+// oldest buffered line has waited this many milliseconds
+const OUTPUT_MAX_SIZE = 64 * 1024;
+const OUTPUT_MAX_DELAY = 16;
+
+/**
+ * Runs of consecutive lines written to the same standard stream.
+ * @internal
+ */
+export type OutputRun = ['stdout' | 'stderr', string[]];
+
+/**
+ * A webR communication channel `output` message, holding lines of standard
+ * stream output in the order they were written.
+ * @internal
+ */
+export interface OutputMessage {
+  type: 'output';
+  data: OutputRun[];
+}
+
+/**
+ * Collects lines of standard stream output into `output` messages, rather
+ * than sending a message for every line.
+ *
+ * Buffered output must be flushed before any other message is sent, so that
+ * output is received in order with messages such as prompts.
+ */
+export class OutputBuffer {
+  #runs: OutputRun[] = [];
+  #size = 0;
+  #start = 0;
+
+  constructor(readonly send: (msg: OutputMessage) => void) {}
+
+  add(type: 'stdout' | 'stderr', text: string) {
+    const last = this.#runs[this.#runs.length - 1];
+    if (last && last[0] === type) {
+      last[1].push(text);
+    } else {
+      if (this.#runs.length === 0) {
+        this.#start = performance.now();
+      }
+      this.#runs.push([type, [text]]);
+    }
+    this.#size += text.length + 1;
+    if (this.#size >= OUTPUT_MAX_SIZE) {
+      this.flush();
+    } else {
+      this.flush(true);
+    }
+  }
+
+  /**
+   * Send any buffered output.
+   * @param {boolean} [dueOnly] Only send output that has been buffered for
+   * longer than the maximum delay.
+   */
+  flush(dueOnly = false) {
+    if (this.#runs.length === 0) {
+      return;
+    }
+    if (dueOnly && performance.now() - this.#start < OUTPUT_MAX_DELAY) {
+      return;
+    }
+    const runs = this.#runs;
+    this.#runs = [];
+    this.#size = 0;
+    this.send({ type: 'output', data: runs });
+  }
+}
+
+/**
+ * Expand a message into individual `stdout` and `stderr` messages, if it is
+ * an `output` message.
+ * @param {Message} msg The message to expand.
+ * @param {function} put Called with each resulting message, in order.
+ * @internal
+ */
+export function expandOutput(msg: Message, put: (msg: Message) => void) {
+  if (msg.type !== 'output') {
+    put(msg);
+    return;
+  }
+  for (const [type, lines] of (msg as OutputMessage).data) {
+    for (const data of lines) {
+      put({ type, data });
+    }
+  }
+}
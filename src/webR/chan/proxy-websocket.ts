@@ -1,19 +1,55 @@
 import { ChannelMain } from "./channel";
 import { SharedBufferChannelWorker } from "./channel-shared";
 import { generateUUID } from "./task-common";
+import { RingBuffer } from "./ring-buffer";
 import { IN_NODE } from '../compat';
 
+// When shared memory is available, WebSocket data is streamed through a pair
+// of ring buffers per socket rather than sent as individual channel messages.
+// A channel message is only needed to wake a reader that has run out of data,
+// so bursts of small messages are batched and large messages are not copied
+// through structured cloning. Text frames are written as UTF-8 with the ring
+// buffer message flag set.
+const STREAM_CAPACITY = 1024 * 1024;
+
+// Maximum time the main thread waits for outgoing data before checking that
+// the socket is still open
+const STREAM_TIMEOUT = 1000;
+
+/** @internal */
+export type WebSocketStreams = {
+  rx: SharedArrayBuffer;
+  tx: SharedArrayBuffer;
+};
+
+type WebSocketEntry = {
+  ws: WebSocket;
+  rx?: RingBuffer;
+  tx?: RingBuffer;
+  written: Promise<void>;
+};
+
+const encoder = new TextEncoder();
+const decoder = new TextDecoder();
+
+function toBytes(data: ArrayBufferLike | ArrayBufferView): Uint8Array {
+  return ArrayBuffer.isView(data)
+    ? new Uint8Array(data.buffer, data.byteOffset, data.byteLength)
+    : new Uint8Array(data);
+}
+
 export interface WebSocketProxy extends WebSocket {
   uuid: string;
   _accept(): void;
   _recieve(data: string | ArrayBufferLike | Blob | ArrayBufferView): void;
+  _drain(): void;
   _close(code?: number, reason?: string): void;
   _error(): void;
 }
 
 export class WebSocketMap {
   WebSocket: typeof WebSocket;
-  #map = new Map<string, WebSocket>();
+  #map = new Map<string, WebSocketEntry>();
 
   constructor(readonly chan: ChannelMain) {
     if (IN_NODE) {
@@ -27,40 +63,81 @@ export class WebSocketMap {
     }
   }
 
-  new(uuid: string, url: string | URL, protocols?: string | string[]) {
+  new(uuid: string, url: string | URL, protocols?: string | string[], streams?: WebSocketStreams) {
     const ws = new this.WebSocket(url, protocols || []);
     ws.binaryType = 'arraybuffer';
-    
+
+    const entry: WebSocketEntry = { ws, written: Promise.resolve() };
+    if (streams) {
+      entry.rx = new RingBuffer(streams.rx);
+      entry.tx = new RingBuffer(streams.tx);
+    }
+
     ws.addEventListener('open', () => {
       this.chan.emit({ type: 'websocket-open', data: { uuid } });
+      if (entry.tx) {
+        void this.#pump(entry.ws, entry.tx);
+      }
     });
 
     ws.addEventListener('message', (ev: MessageEvent) => {
-      const data = new Uint8Array(ev.data as ArrayBufferLike);
-      this.chan.emit({ type: 'websocket-message', data: { uuid, data } });
+      const rx = entry.rx;
+      if (!rx) {
+        const data = new Uint8Array(ev.data as ArrayBufferLike);
+        this.chan.emit({ type: 'websocket-message', data: { uuid, data } });
+        return;
+      }
+      const text = typeof ev.data === 'string';
+      const bytes = text ? encoder.encode(ev.data as string) : toBytes(ev.data as ArrayBufferLike);
+      entry.written = rx.enqueue(bytes, text).then(() => {
+        if (rx.wake()) {
+          this.chan.emit({ type: 'websocket-data', data: { uuid } });
+        }
+      });
     });
 
     ws.addEventListener('close', (ev: CloseEvent) => {
-      this.chan.emit({ type: 'websocket-close', data: { uuid, code: ev.code, reason: ev.reason } });
+      // Report the close once all received data has been written
+      void entry.written.then(() => {
+        this.chan.emit({ type: 'websocket-close', data: { uuid, code: ev.code, reason: ev.reason } });
+      });
     });
 
     ws.addEventListener('error', () => {
       this.chan.emit({ type: 'websocket-error', data: { uuid } });
     });
 
-    this.#map.set(uuid, ws);
+    this.#map.set(uuid, entry);
   }
 
   send(uuid: string, data: string | ArrayBufferLike | Blob | ArrayBufferView): void {
-    const ws = this.#map.get(uuid);
-    ws?.send(data);
+    const entry = this.#map.get(uuid);
+    entry?.ws.send(data);
   }
 
   close(uuid: string, code?: number, reason?: string): void {
-    const ws = this.#map.get(uuid);
-    ws?.close(code, reason);
+    const entry = this.#map.get(uuid);
+    entry?.rx?.cancel();
+    entry?.ws.close(code, reason);
     this.#map.delete(uuid);
   }
+
+  // Wake the main thread reader of a socket's outgoing data stream
+  doorbell(uuid: string): void {
+    this.#map.get(uuid)?.tx?.doorbell();
+  }
+
+  // Send data written by the worker to the socket, for as long as it is open
+  async #pump(ws: WebSocket, tx: RingBuffer) {
+    while (ws.readyState === ws.OPEN) {
+      const bytes = tx.tryPop();
+      if (!bytes) {
+        await tx.waitForData(STREAM_TIMEOUT);
+        continue;
+      }
+      ws.send(tx.flag ? decoder.decode(bytes) : bytes);
+    }
+  }
 }
 
 export class WebSocketProxyFactory {
@@ -77,6 +154,10 @@ export class WebSocketProxyFactory {
       readonly CLOSED = WebSocket.CLOSED;
 
       uuid: string;
+      #rx?: RingBuffer;
+      #tx?: RingBuffer;
+      #sending = false;
+      #pending: (string | ArrayBufferLike | Blob | ArrayBufferView)[] = [];
       url: string;
       protocol: string;
       readyState: number = WebSocket.CONNECTING;
@@ -101,15 +182,65 @@ export class WebSocketProxyFactory {
 
         this.uuid = generateUUID();
 
+        let streams: WebSocketStreams | undefined;
+        if (typeof SharedArrayBuffer !== 'undefined') {
+          this.#rx = new RingBuffer(STREAM_CAPACITY);
+          this.#tx = new RingBuffer(STREAM_CAPACITY);
+          this.#rx.requestWake();
+          streams = { rx: this.#rx.buffer, tx: this.#tx.buffer };
+        }
+
         chan.writeSystem({
           type: 'proxyWebSocket',
-          data: { uuid: this.uuid, url: this.url, protocol: this.protocol }
+          data: { uuid: this.uuid, url: this.url, protocol: this.protocol, streams }
         });
         chan.ws.set(this.uuid, this);
       }
 
       send(data: string | ArrayBufferLike | Blob | ArrayBufferView): void {
-        chan.writeSystem({ type: 'sendWebSocket', data: { uuid: this.uuid, data } });
+        // Messages sent by event handlers run while waiting for buffer space
+        // are queued, so that their fragments are not interleaved with those
+        // of the message being written
+        if (this.#sending) {
+          const immutable = typeof data === 'string' || data instanceof Blob;
+          this.#pending.push(immutable ? data : toBytes(data).slice());
+          return;
+        }
+        this.#sending = true;
+        try {
+          this.#send(data);
+          for (let next = this.#pending.shift(); next !== undefined; next = this.#pending.shift()) {
+            this.#send(next);
+          }
+        } finally {
+          this.#sending = false;
+          this.#pending = [];
+        }
+      }
+
+      #send(data: string | ArrayBufferLike | Blob | ArrayBufferView): void {
+        const tx = this.#tx;
+        if (!tx || this.readyState !== WebSocket.OPEN || data instanceof Blob) {
+          chan.writeSystem({ type: 'sendWebSocket', data: { uuid: this.uuid, data } });
+          return;
+        }
+
+        const text = typeof data === 'string';
+        const bytes = text ? encoder.encode(data) : toBytes(data);
+        for (const [payload, more] of tx.fragment(bytes)) {
+          while (!tx.tryPush(payload, more, text)) {
+            // Handle events while waiting, so that we notice if the socket
+            // closes before the main thread reads the buffered data
+            tx.waitForSpace(50);
+            chan.handleEvents();
+            if (this.readyState !== WebSocket.OPEN) {
+              return;
+            }
+          }
+        }
+        if (tx.wake()) {
+          chan.writeSystem({ type: 'websocketDoorbell', data: { uuid: this.uuid } });
+        }
       }
 
       close(code?: number, reason?: string): void {
@@ -133,7 +264,23 @@ export class WebSocketProxyFactory {
         this.onmessage?.(ev);
       }
 
+      // Dispatch messages written to the incoming data stream
+      _drain(): void {
+        const rx = this.#rx;
+        if (!rx) {
+          return;
+        }
+        do {
+          let bytes: Uint8Array | null;
+          while ((bytes = rx.tryPop())) {
+            this._recieve(rx.flag ? decoder.decode(bytes) : bytes);
+          }
+        } while (!rx.requestWake());
+      }
+
       _close(code?: number, reason?: string): void {
+        this._drain();
+        this.readyState = WebSocket.CLOSED;
         const ev = new CloseEvent('close', { code, reason });
         this.dispatchEvent(ev);
         this.onclose?.(ev);
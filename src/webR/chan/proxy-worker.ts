@@ -4,6 +4,7 @@ import { ChannelMain } from "./channel";
 import { SharedBufferChannelWorker } from "./channel-shared";
 import { PostMessageWorkerMessage } from "./message";
 import { generateUUID } from "./task-common";
+import { Module } from "../emscripten";
 import type { Worker as NodeWorker } from 'worker_threads';
 
 export interface WorkerProxy extends Worker {
@@ -25,7 +26,7 @@ export class WorkerMap {
       const worker = new Worker(url, options);
       const nodeWorker = worker as unknown as NodeWorker;
       nodeWorker.on('message', (ev: MessageEvent<unknown>) => {
-        this.chan.emit({ type: 'worker-message', data: { uuid, data: ev } });
+        this.chan.emitBatched('worker-messages', { uuid, data: ev });
       });
 
       nodeWorker.on('messageerror', (ev: MessageEvent<unknown>) => {
@@ -42,7 +43,7 @@ export class WorkerMap {
         url,
         (worker: Worker) => {
           worker.addEventListener('message', (ev: MessageEvent<unknown>) => {
-            this.chan.emit({ type: 'worker-message', data: { uuid, data: ev.data } });
+            this.chan.emitBatched('worker-messages', { uuid, data: ev.data });
           });
 
           worker.addEventListener('messageerror', (ev: MessageEvent<unknown>) => {
@@ -103,6 +104,81 @@ type WorkerProxyOptions = StructuredSerializeOptions & {
   async?: boolean;
 };
 
+// R vectors of these types are posted to a Worker as a typed array of data
+const typedArrayRTypes = ['raw', 'integer', 'double'];
+
+type RVectorLike = {
+  type(): string;
+  toTypedArray(): ArrayBufferView;
+};
+
+function isTypedArrayRVector(value: object): value is RVectorLike {
+  return 'ptr' in value
+    && typeof (value as RVectorLike).toTypedArray === 'function'
+    && typedArrayRTypes.includes((value as RVectorLike).type());
+}
+
+// Copy a view of WebAssembly memory, so that the whole heap is not cloned
+function copyHeapView(view: ArrayBufferView): ArrayBufferView {
+  const bytes = new Uint8Array(view.byteLength);
+  bytes.set(new Uint8Array(view.buffer, view.byteOffset, view.byteLength));
+  const ctor = view.constructor as new (buffer: ArrayBuffer) => ArrayBufferView;
+  return new ctor(bytes.buffer);
+}
+
+/**
+ * Prepare data to be posted to a proxied Worker.
+ *
+ * Raw, integer and double R vectors are replaced by a typed array holding a
+ * copy of their data, and views of WebAssembly memory are copied out of the
+ * heap. The buffers of these copies are added to `transfer`, so that they
+ * are moved to the Worker rather than cloned again on the way. Arrays and
+ * plain objects are searched recursively, and are only copied if they
+ * contain a value that is replaced.
+ * @param {unknown} value The data to be posted.
+ * @param {Set<Transferable>} transfer The transfer list for the message.
+ * @returns {unknown} The data, with R vectors replaced.
+ * @internal
+ */
+export function toTransferable(value: unknown, transfer: Set<Transferable>): unknown {
+  if (typeof value !== 'object' || value === null || value instanceof ArrayBuffer) {
+    return value;
+  }
+  if (ArrayBuffer.isView(value)) {
+    if (value.buffer !== Module.HEAPU8.buffer) {
+      return value;
+    }
+    const copy = copyHeapView(value);
+    transfer.add(copy.buffer);
+    return copy;
+  }
+  if (isTypedArrayRVector(value)) {
+    const data = value.toTypedArray();
+    transfer.add(data.buffer);
+    return data;
+  }
+
+  let copy: unknown[] | { [key: string]: unknown } | undefined;
+  if (Array.isArray(value)) {
+    value.forEach((v: unknown, i) => {
+      const t = toTransferable(v, transfer);
+      if (t !== v) {
+        copy = copy ?? [...value];
+        (copy as unknown[])[i] = t;
+      }
+    });
+  } else if (Object.getPrototypeOf(value) === Object.prototype) {
+    for (const [k, v] of Object.entries(value)) {
+      const t = toTransferable(v, transfer);
+      if (t !== v) {
+        copy = copy ?? { ...value };
+        (copy as { [key: string]: unknown })[k] = t;
+      }
+    }
+  }
+  return copy ?? value;
+}
+
 export class WorkerProxyFactory {
   static proxy(chan: SharedBufferChannelWorker): typeof Worker {
     return class Worker extends EventTarget implements WorkerProxy {
@@ -132,7 +208,9 @@ export class WorkerProxyFactory {
 
       postMessage(data: unknown, options: Transferable[] | WorkerProxyOptions = { async: true }): any {
         const async = Array.isArray(options) ? true : options.async ?? true;
-        const transfer = Array.isArray(options) ? options : options.transfer ?? [];
+        const transferSet = new Set(Array.isArray(options) ? options : options.transfer ?? []);
+        data = toTransferable(data, transferSet);
+        const transfer = [...transferSet];
         const response = chan.syncRequest({
           type: 'post-message-worker', data: {
             uuid: this.uuid,
@@ -140,7 +218,7 @@ export class WorkerProxyFactory {
             async,
             transfer
           }
-        });
+        }, transfer);
         return response.data;
       }
 
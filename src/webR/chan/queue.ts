@@ -1,44 +1,111 @@
-// From https://stackoverflow.com/questions/47157428/how-to-implement-a-pseudo-blocking-async-queue-in-js-ts
 /**
  * @module Queue
  */
 
+/**
+ * A growable circular buffer with constant time insertion and removal at
+ * either end.
+ * @typeParam T The type of item to be stored in the buffer.
+ */
+export class Ring<T> {
+  #items: (T | undefined)[] = new Array<T | undefined>(16);
+  #head = 0;
+  length = 0;
+
+  push(item: T) {
+    if (this.length === this.#items.length) {
+      // Unroll the ring into a buffer of twice the size
+      const items = new Array<T | undefined>(this.#items.length * 2);
+      for (let i = 0; i < this.length; i++) {
+        items[i] = this.#items[(this.#head + i) & (this.#items.length - 1)];
+      }
+      this.#items = items;
+      this.#head = 0;
+    }
+    this.#items[(this.#head + this.length) & (this.#items.length - 1)] = item;
+    this.length++;
+  }
+
+  shift(): T | undefined {
+    if (this.length === 0) {
+      return undefined;
+    }
+    const item = this.#items[this.#head];
+    this.#items[this.#head] = undefined;
+    this.#head = (this.#head + 1) & (this.#items.length - 1);
+    this.length--;
+    return item;
+  }
+
+  pop(): T | undefined {
+    if (this.length === 0) {
+      return undefined;
+    }
+    this.length--;
+    const idx = (this.#head + this.length) & (this.#items.length - 1);
+    const item = this.#items[idx];
+    this.#items[idx] = undefined;
+    return item;
+  }
+
+  peek(): T | undefined {
+    return this.length ? this.#items[this.#head] : undefined;
+  }
+
+  clear() {
+    this.#items = new Array<T | undefined>(16);
+    this.#head = 0;
+    this.length = 0;
+  }
+}
+
 /**
  * Asynchronous queue mechanism to be used by the communication channels.
+ *
+ * Items are stored in a circular buffer, so that adding and removing items is
+ * constant time. A promise is only created for a reader that is waiting for
+ * an item to be added.
  * @typeParam T The type of item to be stored in the queue.
  */
 export class AsyncQueue<T> {
-  #promises: Promise<T>[];
-  #resolvers: ((t: T) => void)[];
-
-  constructor() {
-    this.#resolvers = [];
-    this.#promises = [];
-  }
+  #items = new Ring<T>();
+  #resolvers = new Ring<(t: T) => void>();
 
   reset() {
-    this.#resolvers = [];
-    this.#promises = [];
+    this.#items.clear();
+    this.#resolvers.clear();
   }
 
   put(t: T) {
-    if (!this.#resolvers.length) {
-      this.#add();
+    const resolve = this.#resolvers.shift();
+    if (resolve) {
+      resolve(t);
+    } else {
+      this.#items.push(t);
+    }
+  }
+
+  async get(): Promise<T> {
+    if (this.#items.length) {
+      return this.#items.shift()!;
     }
-    const resolve = this.#resolvers.shift()!;
-    resolve(t);
+    return new Promise((resolve) => this.#resolvers.push(resolve));
   }
 
-  async get() {
-    if (!this.#promises.length) {
-      this.#add();
+  /**
+   * Remove and return all items currently in the queue, without waiting.
+   * @returns {T[]} The items, in the order they were added.
+   */
+  drain(): T[] {
+    const items: T[] = [];
+    while (this.#items.length) {
+      items.push(this.#items.shift()!);
     }
-    const promise = this.#promises.shift()!;
-    return promise;
+    return items;
   }
 
   isEmpty() {
-    return !this.#promises.length;
+    return !this.#items.length;
   }
 
   isBlocked() {
@@ -46,14 +113,6 @@ export class AsyncQueue<T> {
   }
 
   get length() {
-    return this.#promises.length - this.#resolvers.length;
-  }
-
-  #add() {
-    this.#promises.push(
-      new Promise((resolve) => {
-        this.#resolvers.push(resolve);
-      })
-    );
+    return this.#items.length - this.#resolvers.length;
   }
 }
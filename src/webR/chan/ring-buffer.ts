@@ -0,0 +1,368 @@
+/**
+ * Single-producer single-consumer ring buffers in shared memory.
+ * @module RingBuffer
+ */
+
+// Layout of the control words at the start of the shared buffer
+const HEAD = 0; // Total bytes written by the producer, wrapping at 2^32
+const TAIL = 1; // Total bytes read by the consumer, wrapping at 2^32
+const WAITING = 2; // Set when the consumer must be woken by the producer
+const CTRL_BYTES = 16;
+
+// Frames start with a 4 byte header holding the payload length. The high bit
+// is set when further fragments of the same message follow, and the next bit
+// holds a flag for the message that is opaque to the ring buffer.
+const FRAME_HEADER = 4;
+const FRAME_MORE = 0x80000000;
+const FRAME_FLAG = 0x40000000;
+const FRAME_LENGTH = 0x3fffffff;
+
+const hasWaitAsync = typeof (Atomics as { waitAsync?: unknown }).waitAsync === 'function';
+
+type WaitAsync = (
+  typedArray: Int32Array,
+  index: number,
+  value: number,
+  timeout?: number
+) => { async: boolean; value: Promise<'ok' | 'timed-out'> | 'not-equal' | 'timed-out' };
+
+/**
+ * A ring buffer of variable-length framed messages in a `SharedArrayBuffer`.
+ *
+ * Exactly one thread may write to the buffer and exactly one thread may read
+ * from it. Positions are free-running counters, so that no locks are needed;
+ * the producer only ever updates the head and the consumer only the tail.
+ *
+ * Messages larger than half of the buffer capacity are split into fragments,
+ * and reassembled by the consumer. Blocking operations use `Atomics.wait()`
+ * and so can only be used on worker threads. Asynchronous waits use
+ * `Atomics.waitAsync()` when available, otherwise the consumer may request to
+ * be woken by a doorbell message sent by the producer.
+ */
+export class RingBuffer {
+  readonly buffer: SharedArrayBuffer;
+  readonly capacity: number;
+  #ctrl: Int32Array;
+  #data: Uint8Array;
+  #view: DataView;
+  #fragments: Uint8Array[] = [];
+  #ring = () => { return; };
+  #fullAt = 0;
+  #pending: { payload: Uint8Array; more: boolean; flag: boolean; done?: () => void }[] = [];
+  #flushing = false;
+
+  /** The flag of the message most recently read by `tryPop()` or `pop()`. */
+  flag = false;
+
+  /**
+   * @param {SharedArrayBuffer | number} buffer An existing shared buffer, or
+   * the data capacity in bytes of a new buffer. Capacity is rounded up to a
+   * power of two, with a minimum of 1 KiB.
+   */
+  constructor(buffer: SharedArrayBuffer | number) {
+    if (typeof buffer === 'number') {
+      const capacity = 2 ** Math.max(10, Math.ceil(Math.log2(buffer)));
+      buffer = new SharedArrayBuffer(CTRL_BYTES + capacity);
+    }
+    this.buffer = buffer;
+    this.capacity = buffer.byteLength - CTRL_BYTES;
+    this.#ctrl = new Int32Array(buffer, 0, CTRL_BYTES / 4);
+    this.#data = new Uint8Array(buffer, CTRL_BYTES);
+    this.#view = new DataView(buffer, CTRL_BYTES);
+  }
+
+  /** The largest payload written in a single frame. */
+  get maxFragment(): number {
+    return this.capacity / 2 - FRAME_HEADER;
+  }
+
+  /** The number of bytes waiting to be read. */
+  get used(): number {
+    return (Atomics.load(this.#ctrl, HEAD) - Atomics.load(this.#ctrl, TAIL)) >>> 0;
+  }
+
+  isEmpty(): boolean {
+    return Atomics.load(this.#ctrl, HEAD) === Atomics.load(this.#ctrl, TAIL);
+  }
+
+  // Producer ----------------------------------------------------------
+
+  /**
+   * Write a single frame, if there is enough free space for it.
+   * @param {Uint8Array} payload The frame payload.
+   * @param {boolean} [more] Further fragments of this message follow.
+   * @param {boolean} [flag] A flag to be read back with the message.
+   * @returns {boolean} True if the frame was written.
+   */
+  tryPush(payload: Uint8Array, more = false, flag = false): boolean {
+    if (payload.length > this.maxFragment) {
+      throw new RangeError('Ring buffer frame is too large.');
+    }
+    // Frames are padded so that headers are always 4 byte aligned
+    const size = FRAME_HEADER + ((payload.length + 3) & ~3);
+    const head = Atomics.load(this.#ctrl, HEAD);
+    const tail = Atomics.load(this.#ctrl, TAIL);
+    if (this.capacity - ((head - tail) >>> 0) < size) {
+      this.#fullAt = tail;
+      return false;
+    }
+
+    const pos = (head >>> 0) % this.capacity;
+    const header = payload.length | (more ? FRAME_MORE : 0) | (flag ? FRAME_FLAG : 0);
+    this.#view.setUint32(pos, header >>> 0, true);
+    this.#copyIn(payload, (pos + FRAME_HEADER) % this.capacity);
+
+    Atomics.store(this.#ctrl, HEAD, (head + size) | 0);
+    Atomics.notify(this.#ctrl, HEAD);
+    return true;
+  }
+
+  /**
+   * Write a complete message, splitting it into fragments as required and
+   * blocking while the buffer is full. Worker threads only.
+   * @param {Uint8Array} message The message to write.
+   * @param {boolean} [flag] A flag to be read back with the message.
+   */
+  push(message: Uint8Array, flag = false) {
+    for (const [payload, more] of this.fragment(message)) {
+      while (!this.tryPush(payload, more, flag)) {
+        this.waitForSpace();
+      }
+    }
+  }
+
+  /**
+   * Write a complete message without blocking. If the buffer is full, the
+   * message is queued and written asynchronously once there is space, after
+   * any previously queued messages.
+   * @param {Uint8Array} message The message to write. It must not be
+   * modified until written.
+   * @param {boolean} [flag] A flag to be read back with the message.
+   * @returns {Promise<void>} Resolves once the message has been written.
+   */
+  enqueue(message: Uint8Array, flag = false): Promise<void> {
+    const written = new Promise<void>((resolve) => {
+      const fragments = this.fragment(message);
+      fragments.forEach(([payload, more], i) => {
+        const done = i === fragments.length - 1 ? resolve : undefined;
+        this.#pending.push({ payload, more, flag, done });
+      });
+    });
+    if (!this.#flushing) {
+      void this.#flush();
+    }
+    return written;
+  }
+
+  /** Discard messages queued by `enqueue()` that are not yet written. */
+  cancel() {
+    this.#pending = [];
+  }
+
+  async #flush() {
+    this.#flushing = true;
+    while (this.#pending.length > 0) {
+      const { payload, more, flag, done } = this.#pending[0];
+      if (this.tryPush(payload, more, flag)) {
+        this.#pending.shift();
+        done?.();
+      } else {
+        await this.waitForSpaceAsync();
+      }
+    }
+    this.#flushing = false;
+  }
+
+  /**
+   * Check whether the consumer asked to be woken, after writing a message.
+   * @returns {boolean} True if the consumer must be sent a doorbell message.
+   */
+  wake(): boolean {
+    return Atomics.exchange(this.#ctrl, WAITING, 0) !== 0;
+  }
+
+  /**
+   * Block until the consumer has read from the buffer, after a failed write.
+   * Worker threads only.
+   * @param {number} [timeout] Maximum time to wait, in milliseconds.
+   */
+  waitForSpace(timeout?: number) {
+    Atomics.wait(this.#ctrl, TAIL, this.#fullAt, timeout);
+  }
+
+  /**
+   * Asynchronously wait until the consumer has read from the buffer, after a
+   * failed write.
+   */
+  async waitForSpaceAsync() {
+    if (hasWaitAsync) {
+      const waitAsync = (Atomics as unknown as { waitAsync: WaitAsync }).waitAsync;
+      const result = waitAsync(this.#ctrl, TAIL, this.#fullAt, 100);
+      if (result.async) {
+        await result.value;
+      }
+    } else {
+      await new Promise((resolve) => setTimeout(resolve, 1));
+    }
+  }
+
+  // Consumer ----------------------------------------------------------
+
+  /**
+   * Read a complete message, if one is available.
+   * @returns {Uint8Array | null} A copy of the message, or null if no complete
+   * message is waiting.
+   */
+  tryPop(): Uint8Array | null {
+    for (; ;) {
+      const tail = Atomics.load(this.#ctrl, TAIL);
+      const head = Atomics.load(this.#ctrl, HEAD);
+      if (head === tail) {
+        return null;
+      }
+
+      const pos = (tail >>> 0) % this.capacity;
+      const header = this.#view.getUint32(pos, true);
+      const length = header & FRAME_LENGTH;
+      const payload = this.#copyOut((pos + FRAME_HEADER) % this.capacity, length);
+
+      Atomics.store(this.#ctrl, TAIL, (tail + FRAME_HEADER + ((length + 3) & ~3)) | 0);
+      Atomics.notify(this.#ctrl, TAIL);
+
+      if (header & FRAME_MORE) {
+        this.#fragments.push(payload);
+        continue;
+      }
+      this.flag = (header & FRAME_FLAG) !== 0;
+      if (this.#fragments.length === 0) {
+        return payload;
+      }
+      this.#fragments.push(payload);
+      const message = concat(this.#fragments);
+      this.#fragments = [];
+      return message;
+    }
+  }
+
+  /**
+   * Read a complete message, blocking until one is available. Worker threads
+   * only.
+   * @param {number} [timeout] Maximum time to wait for each fragment, in
+   * milliseconds.
+   * @returns {Uint8Array | null} The message, or null if the wait timed out.
+   */
+  pop(timeout?: number): Uint8Array | null {
+    for (; ;) {
+      const message = this.tryPop();
+      if (message) {
+        return message;
+      }
+      const head = Atomics.load(this.#ctrl, HEAD);
+      if (head !== Atomics.load(this.#ctrl, TAIL)) {
+        continue;
+      }
+      if (Atomics.wait(this.#ctrl, HEAD, head, timeout) === 'timed-out') {
+        return this.tryPop();
+      }
+    }
+  }
+
+  /**
+   * Asynchronously wait for data to be written to the buffer.
+   *
+   * Uses `Atomics.waitAsync()` when available. Otherwise, the returned promise
+   * resolves once `doorbell` is called, which should happen when the producer
+   * sends a doorbell message in response to `wake()`.
+   * @param {number} [timeout] Maximum time to wait, in milliseconds.
+   */
+  async waitForData(timeout?: number): Promise<void> {
+    const head = Atomics.load(this.#ctrl, HEAD);
+    if (head !== Atomics.load(this.#ctrl, TAIL)) {
+      return;
+    }
+
+    if (hasWaitAsync) {
+      const waitAsync = (Atomics as unknown as { waitAsync: WaitAsync }).waitAsync;
+      const result = waitAsync(this.#ctrl, HEAD, head, timeout);
+      if (result.async) {
+        await result.value;
+      }
+      return;
+    }
+
+    const ring = new Promise<void>((resolve) => {
+      this.#ring = resolve;
+      if (timeout !== undefined) {
+        setTimeout(resolve, timeout);
+      }
+    });
+    if (this.requestWake()) {
+      await ring;
+    }
+  }
+
+  /**
+   * Ask the producer to wake the consumer, as reported by `wake()`, after it
+   * next writes a message.
+   * @returns {boolean} True if the buffer is still empty. Otherwise, data was
+   * written before the request was made and should be read.
+   */
+  requestWake(): boolean {
+    Atomics.store(this.#ctrl, WAITING, 1);
+    return this.isEmpty();
+  }
+
+  /** Wake an asynchronous consumer after a doorbell message is received. */
+  doorbell() {
+    this.#ring();
+  }
+
+  // Helpers -----------------------------------------------------------
+
+  /**
+   * Split a message into frame payloads small enough to be written to the
+   * buffer.
+   * @param {Uint8Array} message The message to split.
+   * @returns {[Uint8Array, boolean][]} Frame payloads, each with a flag set
+   * when further fragments follow.
+   */
+  fragment(message: Uint8Array): [Uint8Array, boolean][] {
+    const max = this.maxFragment;
+    const fragments: [Uint8Array, boolean][] = [];
+    let offset = 0;
+    do {
+      const end = Math.min(offset + max, message.length);
+      fragments.push([message.subarray(offset, end), end < message.length]);
+      offset = end;
+    } while (offset < message.length);
+    return fragments;
+  }
+
+  #copyIn(payload: Uint8Array, pos: number) {
+    const first = Math.min(payload.length, this.capacity - pos);
+    this.#data.set(payload.subarray(0, first), pos);
+    if (first < payload.length) {
+      this.#data.set(payload.subarray(first), 0);
+    }
+  }
+
+  #copyOut(pos: number, length: number): Uint8Array {
+    const out = new Uint8Array(length);
+    const first = Math.min(length, this.capacity - pos);
+    out.set(this.#data.subarray(pos, pos + first));
+    if (first < length) {
+      out.set(this.#data.subarray(0, length - first), first);
+    }
+    return out;
+  }
+}
+
+function concat(chunks: Uint8Array[]): Uint8Array {
+  const out = new Uint8Array(chunks.reduce((n, chunk) => n + chunk.length, 0));
+  let offset = 0;
+  for (const chunk of chunks) {
+    out.set(chunk, offset);
+    offset += chunk.length;
+  }
+  return out;
+}
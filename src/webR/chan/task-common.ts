@@ -3,6 +3,8 @@
 export const SZ_BUF_DOESNT_FIT = 0;
 export const SZ_BUF_FITS_IDX = 1;
 export const SZ_BUF_SIZE_IDX = 0;
+export const SZ_BUF_HEADER_IDX = 2;
+export const SZ_BUF_LENGTH = 3;
 
 export interface Endpoint extends EventSource {
   postMessage(message: any, transfer?: Transferable[]): void;
@@ -1,10 +1,16 @@
 // Original code from Synclink and Comlink. Released under Apache 2.0.
 
-import { Endpoint, SZ_BUF_FITS_IDX, SZ_BUF_SIZE_IDX, generateUUID } from './task-common';
+import {
+  Endpoint,
+  SZ_BUF_FITS_IDX,
+  SZ_BUF_HEADER_IDX,
+  SZ_BUF_SIZE_IDX,
+  generateUUID,
+} from './task-common';
 
 import { sleep } from '../utils';
 import { SyncRequestData } from './message';
-import { encode } from '@msgpack/msgpack';
+import { encodeShared, writeShared } from './codec';
 
 import { IN_NODE } from '../compat';
 import type { Worker as NodeWorker } from 'worker_threads';
@@ -21,18 +27,25 @@ const encoder = new TextEncoder();
  *        to read out the buffers to write the answer into. NOTE: requester
  *        owns buffers.
  * @param {any} response The value we want to send back to the requester. We
- *        have to encode it into data_buffer.
+ *        have to encode it into data_buffer. Large typed arrays are written
+ *        after the encoded header, and are received as views of the buffer.
+ * @returns {Promise<number>} The number of bytes written.
  */
-export async function syncResponse(endpoint: Endpoint, data: SyncRequestData, response: any) {
+export async function syncResponse(
+  endpoint: Endpoint,
+  data: SyncRequestData,
+  response: any
+): Promise<number> {
   try {
     // eslint-disable-next-line prefer-const
     let { taskId, sizeBuffer, dataBuffer, signalBuffer } = data;
     // console.warn(msg);
 
-    const bytes = encode(response);
-    const fits = bytes.length <= dataBuffer.length;
+    const encoded = encodeShared(response);
+    const fits = encoded.size <= dataBuffer.length;
 
-    Atomics.store(sizeBuffer, SZ_BUF_SIZE_IDX, bytes.length);
+    Atomics.store(sizeBuffer, SZ_BUF_SIZE_IDX, encoded.size);
+    Atomics.store(sizeBuffer, SZ_BUF_HEADER_IDX, encoded.header.length);
     Atomics.store(sizeBuffer, SZ_BUF_FITS_IDX, +fits);
     if (!fits) {
       // console.log("      need larger buffer", taskId)
@@ -47,14 +60,17 @@ export async function syncResponse(endpoint: Endpoint, data: SyncRequestData, re
       dataBuffer = (await dataPromise).dataBuffer as Uint8Array;
     }
 
-    // Encode result into dataBuffer
-    dataBuffer.set(bytes);
+    // Write result into dataBuffer, with typed array contents copied
+    // directly into place after the encoded header
+    writeShared(dataBuffer, encoded);
     Atomics.store(sizeBuffer, SZ_BUF_FITS_IDX, +true);
 
     // console.log("       signaling completion", taskId)
     await signalRequester(signalBuffer, taskId as number);
+    return encoded.size;
   } catch (e) {
     console.warn(e);
+    return 0;
   }
 }
 
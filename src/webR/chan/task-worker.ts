@@ -4,12 +4,14 @@ import {
   Endpoint,
   SZ_BUF_DOESNT_FIT,
   SZ_BUF_FITS_IDX,
+  SZ_BUF_HEADER_IDX,
+  SZ_BUF_LENGTH,
   SZ_BUF_SIZE_IDX,
   UUID_LENGTH,
 } from './task-common';
 
 import { newSyncRequest, Message } from './message';
-import { decode } from '@msgpack/msgpack';
+import { decodeShared } from './codec';
 
 const decoder = new TextDecoder('utf-8');
 
@@ -68,12 +70,15 @@ export class SyncTask {
   *doSync() {
     // just use syncRequest.
     const { endpoint, msg, transfers } = this;
-    const sizeBuffer = new Int32Array(new SharedArrayBuffer(8));
+    const sizeBuffer = acquireSizeBuffer();
     const signalBuffer = this.signalBuffer!;
     const taskId = this.taskId;
 
-    // Ensure status is cleared. We will notify
-    let dataBuffer = acquireDataBuffer(UUID_LENGTH);
+    // Start with a buffer large enough for a typical response, or for the
+    // previous response of the same type if that was large, to avoid a second
+    // round trip
+    const sizeHint = sizeHints.get(msg.type) ?? 0;
+    let dataBuffer = acquireDataBuffer(Math.max(UUID_LENGTH, DATA_BUFFER_SIZE, sizeHint));
     // console.log("===requesting", taskId);
 
     const syncMsg = newSyncRequest(msg, {
@@ -88,6 +93,7 @@ export class SyncTask {
 
     if (Atomics.load(sizeBuffer, SZ_BUF_FITS_IDX) === SZ_BUF_DOESNT_FIT) {
       // There wasn't enough space, make a bigger dataBuffer.
+      resizes++;
       // First read uuid for response out of current dataBuffer
       const id = decoder.decode(dataBuffer.slice(0, UUID_LENGTH));
       releaseDataBuffer(dataBuffer);
@@ -99,8 +105,22 @@ export class SyncTask {
     }
 
     const size = Atomics.load(sizeBuffer, SZ_BUF_SIZE_IDX);
+    const headerSize = Atomics.load(sizeBuffer, SZ_BUF_HEADER_IDX);
+    releaseSizeBuffer(sizeBuffer);
+    // Only sizes that can be served from the buffer pool are used as hints
+    if (size > DATA_BUFFER_SIZE && size <= 2 ** MAX_POOLED_SIZE_CLASS) {
+      sizeHints.set(msg.type, size);
+    } else {
+      sizeHints.delete(msg.type);
+    }
+
     // console.log("===completing", taskId);
-    return decode(dataBuffer.slice(0, size));
+    const { value, shared } = decodeShared(dataBuffer, headerSize);
+    // A buffer holding typed arrays returned as views is now owned by them
+    if (!shared) {
+      releaseDataBuffer(dataBuffer);
+    }
+    return value;
   }
 
   get result() {
@@ -200,24 +220,85 @@ class _Syncifier {
   }
 }
 
+// Initial size of the data buffer for a synchronous response
+const DATA_BUFFER_SIZE = 64 * 1024;
+
+// Size of the last response of each request type, if larger than the default
+const sizeHints = new Map<string, number>();
+
+// Responses that did not fit in the data buffer
+let resizes = 0;
+
+// Data buffers allocated, rather than taken from the pool
+let allocations = 0;
+
+/**
+ * Report the number of synchronous responses that required a larger data
+ * buffer, and so a second round trip.
+ * @returns {number} The number of resized data buffers.
+ * @internal
+ */
+export function syncBufferResizes(): number {
+  return resizes;
+}
+
+/**
+ * Report the number of data buffers allocated for synchronous responses,
+ * rather than reused from the pool of released buffers.
+ * @returns {number} The number of allocated data buffers.
+ * @internal
+ */
+export function syncBufferAllocations(): number {
+  return allocations;
+}
+
+// Largest data buffer kept for reuse, as a power of 2 (4 MiB)
+const MAX_POOLED_SIZE_CLASS = 22;
+
+// Number of data buffers kept for reuse in each size class
+const MAX_POOLED_BUFFERS = 4;
+
 const dataBuffers: Uint8Array[][] = [];
+const sizeBuffers: Int32Array[] = [];
 
 function acquireDataBuffer(size: number): Uint8Array {
   const powerof2 = Math.ceil(Math.log2(size));
-  if (!dataBuffers[powerof2]) {
-    dataBuffers[powerof2] = [];
-  }
-  const result = dataBuffers[powerof2].pop();
-  if (result) {
-    result.fill(0);
-    return result;
+  // Reuse a pooled buffer of the requested size class, or of the next class
+  // up. The response overwrites everything that is read back, so there is no
+  // need to clear it.
+  for (let i = powerof2; i <= powerof2 + 1 && i < dataBuffers.length; i++) {
+    const result = dataBuffers[i]?.pop();
+    if (result) {
+      return result;
+    }
   }
+  allocations++;
   return new Uint8Array(new SharedArrayBuffer(2 ** powerof2));
 }
 
 function releaseDataBuffer(buffer: Uint8Array) {
   const powerof2 = Math.ceil(Math.log2(buffer.byteLength));
-  dataBuffers[powerof2].push(buffer);
+  // Large buffers are left for garbage collection, rather than being held
+  // for the rest of the session after a single large response
+  if (powerof2 > MAX_POOLED_SIZE_CLASS) {
+    return;
+  }
+  if (!dataBuffers[powerof2]) {
+    dataBuffers[powerof2] = [];
+  }
+  if (dataBuffers[powerof2].length < MAX_POOLED_BUFFERS) {
+    dataBuffers[powerof2].push(buffer);
+  }
+}
+
+function acquireSizeBuffer(): Int32Array {
+  const result = sizeBuffers.pop() ?? new Int32Array(new SharedArrayBuffer(SZ_BUF_LENGTH * 4));
+  result.fill(0);
+  return result;
+}
+
+function releaseSizeBuffer(buffer: Int32Array) {
+  sizeBuffers.push(buffer);
 }
 
 let eventBuffer: Int32Array = new Int32Array(new ArrayBuffer(4));
@@ -0,0 +1,197 @@
+/**
+ * Checkpoints of the virtual filesystem, used to roll back changes made to
+ * the webR session, e.g. between requests from different users.
+ * @module Checkpoint
+ */
+import { Module } from './emscripten';
+
+type FSEntry =
+  | { type: 'dir'; mode: number }
+  | { type: 'file'; mode: number; data: Uint8Array }
+  | { type: 'link'; mode: number; target: string }
+  | { type: 'lazy'; node: FS.FSNode; modified?: number };
+
+type MemFSNode = FS.FSNode & {
+  contents?: Uint8Array;
+  usedBytes?: number;
+  mtime?: number;
+  timestamp?: number;
+};
+
+function lookupNode(path: string) {
+  return Module.FS.lookupPath(path, { follow: false }).node as MemFSNode;
+}
+
+// Files loaded on demand, such as the lazy filesystem entries in the R
+// library, report their size through an accessor that loads the file. Their
+// contents are not saved, and their nodes are not stat'ed.
+function isLazyFile(node: MemFSNode) {
+  return Module.FS.isFile(node.mode) &&
+    typeof Object.getOwnPropertyDescriptor(node, 'usedBytes')?.get === 'function';
+}
+
+function currentMounts(): string[] {
+  const FS = Module.FS as typeof Module.FS & {
+    getMounts: (mount: FS.Mount) => (FS.Mount & { mountpoint: string })[];
+  };
+  return FS.getMounts(FS.root.mount).map((mount) => mount.mountpoint);
+}
+
+function joinPath(dir: string, name: string) {
+  return dir === '/' ? `/${name}` : `${dir}/${name}`;
+}
+
+function isMountpoint(path: string) {
+  const node = Module.FS.lookupPath(path, { follow: false }).node;
+  return Module.FS.isMountpoint(node);
+}
+
+// Check the contents of a file against saved data without copying it, for
+// files stored in memory
+function sameContents(path: string, data: Uint8Array): boolean {
+  const node = lookupNode(path);
+  if (node.mount.type !== Module.FS.filesystems.MEMFS || !node.contents) {
+    return false;
+  }
+  if (node.usedBytes !== data.length) {
+    return false;
+  }
+  const contents = node.contents;
+  for (let i = 0; i < data.length; i++) {
+    if (contents[i] !== data[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * The state of a set of directories in the virtual filesystem, and of the
+ * filesystems mounted, at the time the checkpoint was created.
+ *
+ * Directories are walked without crossing into other mounted filesystems.
+ * File contents are copied, so that later changes can be undone, except for
+ * files loaded on demand, which are only checked for changes.
+ * @internal
+ */
+export class FSCheckpoint {
+  #entries = new Map<string, FSEntry>();
+  #mounts: Set<string>;
+
+  constructor(readonly roots: string[]) {
+    this.#mounts = new Set(currentMounts());
+    for (const root of roots) {
+      if (Module.FS.analyzePath(root, true).exists) {
+        this.#save(root);
+      }
+    }
+  }
+
+  #save(path: string) {
+    const node = lookupNode(path);
+    if (isLazyFile(node)) {
+      this.#entries.set(path, { type: 'lazy', node, modified: node.mtime ?? node.timestamp });
+      return;
+    }
+    const stat = Module.FS.lstat(path);
+    if (Module.FS.isLink(stat.mode)) {
+      this.#entries.set(path, { type: 'link', mode: stat.mode, target: Module.FS.readlink(path) });
+    } else if (Module.FS.isFile(stat.mode)) {
+      this.#entries.set(path, { type: 'file', mode: stat.mode, data: Module.FS.readFile(path) });
+    } else if (Module.FS.isDir(stat.mode)) {
+      this.#entries.set(path, { type: 'dir', mode: stat.mode });
+      for (const name of Module.FS.readdir(path)) {
+        const child = joinPath(path, name);
+        if (name !== '.' && name !== '..' && !isMountpoint(child)) {
+          this.#save(child);
+        }
+      }
+    }
+  }
+
+  /**
+   * Restore the directories to their state at the time of the checkpoint.
+   *
+   * Filesystems mounted since the checkpoint are unmounted, new files are
+   * removed, and changed or removed files are restored.
+   * @returns {string[]} The paths of files loaded on demand that have been
+   * changed or removed since the checkpoint, which can't be restored.
+   */
+  rollback(): string[] {
+    const unrestored: string[] = [];
+    currentMounts()
+      .filter((mountpoint) => !this.#mounts.has(mountpoint))
+      .sort((a, b) => b.length - a.length)
+      .forEach((mountpoint) => Module.FS.unmount(mountpoint));
+
+    for (const root of this.roots) {
+      if (Module.FS.analyzePath(root, true).exists) {
+        this.#prune(root);
+      }
+    }
+
+    // Entries were saved with parent directories before their contents
+    for (const [path, entry] of this.#entries) {
+      const exists = Module.FS.analyzePath(path, true).exists;
+      switch (entry.type) {
+        case 'dir':
+          if (!exists) {
+            Module.FS.mkdir(path, entry.mode);
+          }
+          break;
+        case 'file':
+          if (!exists || !sameContents(path, entry.data)) {
+            Module.FS.writeFile(path, entry.data);
+          }
+          break;
+        case 'link':
+          if (!exists) {
+            Module.FS.symlink(entry.target, path);
+          }
+          break;
+        case 'lazy': {
+          const node = exists ? lookupNode(path) : null;
+          if (!node || node !== entry.node || (node.mtime ?? node.timestamp) !== entry.modified) {
+            unrestored.push(path);
+          }
+          break;
+        }
+      }
+      if (entry.type !== 'link' && entry.type !== 'lazy') {
+        Module.FS.chmod(path, entry.mode);
+      }
+    }
+    return unrestored;
+  }
+
+  // Remove entries that have been created, or replaced with a different type
+  // of entry, since the checkpoint
+  #prune(path: string) {
+    const saved = this.#entries.get(path);
+    const mode = lookupNode(path).mode;
+    const isDir = Module.FS.isDir(mode) && !Module.FS.isLink(mode);
+    if (isDir) {
+      for (const name of Module.FS.readdir(path)) {
+        const child = joinPath(path, name);
+        if (name !== '.' && name !== '..' && !isMountpoint(child)) {
+          this.#prune(child);
+        }
+      }
+    }
+
+    const sameType =
+      saved &&
+      ((saved.type === 'dir' && isDir) ||
+        ((saved.type === 'file' || saved.type === 'lazy') && Module.FS.isFile(mode)) ||
+        (saved.type === 'link' &&
+          Module.FS.isLink(mode) &&
+          Module.FS.readlink(path) === saved.target));
+    if (!sameType && !this.roots.includes(path)) {
+      if (isDir) {
+        Module.FS.rmdir(path);
+      } else {
+        Module.FS.unlink(path);
+      }
+    }
+  }
+}
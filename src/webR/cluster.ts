@@ -0,0 +1,122 @@
+/**
+ * Nodes of a webR cluster, used by the webR backend for the R `parallel`
+ * package. Each node is a separate webR instance, running in a Worker started
+ * from the webR worker thread.
+ * @module Cluster
+ */
+import type { WebROptions } from './webr-main';
+
+/**
+ * A message exchanged between the webR worker thread and a cluster node.
+ *
+ * Tasks and their results are R objects, serialised by R and sent as the
+ * contents of a raw vector.
+ * @internal
+ */
+export type ClusterMessage =
+  | { type: 'init'; options: WebROptions }
+  | { type: 'ready' }
+  | { type: 'eval'; data: Uint8Array }
+  | { type: 'result'; data: Uint8Array }
+  | { type: 'error'; message: string };
+
+type ClusterNode = {
+  worker: Worker;
+  ready: boolean;
+  results: Uint8Array[];
+  error?: string;
+};
+
+/**
+ * Start and communicate with cluster nodes from the webR worker thread.
+ *
+ * Nodes are started using the `Worker` proxy, so that they are created by
+ * the main thread. Results sent by a node are collected as events are handled
+ * by the webR worker, e.g. while R is waiting in `Sys.sleep()`.
+ * @internal
+ */
+export class ClusterNodes {
+  #nodes = new Map<number, ClusterNode>();
+  #nextId = 1;
+
+  /**
+   * @param {string} url The URL of the cluster node worker script.
+   * @param {WebROptions} options Options for starting webR in each node.
+   */
+  constructor(readonly url: string, readonly options: WebROptions) {}
+
+  /**
+   * Start a new cluster node.
+   * @returns {number} An identifier for the node.
+   */
+  start(): number {
+    if (typeof Worker === 'undefined') {
+      throw new Error(
+        'A webR cluster requires the `SharedArrayBuffer` or `RingBuffer` communication channel.'
+      );
+    }
+    const node: ClusterNode = { worker: new Worker(this.url), ready: false, results: [] };
+    node.worker.onmessage = (ev: MessageEvent<ClusterMessage>) => {
+      const msg = ev.data;
+      switch (msg.type) {
+        case 'ready':
+          node.ready = true;
+          break;
+        case 'result':
+          node.results.push(msg.data);
+          break;
+        case 'error':
+          node.error = msg.message;
+          break;
+      }
+    };
+    node.worker.onerror = () => {
+      node.error = 'The webR cluster node has stopped unexpectedly.';
+    };
+    node.worker.postMessage({ type: 'init', options: this.options });
+
+    const id = this.#nextId++;
+    this.#nodes.set(id, node);
+    return id;
+  }
+
+  isReady(id: number): boolean {
+    return this.#get(id).ready;
+  }
+
+  /**
+   * Send a serialised task to a cluster node.
+   * @param {number} id The node identifier.
+   * @param {Uint8Array} data The serialised task. Its buffer is transferred to
+   * the node.
+   */
+  send(id: number, data: Uint8Array) {
+    this.#get(id).worker.postMessage({ type: 'eval', data }, [data.buffer]);
+  }
+
+  /**
+   * Take the oldest result received from a cluster node, without waiting.
+   * @param {number} id The node identifier.
+   * @returns {Uint8Array | null} The serialised result, or `null` if no result
+   * has been received.
+   */
+  recv(id: number): Uint8Array | null {
+    return this.#get(id).results.shift() ?? null;
+  }
+
+  stop(id: number) {
+    this.#nodes.get(id)?.worker.terminate();
+    this.#nodes.delete(id);
+  }
+
+  #get(id: number): ClusterNode {
+    const node = this.#nodes.get(id);
+    if (!node) {
+      throw new Error(`webR cluster node ${id} is not running.`);
+    }
+    if (node.error) {
+      throw new Error(node.error);
+    }
+    return node;
+  }
+}
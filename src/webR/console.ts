@@ -191,6 +191,9 @@ export class Console {
           break;
         case 'closed':
           return;
+        case 'metrics':
+          // Reported when the `metricsInterval` option is set
+          break;
         default:
           console.warn(`Unhandled output type for webR Console: ${output.type}.`);
       }
@@ -3,6 +3,7 @@ import type { RObject, RList } from './robj-worker';
 import type { EvalROptions } from './webr-chan';
 import type { UnwindProtectException } from './utils-r';
 import type { ChannelWorker } from './chan/channel';
+import type { ClusterNodes } from './cluster';
 import type { FSMountOptions } from './webr-main';
 
 export interface Module extends EmscriptenModule {
@@ -11,7 +12,9 @@ export interface Module extends EmscriptenModule {
    */
   FS: typeof FS & {
     _mount: typeof FS.mount;
+    _unmount: typeof FS.unmount;
     mkdirTree(path: string): void;
+    ErrnoError: new (errno: number) => Error & { errno: number };
     filesystems: {
       [key: string]: Emscripten.FileSystemType;
     }
@@ -36,9 +39,12 @@ export interface Module extends EmscriptenModule {
   ) => {
     status: number;
     response: string | ArrayBuffer;
+    headers?: { [name: string]: string };
   };
-  mountImageUrl: (url: string, mountpoint: string) => void;
+  mountImageUrl: (url: string, mountpoint: string, lazy?: boolean, hash?: string) => void;
   mountImagePath: (path: string, mountpoint: string) => void;
+  prefetchImageUrls: (urls: string[], hashes: string[], concurrency: number) => void;
+  fetchRepoMetadata: (url: string, path: string, force: boolean) => number;
   mountDriveFS: (mountpoint: string, options: FSMountOptions<'DRIVEFS'>) => void;
   // Exported Emscripten JS API
   allocateUTF8: typeof allocateUTF8;
@@ -121,6 +127,7 @@ export interface Module extends EmscriptenModule {
   _R_FalseValue: RPtr;
   _R_GlobalEnv: RPtr;
   _R_Interactive: RPtr;
+  _R_wait_usec: RPtr;
   _R_NaInt: RPtr;
   _R_NaReal: RPtr;
   _R_NaString: RPtr;
@@ -139,6 +146,7 @@ export interface Module extends EmscriptenModule {
   webr: {
     UnwindProtectException: typeof UnwindProtectException;
     channel: ChannelWorker | undefined,
+    cluster: ClusterNodes;
     canvas: {
       [key: number]: {
         ctx: OffscreenCanvasRenderingContext2D;
@@ -151,7 +159,7 @@ export interface Module extends EmscriptenModule {
     resolveInit: () => void;
     handleEvents: () => void;
     dataViewer: (data: RPtr, title: string) => void;
-    evalJs: (code: RPtr) => unknown;
+    evalJs: (code: RPtr, wait?: number, args?: RPtr) => RPtr;
     evalR: (expr: string | RObject, options?: EvalROptions) => RObject;
     captureR: (expr: string | RObject, options: EvalROptions) => {
       result: RObject,
@@ -3,20 +3,61 @@
  * @module Mount
  */
 
-import { ungzip } from 'pako';
+import { inflate, Inflate } from 'pako';
 import { Module } from './emscripten';
 import { IN_NODE } from './compat';
 import { DriveFS } from '@jupyterlite/contents';
-import type { FSMountOptions, FSMetaData } from './webr-main';
-import type { readFileSync } from 'fs';
+import type { FSMountOptions, FSMetaData, FSBlockIndex } from './webr-main';
+import type * as NodeFS from 'fs';
+import type { ImageCache } from './package-cache';
+
+type WorkerFileContents = {
+  size: number;
+  slice: (start?: number, end?: number) => WorkerFileContents;
+};
 
 type WorkerFileSystemType = Emscripten.FileSystemType & {
-  reader: { readAsArrayBuffer: (chunk: Buffer) => ArrayBuffer },
+  reader: { readAsArrayBuffer: (chunk: any) => ArrayBuffer },
   FILE_MODE: number
   createNode: (dir: FS.FSNode, file: string, mode: number, dev: number,
-    contents: ArrayBufferView, mtime?: Date) => FS.FSNode;
+    contents: WorkerFileContents, mtime?: Date) => FS.FSNode;
 };
 
+// Lazily mounted images are downloaded in blocks of this size, with up to
+// this many blocks cached for each image
+const RANGE_BLOCK_SIZE = 64 * 1024;
+const RANGE_CACHE_BLOCKS = 256;
+
+// Decompressed blocks of block-compressed images kept for each image
+const BLOCK_CACHE_BLOCKS = 8;
+
+// Images on disk are read in pages of this size, with up to this many pages
+// cached for each image
+const FILE_PAGE_SIZE = 64 * 1024;
+const FILE_CACHE_PAGES = 16;
+
+// Trailer magic number of block-compressed images, "WRBK"
+const BLOCK_IMAGE_MAGIC = 0x5752424b;
+
+/**
+ * Random access to the contents of a filesystem image.
+ * @internal
+ */
+export interface ImageReader {
+  /** Read bytes `start` to `end`, exclusive, of the image. */
+  read(start: number, end: number): Uint8Array;
+}
+
+/**
+ * Random access to a filesystem image of known length, so that trailing
+ * metadata can be located.
+ * @internal
+ */
+export interface SeekableImage extends ImageReader {
+  /** Read the last `length` bytes of the image. */
+  tail(length: number): Uint8Array;
+}
+
 /**
  * Hooked FS.mount() for using WORKERFS under Node.js or with `Blob` objects
  * replaced with Uint8Array over the communication channel.
@@ -68,41 +109,245 @@ export function mountDriveFS(mountpoint: string, options: FSMountOptions<'DRIVEF
   Module.FS.mount(fs, {}, mountpoint);
 }
 
+let imageCache: ImageCache | null = null;
+
+/**
+ * Set the cache consulted before downloading filesystem images.
+ * @internal
+ */
+export function setImageCache(cache: ImageCache | null) {
+  imageCache = cache;
+}
+
+// Cache keys include a hash of the expected image contents. Images without a
+// hash are instead cached with their ETag, see `cachedWithETag()`.
+function imageCacheKey(url: string, hash: string) {
+  return hash ? `${url}#${hash}` : null;
+}
+
+// A file cached with the ETag given by the server, for revalidation
+function cachedWithETag(url: string): { data: Uint8Array; etag: string } | null {
+  const data = imageCache?.get(url);
+  const etag = imageCache?.get(`${url}#etag`);
+  return data && etag ? { data, etag: new TextDecoder().decode(etag) } : null;
+}
+
+function putWithETag(url: string, data: Uint8Array, etag: string) {
+  imageCache?.put(url, data);
+  imageCache?.put(`${url}#etag`, new TextEncoder().encode(etag));
+}
+
+// Images downloaded ahead of mounting, by URL
+const prefetched = new Map<string, Uint8Array>();
+
+/**
+ * Download filesystem images ahead of mounting them with `mountImageUrl()`.
+ *
+ * Images that are not in the image cache are downloaded together by
+ * `download`, e.g. concurrently by the main thread. With `gunzip`, `download`
+ * may decompress gzip compressed images as they are received. This is only
+ * requested when none of the images are to be added to the image cache,
+ * which holds images as served, under the hash of their served contents.
+ * Any previously prefetched images that have not been mounted are discarded. If `download` throws, the
+ * images are instead downloaded one at a time as they are mounted. Prefetched
+ * images are held in memory until mounted, so callers should prefetch a
+ * bounded batch of images at a time.
+ * @internal
+ */
+export function prefetchImageUrls(
+  urls: string[],
+  hashes: string[],
+  download: (urls: string[], gunzip: boolean) => (Uint8Array | null)[]
+) {
+  prefetched.clear();
+  const pending: number[] = [];
+  urls.forEach((url, i) => {
+    const key = imageCacheKey(url, hashes[i]);
+    const cached = key ? imageCache?.get(key) : null;
+    if (cached) {
+      prefetched.set(url, cached);
+    } else {
+      pending.push(i);
+    }
+  });
+  if (pending.length === 0) {
+    return;
+  }
+
+  const keys = pending.map((i) => imageCacheKey(urls[i], hashes[i]));
+  const gunzip = !imageCache || keys.every((key) => !key);
+  let images: (Uint8Array | null)[];
+  try {
+    images = download(pending.map((i) => urls[i]), gunzip);
+  } catch {
+    return;
+  }
+  pending.forEach((i, j) => {
+    const data = images[j];
+    const key = keys[j];
+    if (data) {
+      prefetched.set(urls[i], data);
+      if (key) {
+        imageCache?.put(key, data);
+      }
+    }
+  });
+}
+
+// Repository metadata downloaded in this session, by URL
+const repoMetadata = new Map<string, { data: Uint8Array; etag: string; written: boolean }>();
+
+/**
+ * Download the metadata of a package repository, such as its `PACKAGES`
+ * file, and write it to `path` in the VFS.
+ *
+ * Metadata with an `ETag` is kept for the session, and in the image cache if
+ * set, and later requests for it are conditional. Metadata that has not
+ * changed since it was last written is not downloaded or written again,
+ * unless `force` is set. Kept metadata is also used when the repository
+ * can't be reached.
+ * @returns {number} `1` if metadata was written to `path`, `0` if it is
+ * unchanged, or `-1` if it is not available.
+ * @internal
+ */
+export function fetchRepoMetadata(url: string, path: string, force: boolean): number {
+  let entry = repoMetadata.get(url);
+  if (!entry) {
+    const cached = cachedWithETag(url);
+    if (cached) {
+      entry = { ...cached, written: false };
+      repoMetadata.set(url, entry);
+    }
+  }
+
+  const resp = Module.downloadFileContent(url, entry ? [`If-None-Match: ${entry.etag}`] : []);
+  if (resp.status >= 200 && resp.status < 300) {
+    const data = new Uint8Array(resp.response as ArrayBuffer);
+    const etag = resp.headers?.etag;
+    entry = { data, etag: etag ?? '', written: false };
+    if (etag) {
+      repoMetadata.set(url, entry);
+      putWithETag(url, data, etag);
+    } else {
+      repoMetadata.delete(url);
+    }
+  } else if (!entry) {
+    return -1;
+  }
+
+  if (entry.written && !force) {
+    return 0;
+  }
+  Module.FS.writeFile(path, entry.data);
+  entry.written = true;
+  return 1;
+}
+
+// Take an image from those prefetched, or from the image cache
+function takeCachedImage(url: string, hash: string): Uint8Array | null {
+  const data = prefetched.get(url);
+  if (data) {
+    prefetched.delete(url);
+    return data;
+  }
+  const key = imageCacheKey(url, hash);
+  return (key && imageCache?.get(key)) || null;
+}
+
+// Download a file, or take it from the prefetched images or image cache
+function downloadImageFile(url: string, hash: string, error: string): ArrayBuffer {
+  const toBuffer = (data: Uint8Array) => data.byteLength === data.buffer.byteLength
+    ? data.buffer as ArrayBuffer
+    : data.slice().buffer;
+
+  const cached = takeCachedImage(url, hash);
+  if (cached) {
+    return toBuffer(cached);
+  }
+
+  // Without a hash of the expected contents, a cached copy is only used once
+  // the server confirms that it is unchanged
+  const key = imageCacheKey(url, hash);
+  const stale = key ? null : cachedWithETag(url);
+  const resp = Module.downloadFileContent(url, stale ? [`If-None-Match: ${stale.etag}`] : []);
+  if (resp.status === 304 && stale) {
+    return toBuffer(stale.data);
+  }
+  if (resp.status < 200 || resp.status >= 300) {
+    throw new Error(error);
+  }
+  const data = resp.response as ArrayBuffer;
+  const etag = resp.headers?.etag;
+  if (key) {
+    imageCache?.put(key, new Uint8Array(data));
+  } else if (etag) {
+    putWithETag(url, new Uint8Array(data), etag);
+  }
+  return data;
+}
+
 /**
  * Download an Emscripten FS image and mount to the VFS
+ *
+ * With `lazy`, only the image metadata is downloaded when mounting. File
+ * contents are downloaded when read, using HTTP `Range` requests. Images
+ * that are gzip compressed, or that do not provide their metadata separately
+ * or with an index hint, are downloaded in full.
+ *
+ * Images prefetched with `prefetchImageUrls()` are mounted without further
+ * downloads. When an image cache is set, images are mounted from the cache if
+ * present, and added to the cache when downloaded in full. `hash` identifies the
+ * expected contents of the image, if known. Cached images without a hash are
+ * revalidated with the server using their `ETag` before they are mounted.
  * @internal
  */
-export function mountImageUrl(url: string, mountpoint: string) {
+export function mountImageUrl(url: string, mountpoint: string, lazy = false, hash = '') {
+  const cached = /\.vfs$|\.tgz$|\.tar\.gz$|\.tar$/.test(url)
+    ? takeCachedImage(url, hash)
+    : null;
+
+  if (/\.vfs$/.test(url)) {
+    // Block-compressed VFS format - decompressed as files are read
+    let image: RangeImage | MemoryImage;
+    if (cached) {
+      image = new MemoryImage(cached);
+    } else if (lazy) {
+      image = new RangeImage(url);
+    } else {
+      const data = downloadImageFile(url, hash, "Can't download Emscripten filesystem image.");
+      image = new MemoryImage(new Uint8Array(data));
+    }
+    mountBlockImage(image, mountpoint);
+    return;
+  }
+
+  if (lazy && !cached && mountImageUrlLazy(url, mountpoint)) {
+    return;
+  }
+
   if (/\.tgz$|\.tar\.gz$|\.tar$/.test(url)) {
     // New (v2.0) VFS format - metadata appended to package
-    const dataResp = Module.downloadFileContent(url);
-    if (dataResp.status < 200 || dataResp.status >= 300) {
-      throw new Error("Can't download Emscripten filesystem image.");
-    }
-    const { data, metadata } = decodeVFSArchive(dataResp.response as ArrayBuffer);
+    const archive = cached
+      ?? new Uint8Array(downloadImageFile(url, hash, "Can't download Emscripten filesystem image."));
+    const { data, metadata } = decodeVFSArchive(archive);
     mountImageData(data, metadata, mountpoint);
   } else {
     // Legacy (v1.0) VFS format - from Emscripten's file_packager
     const urlBase = url.replace(/\.data\.gz$|\.data$|\.js.metadata$/, '');
-    const metaResp = Module.downloadFileContent(`${urlBase}.js.metadata`);
-    if (metaResp.status < 200 || metaResp.status >= 300) {
-      throw new Error("Can't download Emscripten filesystem image metadata.");
-    }
+    const metaData = downloadImageFile(
+      `${urlBase}.js.metadata`, hash, "Can't download Emscripten filesystem image metadata."
+    );
 
-    const metadata = JSON.parse(
-      new TextDecoder().decode(metaResp.response as ArrayBuffer)
-    ) as FSMetaData;
+    const metadata = JSON.parse(new TextDecoder().decode(metaData)) as FSMetaData;
 
     const ext = metadata.gzip ? '.data.gz' : '.data';
-    const dataResp = Module.downloadFileContent(`${urlBase}${ext}`);
-    if (dataResp.status < 200 || dataResp.status >= 300) {
-      throw new Error("Can't download Emscripten filesystem image data.");
-    }
+    let data = downloadImageFile(
+      `${urlBase}${ext}`, hash, "Can't download Emscripten filesystem image data."
+    );
 
     // Decompress filesystem data, if required
-    let data = dataResp.response as ArrayBuffer;
     if (metadata.gzip) {
-      data = ungzip(data).buffer as ArrayBuffer;
+      data = gunzip(new Uint8Array(data)).buffer as ArrayBuffer;
     }
     mountImageData(data, metadata, mountpoint);
   }
@@ -113,11 +358,19 @@ export function mountImageUrl(url: string, mountpoint: string) {
  * @internal
  */
 export function mountImagePath(path: string, mountpoint: string) {
-  const fs = require('fs') as {
-    readFileSync: typeof readFileSync;
-  };
+  const fs = require('fs') as typeof NodeFS;
 
-  if (/\.tgz$|\.tar\.gz$|\.tar$/.test(path)) {
+  if (/\.vfs$/.test(path)) {
+    // Block-compressed VFS format - decompressed as files are read
+    mountFileImage(path, mountpoint, (image) => {
+      mountBlockImage(image, mountpoint);
+      return true;
+    });
+  } else if (/\.tar$/.test(path) &&
+    mountFileImage(path, mountpoint, (image) => mountArchiveReader(image, mountpoint))) {
+    // Uncompressed v2.0 VFS format with metadata hint - read as files are read
+    return;
+  } else if (/\.tgz$|\.tar\.gz$|\.tar$/.test(path)) {
     // New (v2.0) VFS format - metadata appended to package
     const buffer = fs.readFileSync(path);
     const { data, metadata } = decodeVFSArchive(buffer);
@@ -129,61 +382,516 @@ export function mountImagePath(path: string, mountpoint: string) {
       fs.readFileSync(`${pathBase}.js.metadata`, 'utf8')
     ) as FSMetaData;
 
-    const ext = metadata.gzip ? '.data.gz' : '.data';
-    const fileData = fs.readFileSync(`${pathBase}${ext}`);
-    let data = new Uint8Array(fileData).buffer as ArrayBuffer;
-
-    // Decompress filesystem data, if required
     if (metadata.gzip) {
-      data = ungzip(data).buffer as ArrayBuffer;
+      // Compressed data - decompressed in full
+      const data = gunzip(fs.readFileSync(`${pathBase}.data.gz`));
+      mountImageData(data.buffer as ArrayBuffer, metadata, mountpoint);
+    } else {
+      // Uncompressed data - read as files are read
+      mountFileImage(`${pathBase}.data`, mountpoint, (image) => {
+        mountImageReader(image, metadata, mountpoint);
+        return true;
+      });
     }
-    mountImageData(data, metadata, mountpoint);
   }
 }
 
+// Image files in use by mounted filesystems, by mountpoint
+const mountedFileImages = new Map<string, FileImage[]>();
+
+// Open the image file at `path` and mount it with `mount`, which returns
+// `false` if the image can't be mounted that way. The file is closed when the
+// filesystem at `mountpoint` is unmounted, or immediately if not mounted.
+function mountFileImage(path: string, mountpoint: string, mount: (image: FileImage) => boolean) {
+  const image = new FileImage(path);
+  let mounted = false;
+  try {
+    mounted = mount(image);
+  } finally {
+    if (!mounted) {
+      image.close();
+    }
+  }
+  if (mounted) {
+    const root = Module.FS.lookupPath(mountpoint, {}).path;
+    mountedFileImages.set(root, [...(mountedFileImages.get(root) ?? []), image]);
+  }
+  return mounted;
+}
+
+/**
+ * Hooked FS.unmount(), closing the image files used by the filesystem.
+ * @internal
+ */
+export function unmountFS(mountpoint: string) {
+  const root = Module.FS.lookupPath(mountpoint, {}).path;
+  Module.FS._unmount(mountpoint);
+  mountedFileImages.get(root)?.forEach((image) => image.close());
+  mountedFileImages.delete(root);
+}
+
+/**
+ * Random access to a remote file using HTTP `Range` requests, keeping the
+ * most recently used blocks of the file in memory.
+ *
+ * If the server does not support range requests the whole file is received
+ * with the first request, and is kept in memory instead.
+ * @internal
+ */
+export class RangeImage implements SeekableImage {
+  #blocks = new Map<number, Uint8Array>();
+  #whole: Uint8Array | null = null;
+
+  constructor(readonly url: string) {}
+
+  #download(range: string): Uint8Array {
+    const resp = Module.downloadFileContent(this.url, [`Range: bytes=${range}`]);
+    if (resp.status < 200 || resp.status >= 300) {
+      throw new Error(`Can't download bytes ${range} of "${this.url}".`);
+    }
+    const data = new Uint8Array(resp.response as ArrayBuffer);
+    if (resp.status !== 206) {
+      this.#whole = data;
+      this.#blocks.clear();
+    }
+    return data;
+  }
+
+  /** Read the last `length` bytes of the file. */
+  tail(length: number): Uint8Array {
+    const data = this.#download(`-${length}`);
+    return this.#whole ? data.subarray(Math.max(0, data.length - length)) : data;
+  }
+
+  /** Read bytes `start` to `end`, exclusive, of the file. */
+  read(start: number, end: number): Uint8Array {
+    if (this.#whole) {
+      return this.#whole.subarray(start, end);
+    }
+    const out = new Uint8Array(Math.max(0, end - start));
+    const last = Math.floor((end - 1) / RANGE_BLOCK_SIZE);
+    let index = Math.floor(start / RANGE_BLOCK_SIZE);
+    while (index <= last) {
+      const block = this.#blocks.get(index);
+      if (block) {
+        // Mark the block as most recently used
+        this.#blocks.delete(index);
+        this.#blocks.set(index, block);
+        this.#copy(out, start, index, block);
+        index++;
+        continue;
+      }
+
+      // Download a run of missing blocks with a single request
+      let runEnd = index;
+      while (runEnd < last && !this.#blocks.has(runEnd + 1)) {
+        runEnd++;
+      }
+      const data = this.#download(
+        `${index * RANGE_BLOCK_SIZE}-${(runEnd + 1) * RANGE_BLOCK_SIZE - 1}`
+      );
+      if (this.#whole) {
+        return this.#whole.subarray(start, end);
+      }
+      for (let i = index; i <= runEnd; i++) {
+        const offset = (i - index) * RANGE_BLOCK_SIZE;
+        const block = data.slice(offset, offset + RANGE_BLOCK_SIZE);
+        this.#copy(out, start, i, block);
+        this.#cache(i, block);
+      }
+      index = runEnd + 1;
+    }
+    return out;
+  }
+
+  #copy(out: Uint8Array, start: number, index: number, block: Uint8Array) {
+    const blockStart = index * RANGE_BLOCK_SIZE;
+    const from = Math.max(0, start - blockStart);
+    const to = Math.min(block.length, start + out.length - blockStart);
+    if (to > from) {
+      out.set(block.subarray(from, to), blockStart + from - start);
+    }
+  }
+
+  #cache(index: number, block: Uint8Array) {
+    this.#blocks.set(index, block);
+    if (this.#blocks.size > RANGE_CACHE_BLOCKS) {
+      this.#blocks.delete(this.#blocks.keys().next().value as number);
+    }
+  }
+}
+
+// Emscripten's errno for a bad file descriptor
+const ERRNO_EBADF = 8;
+
+// Image files are closed when the filesystem they are mounted in is
+// unmounted. As a backstop, they are also closed once their images are no
+// longer referenced.
+const fileImageRegistry = typeof FinalizationRegistry !== 'undefined'
+  ? new FinalizationRegistry<number>((fd) => {
+    try {
+      (require('fs') as typeof NodeFS).closeSync(fd);
+    } catch {
+      // The file has already been closed
+    }
+  })
+  : null;
+
+/**
+ * Random access to a filesystem image on disk, using positioned reads from
+ * an open file descriptor (requires Node). The most recently used pages of
+ * the file are kept in memory, so that mounting the image does not require
+ * reading it in full.
+ * @internal
+ */
+export class FileImage implements SeekableImage {
+  readonly fd: number;
+  readonly size: number;
+  #pages = new Map<number, Uint8Array>();
+  #closed = false;
+
+  constructor(readonly path: string) {
+    const fs = require('fs') as typeof NodeFS;
+    this.fd = fs.openSync(path, 'r');
+    try {
+      this.size = fs.fstatSync(this.fd).size;
+    } catch (e) {
+      fs.closeSync(this.fd);
+      throw e;
+    }
+    fileImageRegistry?.register(this, this.fd, this);
+  }
+
+  /** Close the file. The image can't be read once closed. */
+  close() {
+    if (this.#closed) {
+      return;
+    }
+    this.#closed = true;
+    this.#pages.clear();
+    fileImageRegistry?.unregister(this);
+    (require('fs') as typeof NodeFS).closeSync(this.fd);
+  }
+
+  /** Read the last `length` bytes of the file. */
+  tail(length: number): Uint8Array {
+    return this.read(Math.max(0, this.size - length), this.size);
+  }
+
+  /**
+   * Read bytes `start` to `end`, exclusive, of the file. Fails with `EBADF`
+   * once the image has been closed, so that streams left open after
+   * unmounting can't read from a file descriptor that may have been reused.
+   */
+  read(start: number, end: number): Uint8Array {
+    if (this.#closed) {
+      throw new Module.FS.ErrnoError(ERRNO_EBADF);
+    }
+    end = Math.min(end, this.size);
+    const out = new Uint8Array(Math.max(0, end - start));
+    const first = Math.floor(start / FILE_PAGE_SIZE);
+    const last = Math.floor((end - 1) / FILE_PAGE_SIZE);
+
+    // Larger reads bypass the page cache
+    if (last - first + 1 > 2) {
+      this.#readInto(out, start);
+      return out;
+    }
+
+    for (let index = first; index <= last; index++) {
+      let page = this.#pages.get(index);
+      if (page) {
+        // Mark the page as most recently used
+        this.#pages.delete(index);
+      } else {
+        const pageStart = index * FILE_PAGE_SIZE;
+        page = new Uint8Array(Math.min(FILE_PAGE_SIZE, this.size - pageStart));
+        this.#readInto(page, pageStart);
+        if (this.#pages.size >= FILE_CACHE_PAGES) {
+          this.#pages.delete(this.#pages.keys().next().value as number);
+        }
+      }
+      this.#pages.set(index, page);
+
+      const pageStart = index * FILE_PAGE_SIZE;
+      const from = Math.max(0, start - pageStart);
+      const to = Math.min(page.length, end - pageStart);
+      out.set(page.subarray(from, to), pageStart + from - start);
+    }
+    return out;
+  }
+
+  #readInto(buffer: Uint8Array, position: number) {
+    const fs = require('fs') as typeof NodeFS;
+    let offset = 0;
+    while (offset < buffer.length) {
+      const n = fs.readSync(this.fd, buffer, offset, buffer.length - offset, position + offset);
+      if (n === 0) {
+        throw new Error(`Can't read filesystem image "${this.path}", unexpected end of file.`);
+      }
+      offset += n;
+    }
+  }
+}
+
+/**
+ * Random access to a filesystem image held in memory.
+ * @internal
+ */
+export class MemoryImage implements SeekableImage {
+  constructor(readonly data: Uint8Array) {}
+
+  /** Read the last `length` bytes of the image. */
+  tail(length: number): Uint8Array {
+    return this.data.subarray(Math.max(0, this.data.length - length));
+  }
+
+  read(start: number, end: number): Uint8Array {
+    return this.data.subarray(start, end);
+  }
+}
+
+/**
+ * Random access to the uncompressed contents of a block-compressed
+ * filesystem image. Blocks are decompressed when first read, with the most
+ * recently used blocks kept in memory.
+ * @internal
+ */
+export class BlockImage implements ImageReader {
+  #blocks = new Map<number, Uint8Array>();
+
+  constructor(readonly image: ImageReader, readonly index: FSBlockIndex) {}
+
+  read(start: number, end: number): Uint8Array {
+    const size = this.index.size;
+    const out = new Uint8Array(Math.max(0, end - start));
+    for (let i = Math.floor(start / size); i * size < end; i++) {
+      const block = this.#block(i);
+      const from = Math.max(0, start - i * size);
+      const to = Math.min(block.length, end - i * size);
+      if (to > from) {
+        out.set(block.subarray(from, to), i * size + from - start);
+      }
+    }
+    return out;
+  }
+
+  #block(i: number): Uint8Array {
+    let block = this.#blocks.get(i);
+    if (block) {
+      this.#blocks.delete(i);
+    } else {
+      const { offsets, compression } = this.index;
+      if (i + 1 >= offsets.length) {
+        throw new Error(`Block ${i} is out of range for the filesystem image.`);
+      }
+      const data = this.image.read(offsets[i], offsets[i + 1]);
+      block = compression === 'zlib' ? inflate(data) : data.slice();
+      if (this.#blocks.size >= BLOCK_CACHE_BLOCKS) {
+        this.#blocks.delete(this.#blocks.keys().next().value as number);
+      }
+    }
+    this.#blocks.set(i, block);
+    return block;
+  }
+}
+
+// Mount a block-compressed image, reading its metadata from the trailer at
+// the end of the image
+function mountBlockImage(image: SeekableImage, mountpoint: string) {
+  const trailer = new DataView(image.tail(16).slice().buffer);
+  if (trailer.byteLength !== 16 || trailer.getUint32(0) !== BLOCK_IMAGE_MAGIC) {
+    throw new Error("Can't mount image, not a block-compressed VFS image.");
+  }
+  // const version = trailer.getInt32(4);
+  const offset = trailer.getInt32(8);
+  const len = trailer.getInt32(12);
+  if (offset < 0 || len < 0) {
+    throw new Error("Can't mount image, invalid block-compressed VFS image trailer.");
+  }
+  const bytes = image.read(offset, offset + len);
+  const metadata = JSON.parse(new TextDecoder().decode(bytes)) as FSMetaData;
+  if (!metadata.blocks) {
+    throw new Error("Can't mount image, no block index found in VFS metadata.");
+  }
+  mountImageReader(new BlockImage(image, metadata.blocks), metadata, mountpoint);
+}
+
 // Mount the filesystem image `data` and `metadata` to the VFS at `mountpoint`
 function mountImageData(data: ArrayBuffer, metadata: FSMetaData, mountpoint: string) {
-  if (IN_NODE) {
-    const buf = Buffer.from(data);
-    const WORKERFS = Module.FS.filesystems.WORKERFS as WorkerFileSystemType;
-
-    if (!WORKERFS.reader) WORKERFS.reader = {
-      readAsArrayBuffer: (chunk: Buffer) => new Uint8Array(chunk).buffer,
-    };
-
-    metadata.files.forEach((f: { filename: string, start: number, end: number }) => {
-      const contents: Buffer & { size?: number } = buf.subarray(f.start, f.end);
-      contents.size = contents.byteLength;
-      contents.slice = (start?: number, end?: number) => {
-        const sub: Buffer & { size?: number } = contents.subarray(start, end);
-        sub.size = sub.byteLength;
-        return sub;
-      };
-      const parts = (mountpoint + f.filename).split('/');
-      const file = parts.pop();
-      if (!file) {
-        throw new Error(`Invalid mount path "${mountpoint}${f.filename}".`);
-      }
-      const dir = parts.join('/');
-      Module.FS.mkdirTree(dir);
-      const dirNode = Module.FS.lookupPath(dir, {}).node;
-      WORKERFS.createNode(dirNode, file, WORKERFS.FILE_MODE, 0, contents);
-    });
+  // File contents are read directly from the image data, rather than from a
+  // copy of it in a `Blob`
+  const image = new MemoryImage(new Uint8Array(data));
+  if (metadata.blocks) {
+    mountImageReader(new BlockImage(image, metadata.blocks), metadata, mountpoint);
   } else {
-    // Main thread communication casts `Blob` to Uint8Array
-    // FIXME: Use a replacer + reviver to handle `Blob`s
-    Module.FS._mount(Module.FS.filesystems.WORKERFS, {
-      packages: [{
-        blob: new Blob([data]),
-        metadata,
-      }],
-    }, mountpoint);
+    mountImageReader(image, metadata, mountpoint);
+  }
+}
+
+// Create WORKERFS nodes for the files listed in `metadata`, with contents
+// given for each range of the filesystem image
+function createImageNodes(
+  metadata: FSMetaData,
+  mountpoint: string,
+  contents: (start: number, end: number) => WorkerFileContents
+) {
+  const WORKERFS = Module.FS.filesystems.WORKERFS as WorkerFileSystemType;
+  metadata.files.forEach((f: { filename: string, start: number, end: number }) => {
+    const parts = (mountpoint + f.filename).split('/');
+    const file = parts.pop();
+    if (!file) {
+      throw new Error(`Invalid mount path "${mountpoint}${f.filename}".`);
+    }
+    const dir = parts.join('/');
+    Module.FS.mkdirTree(dir);
+    const dirNode = Module.FS.lookupPath(dir, {}).node;
+    WORKERFS.createNode(dirNode, file, WORKERFS.FILE_MODE, 0, contents(f.start, f.end));
+  });
+}
+
+// The contents of a file in a filesystem image that is read on demand
+class ImageFileContents {
+  constructor(readonly image: ImageReader, readonly start: number, readonly end: number) {}
+
+  get size() {
+    return this.end - this.start;
+  }
+
+  slice(start = 0, end = this.size): ImageFileContents {
+    return new ImageFileContents(
+      this.image,
+      this.start + start,
+      this.start + Math.min(end, this.size)
+    );
+  }
+
+  read(): ArrayBuffer {
+    const data = this.image.read(this.start, this.end);
+    return data.byteLength === data.buffer.byteLength
+      ? data.buffer as ArrayBuffer
+      : data.slice().buffer;
+  }
+}
+
+// Let WORKERFS read from images read on demand, in addition to its usual
+// sources of file contents
+let imageReaderInstalled = false;
+function installImageReader() {
+  if (imageReaderInstalled) {
+    return;
+  }
+  const WORKERFS = Module.FS.filesystems.WORKERFS as WorkerFileSystemType;
+  const reader = WORKERFS.reader ?? (IN_NODE
+    ? { readAsArrayBuffer: (chunk: Buffer) => new Uint8Array(chunk).buffer }
+    : new FileReaderSync());
+  WORKERFS.reader = {
+    readAsArrayBuffer: (chunk: unknown) => chunk instanceof ImageFileContents
+      ? chunk.read()
+      : reader.readAsArrayBuffer(chunk as Blob & Buffer),
+  };
+  imageReaderInstalled = true;
+}
+
+// Mount an image whose file contents are read on demand. Files are created
+// within an in-memory filesystem, so that the image can be unmounted as a
+// whole.
+function mountImageReader(image: ImageReader, metadata: FSMetaData, mountpoint: string) {
+  Module.FS.mkdirTree(mountpoint);
+  if (!Module.FS.isMountpoint(Module.FS.lookupPath(mountpoint, {}).node)) {
+    Module.FS._mount(Module.FS.filesystems.MEMFS, {}, mountpoint);
+  }
+  installImageReader();
+  createImageNodes(metadata, mountpoint, (start, end) => new ImageFileContents(image, start, end));
+}
+
+// Mount an image from its metadata, reading file contents on demand.
+// Returns `false` if the image format does not allow it.
+function mountImageUrlLazy(url: string, mountpoint: string): boolean {
+  if (/\.tgz$|\.tar\.gz$/.test(url)) {
+    return false;
+  } else if (/\.tar$/.test(url)) {
+    return mountArchiveReader(new RangeImage(url), mountpoint);
+  }
+
+  const urlBase = url.replace(/\.data\.gz$|\.data$|\.js.metadata$/, '');
+  const metaResp = Module.downloadFileContent(`${urlBase}.js.metadata`);
+  if (metaResp.status < 200 || metaResp.status >= 300) {
+    throw new Error("Can't download Emscripten filesystem image metadata.");
+  }
+  const metadata = JSON.parse(
+    new TextDecoder().decode(metaResp.response as ArrayBuffer)
+  ) as FSMetaData;
+  if (metadata.gzip) {
+    return false;
+  }
+  mountImageReader(new RangeImage(`${urlBase}.data`), metadata, mountpoint);
+  return true;
+}
+
+// Mount an uncompressed v2.0 VFS archive, locating its metadata with the
+// archive hint and reading file contents on demand. Returns `false` if the
+// archive has no hint.
+function mountArchiveReader(image: SeekableImage, mountpoint: string): boolean {
+  const index = getArchiveMetadata(image.tail(16).slice().buffer);
+  if (!index) {
+    return false;
+  }
+  const bytes = image.read(512 * index.block, 512 * index.block + index.len);
+  const metadata = JSON.parse(new TextDecoder().decode(bytes)) as FSMetaData;
+  mountImageReader(image, metadata, mountpoint);
+  return true;
+}
+
+/**
+ * Decompress gzip data into a single buffer.
+ *
+ * The buffer is sized from the uncompressed length recorded in the gzip
+ * trailer, and output is copied into it as it is inflated, rather than
+ * collected in chunks and then concatenated.
+ * @internal
+ */
+export function gunzip(data: Uint8Array): Uint8Array {
+  const view = new DataView(data.buffer, data.byteOffset, data.byteLength);
+  // The recorded length is bounded by the largest possible deflate ratio, in
+  // case of a corrupt or malicious trailer
+  const isize = data.length >= 4 ? view.getUint32(data.length - 4, true) : 0;
+  let out = new Uint8Array(Math.min(isize, data.length * 1032));
+  let length = 0;
+
+  const inflator = new Inflate({ chunkSize: 256 * 1024 });
+  // The end of the stream is only reported for complete input
+  let ended = false;
+  const onEnd = inflator.onEnd.bind(inflator);
+  inflator.onEnd = (status: number) => {
+    ended = true;
+    onEnd(status);
+  };
+  inflator.onData = (chunk: Uint8Array) => {
+    // The recorded length is modulo 2^32, and covers only the last member
+    if (length + chunk.length > out.length) {
+      const grown = new Uint8Array(Math.max(2 * out.length, length + chunk.length));
+      grown.set(out.subarray(0, length));
+      out = grown;
+    }
+    out.set(chunk, length);
+    length += chunk.length;
+  };
+  inflator.push(data, true);
+  if (inflator.err || !ended) {
+    throw new Error(`Can't decompress filesystem image: ${inflator.msg || 'unexpected end of data'}.`);
   }
+  return length === out.length ? out : out.slice(0, length);
 }
 
-// Decode archive data and metadata encoded in v2.0 VFS image
-function decodeVFSArchive(data: ArrayBuffer | Buffer) {
-  const buffer = ungzip(new Uint8Array(data)).buffer as ArrayBuffer;
+// Decode archive data and metadata encoded in v2.0 VFS image, which may be
+// gzip compressed
+function decodeVFSArchive(data: ArrayBuffer | Uint8Array) {
+  const input = data instanceof Uint8Array ? data : new Uint8Array(data);
+  const archive = input[0] === 0x1f && input[1] === 0x8b ? gunzip(input) : input;
+  const buffer = archive.byteLength === archive.buffer.byteLength
+    ? archive.buffer as ArrayBuffer
+    : archive.slice().buffer;
   const index = getArchiveMetadata(buffer) || findArchiveMetadata(buffer);
   if (!index) {
     throw new Error("Can't mount archive, no VFS metadata found.");
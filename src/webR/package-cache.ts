@@ -0,0 +1,236 @@
+/**
+ * Persistent caching of downloaded filesystem images, such as the images
+ * used to mount R packages.
+ * @module PackageCache
+ */
+import { digestString, digestStringSync } from './utils';
+import type { ChannelWorker } from './chan/channel';
+import type * as NodeFS from 'fs';
+import type * as NodeOS from 'os';
+import type * as NodePath from 'path';
+
+/**
+ * Options for caching downloaded filesystem images, such as R packages, so
+ * that they can be mounted without network access in later sessions.
+ */
+export interface PackageCacheOptions {
+  /**
+   * The largest total size of cached images, in bytes. The least recently
+   * used images are removed when the limit is exceeded.
+   * Default: `512` MiB.
+   */
+  maxSize?: number;
+
+  /**
+   * The directory where images are cached, when running under Node.js. In a
+   * web browser, images are cached using the Cache API.
+   * Default: `webr-packages` in the system temporary directory.
+   */
+  dir?: string;
+}
+
+const PACKAGE_CACHE = 'webr-packages';
+const PACKAGE_CACHE_MAX_SIZE = 512 * 1024 * 1024;
+
+/**
+ * A cache of filesystem images, used synchronously by the webR worker.
+ *
+ * Entries are keyed by the URL of the image and a hash of its expected
+ * contents, so that a changed image is never served for a URL. Images without
+ * a known hash are stored with their `ETag`, and revalidated with the server
+ * before use. Entries are named by the SHA-256 digest of their key.
+ * @internal
+ */
+export interface ImageCache {
+  get(key: string): Uint8Array | null;
+  put(key: string, data: Uint8Array): void;
+}
+
+/**
+ * An image cache stored in a directory, for use under Node.js.
+ * @internal
+ */
+export class NodeImageCache implements ImageCache {
+  readonly dir: string;
+  readonly maxSize: number;
+
+  constructor(options: PackageCacheOptions) {
+    const os = require('os') as typeof NodeOS;
+    const path = require('path') as typeof NodePath;
+    this.dir = options.dir ?? path.join(os.tmpdir(), PACKAGE_CACHE);
+    this.maxSize = options.maxSize ?? PACKAGE_CACHE_MAX_SIZE;
+  }
+
+  get(key: string): Uint8Array | null {
+    const fs = require('fs') as typeof NodeFS;
+    const file = this.#path(key);
+    try {
+      const data = fs.readFileSync(file);
+      // The modification time records when the entry was last used
+      const now = new Date();
+      fs.utimesSync(file, now, now);
+      return new Uint8Array(data.buffer, data.byteOffset, data.byteLength);
+    } catch {
+      return null;
+    }
+  }
+
+  put(key: string, data: Uint8Array) {
+    const fs = require('fs') as typeof NodeFS;
+    if (data.byteLength > this.maxSize) {
+      return;
+    }
+    try {
+      fs.mkdirSync(this.dir, { recursive: true });
+      // Write under a temporary name, so that other sessions never read a
+      // partially written entry
+      const file = this.#path(key);
+      const tmp = `${file}.${Math.random().toString(36).slice(2)}.tmp`;
+      fs.writeFileSync(tmp, data);
+      fs.renameSync(tmp, file);
+      this.#evict();
+    } catch (e) {
+      console.warn(`Can't write to the webR package cache: ${(e as Error).message}`);
+    }
+  }
+
+  #path(key: string): string {
+    const path = require('path') as typeof NodePath;
+    return path.join(this.dir, digestStringSync(key));
+  }
+
+  // Remove the least recently used entries until the cache fits its limit
+  #evict() {
+    const fs = require('fs') as typeof NodeFS;
+    const path = require('path') as typeof NodePath;
+    const entries = fs.readdirSync(this.dir)
+      .filter((name) => !name.endsWith('.tmp'))
+      .map((name) => {
+        const file = path.join(this.dir, name);
+        const stat = fs.statSync(file);
+        return { file, size: stat.size, used: stat.mtimeMs };
+      })
+      .sort((a, b) => a.used - b.used);
+    let total = entries.reduce((sum, entry) => sum + entry.size, 0);
+    for (const entry of entries) {
+      if (total <= this.maxSize) {
+        break;
+      }
+      fs.rmSync(entry.file, { force: true });
+      total -= entry.size;
+    }
+  }
+}
+
+/**
+ * An image cache kept by the main thread, used from the webR worker with
+ * synchronous requests. Requires the `SharedArrayBuffer` or `RingBuffer`
+ * communication channel.
+ * @internal
+ */
+export class ChannelImageCache implements ImageCache {
+  #enabled = true;
+
+  constructor(readonly chan: ChannelWorker) {}
+
+  get(key: string): Uint8Array | null {
+    if (!this.#enabled) {
+      return null;
+    }
+    try {
+      const response = this.chan.syncRequest({ type: 'cache-get', data: { key } });
+      // Large responses are views of a shared buffer, which some consumers
+      // such as TextDecoder reject, so the image is copied
+      return (response.data as Uint8Array | null)?.slice() ?? null;
+    } catch {
+      // Synchronous requests are not supported by this channel
+      this.#enabled = false;
+      return null;
+    }
+  }
+
+  put(key: string, data: Uint8Array) {
+    if (!this.#enabled) {
+      return;
+    }
+    // The copy is transferred, as the caller may keep using the original
+    const copy = data.slice();
+    this.chan.writeSystem({ type: 'cachePut', data: { key, data: copy } }, [copy.buffer]);
+  }
+}
+
+type BrowserCacheIndex = { [name: string]: { size: number; used: number } };
+
+/**
+ * An image cache using the Cache API, for use by the main thread in a web
+ * browser. An index of entry sizes and last use times is kept alongside the
+ * entries, for eviction of the least recently used entries.
+ * @internal
+ */
+export class BrowserPackageCache {
+  readonly maxSize: number;
+  #queue: Promise<unknown> = Promise.resolve();
+
+  constructor(options: PackageCacheOptions) {
+    this.maxSize = options.maxSize ?? PACKAGE_CACHE_MAX_SIZE;
+  }
+
+  async get(key: string): Promise<Uint8Array | null> {
+    if (typeof caches === 'undefined') {
+      return null;
+    }
+    const cache = await caches.open(PACKAGE_CACHE);
+    const name = await digestString(key);
+    const response = await cache.match(this.#url(name));
+    if (!response) {
+      return null;
+    }
+    const data = new Uint8Array(await response.arrayBuffer());
+    void this.#updateIndex(cache, (index) => {
+      if (index[name]) {
+        index[name].used = Date.now();
+      }
+    });
+    return data;
+  }
+
+  async put(key: string, data: Uint8Array) {
+    if (typeof caches === 'undefined' || data.byteLength > this.maxSize) {
+      return;
+    }
+    const cache = await caches.open(PACKAGE_CACHE);
+    const name = await digestString(key);
+    await cache.put(this.#url(name), new Response(data));
+    await this.#updateIndex(cache, async (index) => {
+      index[name] = { size: data.byteLength, used: Date.now() };
+      const names = Object.keys(index).sort((a, b) => index[a].used - index[b].used);
+      let total = names.reduce((sum, n) => sum + index[n].size, 0);
+      for (const n of names) {
+        if (total <= this.maxSize) {
+          break;
+        }
+        await cache.delete(this.#url(n));
+        total -= index[n].size;
+        delete index[n];
+      }
+    });
+  }
+
+  // Index updates are applied one at a time, as read-modify-write operations
+  #updateIndex(cache: Cache, update: (index: BrowserCacheIndex) => void | Promise<void>) {
+    this.#queue = this.#queue.then(async () => {
+      const response = await cache.match(this.#url('index.json'));
+      const index = (response ? await response.json() : {}) as BrowserCacheIndex;
+      await update(index);
+      await cache.put(this.#url('index.json'), new Response(JSON.stringify(index)));
+    }).catch((e: Error) => {
+      console.warn(`Can't update the webR package cache index: ${e.message}`);
+    });
+    return this.#queue;
+  }
+
+  // The Cache API requires keys with an http(s) URL
+  #url(name: string): string {
+    return new URL(`${PACKAGE_CACHE}/${name}`, globalThis.location.href).toString();
+  }
+}
@@ -16,6 +16,7 @@ export type WebRPayloadPtr = {
     type?: RType;
     ptr: RPtr;
     methods?: string[];
+    handle?: number;
   };
   payloadType: 'ptr';
 };
@@ -4,12 +4,20 @@
  * @module Proxy
  */
 import { ChannelMain } from './chan/channel';
+import { decode, ExtensionCodec } from '@msgpack/msgpack';
 import { replaceInObject } from './utils';
 import { isWebRPayloadPtr, WebRPayloadPtr, WebRPayload } from './payload';
-import { RType, RCtor, WebRData, WebRDataRaw } from './robj';
+import { RType, RCtor, WebRData, WebRDataJs, WebRDataRaw } from './robj';
 import { isRObject, RObject, isRFunction } from './robj-main';
 import * as RWorker from './robj-worker';
-import { ShelterID, CallRObjectMethodMessage, NewRObjectMessage } from './webr-chan';
+import {
+  ShelterID,
+  CallRObjectMethodMessage,
+  NewRObjectMessage,
+  RObjectMethodCall,
+  ShelterDestroyMessage,
+  ToJsRObjectMessage,
+} from './webr-chan';
 import type * as Payload from './payload';
 import { WebRError, WebRPayloadError } from './error';
 
@@ -30,6 +38,23 @@ export type Methods<T> = {
  */
 export type DistProxy<U> = U extends RWorker.RObject ? RProxy<U> : U;
 
+/**
+ * A pipeline of method calls on an R object, as returned by the `pipe()`
+ * method of an {@link RProxy}.
+ *
+ * Where the result would be an {@link RWorker.RObject}, its methods can be
+ * called to extend the pipeline. A pipeline is evaluated when it is awaited,
+ * with the calls sent to the worker thread together so that only the final
+ * result is returned.
+ * @typeParam T The type of the result of the pipeline.
+ */
+export type RPipeline<T> = PromiseLike<Awaited<RProxify<T>>> & (T extends RWorker.RObject
+  ? { [P in Methods<T>]: T[P] extends (...args: infer U) => infer R
+    ? (...args: { [V in keyof U]: DistProxy<U[V]> }) => RPipeline<R>
+    : never }
+  & { chunks(options?: RChunksOptions): PromiseLike<AsyncGenerator<RChunk<T>, void, unknown>> }
+  : unknown);
+
 /**
  * Convert {@link RWorker.RObject} properties for use with an {@link RProxy}.
  *
@@ -71,6 +96,11 @@ export type RProxify<T> = T extends Array<any> // [RObject, RObject, ...]
  *
  * - All return types are wrapped in a Promise.
  *
+ * - Chains of method calls can be made through `pipe()`, e.g.
+ *   `await obj.pipe().get('coefficients').get(1).toNumber()`, and are
+ *   evaluated by the worker thread in a single request. See
+ *   {@link RPipeline}.
+ *
  * If required, the {@link Payload.WebRPayloadPtr} object associated with the
  * proxy can be accessed directly through the `_payload` property.
  * @typeParam T The {@link RWorker.RObject} type to convert into `RProxy` type.
@@ -78,8 +108,31 @@ export type RProxify<T> = T extends Array<any> // [RObject, RObject, ...]
 export type RProxy<T extends RWorker.RObject> = { [P in Methods<T>]: RProxify<T[P]> } & {
   _payload: WebRPayloadPtr;
   [Symbol.asyncIterator](): AsyncGenerator<RProxy<RWorker.RObject>, void, unknown>;
+  chunks(options?: RChunksOptions): AsyncGenerator<RChunk<T>, void, unknown>;
+  pipe(): RPipeline<T>;
 };
 
+/**
+ * The type of a chunk of data yielded by the `chunks()` method of an
+ * {@link RProxy}, based on the `getChunk()` method of the proxied
+ * {@link RWorker.RObject} type.
+ * @typeParam T The {@link RWorker.RObject} type being iterated over.
+ */
+export type RChunk<T> = T extends { getChunk(offset: number, size: number): infer U }
+  ? U extends Array<infer V> ? DistProxy<V>[] : U
+  : never;
+
+/**
+ * Options for chunked iteration over an R vector or list.
+ */
+export interface RChunksOptions {
+  /**
+   * The maximum number of elements in each chunk.
+   * Default: 65536.
+   */
+  size?: number;
+}
+
 /**
  * Create a proxy constructor based on a {@link RWorker.RObject} class.
  *
@@ -111,30 +164,68 @@ function empty() { return; }
  */
 function targetAsyncIterator(chan: ChannelMain, proxy: RProxy<RWorker.RObject>) {
   return async function* () {
-    // Get the R object's length
-    const msg: CallRObjectMethodMessage = {
-      type: 'callRObjectMethod',
-      data: {
-        payload: proxy._payload,
-        prop: 'getPropertyValue',
-        args: [{ payloadType: 'raw', obj: 'length' }],
-        shelter: undefined, // TODO
-      },
-    };
-    const reply = await chan.request(msg);
-
-    // Throw an error if there was some problem accessing the object length
-    if (typeof reply.obj !== 'number') {
-      throw new WebRError('Cannot iterate over object, unexpected type for length property.');
-    }
+    const length = await targetLength(chan, proxy);
 
     // Loop through the object and yield values
-    for (let i = 1; i <= reply.obj; i++) {
+    for (let i = 1; i <= length; i++) {
       yield proxy.get(i);
     }
   };
 }
 
+/* Proxy chunked iteration over R vectors and lists. This allows large objects
+ * to be consumed in fixed-size slices using `for await (c of obj.chunks()){}`.
+ *
+ * The next chunk is requested while the current chunk is being consumed, so
+ * that at most two chunks are held on the main thread at any time.
+ */
+function targetChunks(chan: ChannelMain, proxy: RProxy<RWorker.RObject>) {
+  return async function* (options: RChunksOptions = {}) {
+    const size = options.size ?? 65536;
+    if (!Number.isInteger(size) || size <= 0) {
+      throw new WebRError('Chunk size must be a positive integer.');
+    }
+
+    const length = await targetLength(chan, proxy);
+    const getChunk = targetMethod(chan, 'getChunk', proxy._payload) as (
+      offset: number,
+      size: number
+    ) => Promise<unknown>;
+
+    let next = length > 0 ? getChunk(0, size) : undefined;
+    try {
+      for (let offset = 0; offset < length; offset += size) {
+        const chunk = await next;
+        next = offset + size < length ? getChunk(offset + size, size) : undefined;
+        yield chunk;
+      }
+    } finally {
+      // Avoid unhandled rejections from read-ahead if iteration ends early
+      next?.catch(() => undefined);
+    }
+  };
+}
+
+/* Get the length of a proxied R object, for iteration */
+async function targetLength(chan: ChannelMain, proxy: RProxy<RWorker.RObject>) {
+  const msg: CallRObjectMethodMessage = {
+    type: 'callRObjectMethod',
+    data: {
+      payload: proxy._payload,
+      prop: 'getPropertyValue',
+      args: [{ payloadType: 'raw', obj: 'length' }],
+      shelter: undefined, // TODO
+    },
+  };
+  const reply = await chan.request(msg);
+
+  // Throw an error if there was some problem accessing the object length
+  if (typeof reply.obj !== 'number') {
+    throw new WebRError('Cannot iterate over object, unexpected type for length property.');
+  }
+  return reply.obj;
+}
+
 /**
  * Proxy an R object method by providing an async function that requests that
  * the worker thread calls the method and then returns the result.
@@ -146,36 +237,173 @@ function targetAsyncIterator(chan: ChannelMain, proxy: RProxy<RWorker.RObject>)
 export function targetMethod(chan: ChannelMain, prop: string): unknown;
 export function targetMethod(chan: ChannelMain, prop: string, payload: WebRPayloadPtr): unknown;
 export function targetMethod(chan: ChannelMain, prop: string, payload?: WebRPayloadPtr): unknown {
-  return async (..._args: WebRData[]) => {
-    const args = _args.map((arg) => {
-      if (isRObject(arg)) {
-        return arg._payload;
+  return async (...args: WebRData[]) => requestMethodCalls(chan, payload, [{ prop, args: methodArgs(args) }]);
+}
+
+function methodArgs(args: WebRData[]): WebRPayload[] {
+  return args.map((arg) => {
+    if (isRObject(arg)) {
+      return arg._payload;
+    }
+    return {
+      obj: replaceInObject(arg, isRObject, (obj: RObject) => obj._payload),
+      payloadType: 'raw',
+    } as WebRPayload;
+  });
+}
+
+async function requestMethodCalls(
+  chan: ChannelMain,
+  payload: WebRPayloadPtr | undefined,
+  calls: RObjectMethodCall[]
+) {
+  const [{ prop, args }, ...pipeline] = calls;
+  const msg: CallRObjectMethodMessage = {
+    type: 'callRObjectMethod',
+    data: { payload, prop, args, pipeline: pipeline.length ? pipeline : undefined },
+  };
+  const reply = await chan.request(msg);
+
+  switch (reply.payloadType) {
+    case 'ptr':
+      return newRProxy(chan, reply);
+    case 'raw': {
+      const proxyReply = replaceInObject(
+        reply,
+        isWebRPayloadPtr,
+        (obj: WebRPayloadPtr, chan: ChannelMain) => newRProxy(chan, obj),
+        chan
+      ) as WebRPayload;
+      return proxyReply.obj;
+    }
+  }
+}
+
+/* A method call in a pipeline, made on the result of its parent call or on
+ * the piped R object. The request for its result is made at most once.
+ */
+type PipelineCall = {
+  parent?: PipelineCall;
+  prop: string;
+  args: WebRData[];
+  children: number;
+  promise?: Promise<unknown>;
+};
+
+/* Methods of an RProxy that are handled on the main thread, and so are
+ * called on the resolved result of the previous call in a pipeline.
+ */
+const pipelineProxyMethods = ['toJs', 'chunks'];
+
+/* Proxy a pipeline of method calls on an R object.
+ *
+ * Method calls extend the pipeline without making any requests. The pipeline
+ * is evaluated when awaited, with calls that have not yet been requested sent
+ * as a single request. The result of each call is requested at most once, so
+ * that a call whose result is shared by several pipelines, or which has
+ * already been awaited, is reused rather than evaluated again.
+ */
+function newPipeline(chan: ChannelMain, proxy: RProxy<RWorker.RObject>, call?: PipelineCall): unknown {
+  return new Proxy({}, {
+    get: (_, prop: string | number | symbol) => {
+      if (prop === 'then' || prop === 'catch' || prop === 'finally') {
+        const p = call ? requestPipeline(chan, proxy, call) : Promise.resolve(proxy);
+        return p[prop].bind(p);
+      } else if (typeof prop === 'symbol') {
+        return undefined;
       }
-      return {
-        obj: replaceInObject(arg, isRObject, (obj: RObject) => obj._payload),
-        payloadType: 'raw',
-      } as WebRPayload;
-    });
+      return (...args: WebRData[]) => {
+        if (call) {
+          call.children++;
+        }
+        return newPipeline(chan, proxy, { parent: call, prop: prop.toString(), args, children: 0 });
+      };
+    },
+  });
+}
 
-    const msg: CallRObjectMethodMessage = {
-      type: 'callRObjectMethod',
-      data: { payload, prop, args: args },
+function requestPipeline(chan: ChannelMain, proxy: RProxy<RWorker.RObject>, call: PipelineCall) {
+  if (!call.promise) {
+    call.promise = sendPipeline(chan, proxy, call);
+  }
+  return call.promise;
+}
+
+async function sendPipeline(chan: ChannelMain, proxy: RProxy<RWorker.RObject>, call: PipelineCall) {
+  // Requested separately: calls made on the main thread, calls that have
+  // already been requested, and calls with results shared by other pipelines
+  const calls = [call];
+  let base = call.parent;
+  if (!pipelineProxyMethods.includes(call.prop)) {
+    while (base && !base.promise && base.children === 1 && !pipelineProxyMethods.includes(base.prop)) {
+      calls.unshift(base);
+      base = base.parent;
+    }
+  }
+
+  const target = base ? await requestPipeline(chan, proxy, base) : proxy;
+  if (!isRObject(target)) {
+    throw new TypeError(`Can't call method \`${calls[0].prop}\` of a value that is not an R object`);
+  }
+  if (pipelineProxyMethods.includes(call.prop)) {
+    const method = (target as unknown as { [key: string]: (...args: WebRData[]) => unknown })[call.prop];
+    if (typeof method !== 'function') {
+      throw new ReferenceError(`${call.prop} is not defined`);
+    }
+    return method(...call.args);
+  }
+  return requestMethodCalls(
+    chan,
+    target._payload,
+    calls.map(({ prop, args }) => ({ prop, args: methodArgs(args) }))
+  );
+}
+
+/* R object types converted to JS using the native serialiser on the worker
+ * thread. The resulting tree is sent as a single msgpack encoded buffer.
+ */
+const packedToJsTypes: (RType | undefined)[] = ['list', 'pairlist', 'environment'];
+
+/* Extension types used by the native serialiser, see `webr/src/tojs.c` */
+const TOJS_EXT_REF = 1;
+const TOJS_EXT_FALLBACK = 2;
+
+/**
+ * Proxy the `toJs()` method of R objects that are serialised natively.
+ *
+ * The worker thread writes the {@link WebRDataJs} tree directly into a msgpack
+ * encoded buffer, which is transferred over the channel without re-encoding
+ * and then decoded here. References to R objects beyond the requested depth
+ * are returned as an {@link RProxy}.
+ * @internal
+ */
+function targetToJs(chan: ChannelMain, payload: WebRPayloadPtr) {
+  return async (options: { depth: number } = { depth: 0 }) => {
+    const msg: ToJsRObjectMessage = {
+      type: 'toJsRObject',
+      data: { payload, options: { depth: options.depth } },
     };
     const reply = await chan.request(msg);
+    const { data, refs, fallback } = reply.obj as {
+      data: Uint8Array;
+      refs: WebRPayloadPtr[];
+      fallback: WebRDataJs[];
+    };
 
-    switch (reply.payloadType) {
-      case 'ptr':
-        return newRProxy(chan, reply);
-      case 'raw': {
-        const proxyReply = replaceInObject(
-          reply,
-          isWebRPayloadPtr,
-          (obj: WebRPayloadPtr, chan: ChannelMain) => newRProxy(chan, obj),
-          chan
-        ) as WebRPayload;
-        return proxyReply.obj;
-      }
-    }
+    const index = (ext: Uint8Array) => new DataView(ext.buffer, ext.byteOffset).getUint32(0);
+    const extensionCodec = new ExtensionCodec();
+    extensionCodec.register({
+      type: TOJS_EXT_REF,
+      encode: () => null,
+      decode: (ext: Uint8Array) => newRProxy(chan, refs[index(ext)]),
+    });
+    extensionCodec.register({
+      type: TOJS_EXT_FALLBACK,
+      encode: () => null,
+      decode: (ext: Uint8Array) => fallback[index(ext)],
+    });
+
+    return decode(data, { extensionCodec }) as WebRDataJs;
   };
 }
 
@@ -201,22 +429,185 @@ async function newRObject(
     case 'raw':
       throw new WebRPayloadError('Unexpected raw payload type returned from newRObject');
     case 'ptr':
-      return newRProxy(chan, payload);
+      return newRProxy(chan, payload, shelter);
+  }
+}
+
+/**
+ * Counters for R objects protected by a shelter, as tracked by the proxies
+ * created on the main thread.
+ */
+export interface ShelterStats {
+  /** The number of reachable proxies to R objects protected by the shelter. */
+  live: number;
+  /** The number of unreachable R objects waiting to be released. */
+  pending: number;
+  /** The total number of R objects automatically released. */
+  released: number;
+}
+
+// Flush pending releases once this many objects are waiting, otherwise after
+// the given interval in milliseconds.
+const RELEASE_BATCH_SIZE = 256;
+const RELEASE_INTERVAL = 1000;
+
+type HeldPayload = {
+  shelter: ShelterID;
+  epoch: number;
+  payload: WebRPayloadPtr;
+};
+
+/**
+ * Automatically release R objects referenced by unreachable proxies.
+ *
+ * Proxies to R objects protected by a shelter are registered with a
+ * `FinalizationRegistry`. Once a proxy has been garbage collected, the R
+ * object is queued and released in a batched `shelterDestroy` request. Purging
+ * a shelter starts a new epoch, so that objects already released by the purge
+ * are not released a second time.
+ * @internal
+ */
+export class ProxyReleaser {
+  #chan: ChannelMain;
+  #registry?: FinalizationRegistry<HeldPayload>;
+  #shelters = new Map<ShelterID, ShelterStats & { epoch: number, queue: WebRPayloadPtr[] }>();
+  // The shelter epoch in which each registered payload was registered
+  #epochs = new WeakMap<WebRPayloadPtr, number>();
+  #pending = 0;
+  #timer?: ReturnType<typeof setTimeout>;
+
+  constructor(chan: ChannelMain) {
+    this.#chan = chan;
+    if (typeof FinalizationRegistry !== 'undefined') {
+      this.#registry = new FinalizationRegistry((held) => this.#finalize(held));
+    }
+  }
+
+  register(proxy: RProxy<RWorker.RObject>, shelter: ShelterID) {
+    const payload = proxy._payload;
+    if (!this.#registry || payload.obj.handle === undefined) {
+      return;
+    }
+    const state = this.#state(shelter);
+    this.#registry.register(proxy, { shelter, epoch: state.epoch, payload }, payload);
+    this.#epochs.set(payload, state.epoch);
+    state.live++;
+  }
+
+  unregister(shelter: ShelterID, payloads: WebRPayloadPtr[]) {
+    const state = this.#state(shelter);
+    payloads.forEach((payload) => {
+      const epoch = this.#epochs.get(payload);
+      this.#epochs.delete(payload);
+      // Proxies registered before a purge are no longer counted as live
+      if (this.#registry?.unregister(payload) && epoch === state.epoch) {
+        state.live--;
+      }
+    });
+  }
+
+  purge(shelter: ShelterID) {
+    const state = this.#state(shelter);
+    this.#pending -= state.queue.length;
+    state.epoch++;
+    state.live = 0;
+    state.queue = [];
+  }
+
+  stats(shelter: ShelterID): ShelterStats {
+    const { live, pending, released } = this.#state(shelter);
+    return { live, pending, released };
+  }
+
+  flush() {
+    clearTimeout(this.#timer);
+    this.#timer = undefined;
+    this.#pending = 0;
+
+    this.#shelters.forEach((state, shelter) => {
+      if (state.queue.length === 0) {
+        return;
+      }
+      const msg: ShelterDestroyMessage = {
+        type: 'shelterDestroy',
+        data: { id: shelter, obj: state.queue },
+      };
+      state.released += state.queue.length;
+      state.pending = 0;
+      state.queue = [];
+
+      try {
+        // Objects may have already been released explicitly, ignore failures
+        this.#chan.request(msg).catch(() => undefined);
+      } catch {
+        // The communication channel has been closed
+      }
+    });
+  }
+
+  #state(shelter: ShelterID) {
+    let state = this.#shelters.get(shelter);
+    if (!state) {
+      state = { epoch: 0, live: 0, pending: 0, released: 0, queue: [] };
+      this.#shelters.set(shelter, state);
+    }
+    return state;
+  }
+
+  #finalize(held: HeldPayload) {
+    const state = this.#state(held.shelter);
+    if (held.epoch !== state.epoch) {
+      return;
+    }
+    state.live--;
+    state.pending++;
+    state.queue.push(held.payload);
+
+    if (++this.#pending >= RELEASE_BATCH_SIZE) {
+      this.flush();
+    } else if (!this.#timer) {
+      this.#timer = setTimeout(() => this.flush(), RELEASE_INTERVAL);
+      // Don't hold a Node.js process open only to release R objects
+      (this.#timer as { unref?: () => void }).unref?.();
+    }
   }
 }
 
+const releasers = new WeakMap<ChannelMain, ProxyReleaser>();
+
+/**
+ * Get the {@link ProxyReleaser} associated with a communication channel.
+ * @internal
+ */
+export function proxyReleaser(chan: ChannelMain): ProxyReleaser {
+  let releaser = releasers.get(chan);
+  if (!releaser) {
+    releaser = new ProxyReleaser(chan);
+    releasers.set(chan, releaser);
+  }
+  return releaser;
+}
+
 /**
  * Proxy an R object.
  *
  * The proxy targets a particular R object in WebAssembly memory. Methods of the
  * relevant subclass of {@link RWorker.RObject} are proxied, enabling
  * structured manipulation of R objects from the main thread.
+ *
+ * When a shelter is given, the R object is automatically released from the
+ * shelter once the proxy is no longer reachable.
  * @param {ChannelMain} chan The current main thread communication channel.
  * @param {WebRPayloadPtr} payload A webR payload referencing an R object.
+ * @param {ShelterID} [shelter] The shelter protecting the R object.
  * @returns {RProxy<RWorker.RObject>} An {@link RObject} corresponding to the
  * referenced R object.
  */
-export function newRProxy(chan: ChannelMain, payload: WebRPayloadPtr): RProxy<RWorker.RObject> {
+export function newRProxy(
+  chan: ChannelMain,
+  payload: WebRPayloadPtr,
+  shelter?: ShelterID
+): RProxy<RWorker.RObject> {
   const proxy = new Proxy(
     // Assume we are proxying an RFunction if the methods list contains 'exec'.
     payload.obj.methods?.includes('exec') ? Object.assign(empty, { ...payload }) : payload,
@@ -226,6 +617,12 @@ export function newRProxy(chan: ChannelMain, payload: WebRPayloadPtr): RProxy<RW
           return payload;
         } else if (prop === Symbol.asyncIterator) {
           return targetAsyncIterator(chan, proxy);
+        } else if (prop === 'pipe') {
+          return () => newPipeline(chan, proxy);
+        } else if (prop === 'chunks' && payload.obj.methods?.includes('getChunk')) {
+          return targetChunks(chan, proxy);
+        } else if (prop === 'toJs' && packedToJsTypes.includes(payload.obj.type)) {
+          return targetToJs(chan, payload);
         } else if (payload.obj.methods?.includes(prop.toString())) {
           return targetMethod(chan, prop.toString(), payload);
         }
@@ -236,6 +633,10 @@ export function newRProxy(chan: ChannelMain, payload: WebRPayloadPtr): RProxy<RW
       },
     }
   ) as unknown as RProxy<RWorker.RObject>;
+
+  if (shelter) {
+    proxyReleaser(chan).register(proxy, shelter);
+  }
   return proxy;
 }
 
@@ -29,25 +29,156 @@ function assertRType(obj: RObjectBase, type: RType) {
   }
 }
 
-// TODO: Shelter should be a dictionary not an array
-export const shelters = new Map<ShelterID, RPtr[]>();
+/*
+ * Handles identify a slot in a shelter's handle table, along with the
+ * generation of the slot at the time the object was stored. Generations are
+ * incremented as slots are released, so that stale handles are detected.
+ */
+const HANDLE_SLOT_BITS = 24;
+const HANDLE_SLOT_MASK = (1 << HANDLE_SLOT_BITS) - 1;
+const HANDLE_INIT_CAPACITY = 16;
 
-// Use this for implicit protection of objects sent to the main
-// thread. Currently uses the precious list but could use a different
-// mechanism in the future. Unprotection is explicit through
-// `Shelter.destroy()`.
-export function keep(shelter: ShelterID, x: RHandle) {
-  const ptr = handlePtr(x);
-  Module._R_PreserveObject(ptr);
+/**
+ * A table of R objects protected by a shelter.
+ *
+ * Objects are stored in the slots of a single preserved R list, so that
+ * keeping and releasing objects does not touch R's precious list. Free slots
+ * are reused through a free list, and each slot has a generation counter that
+ * invalidates handles to released objects.
+ * @internal
+ */
+export class HandleTable {
+  #list: RPtr | null = null;
+  #capacity = 0;
+  #ptrs: RPtr[] = [];
+  #gens: number[] = [];
+  #free: number[] = [];
+  #slots = new Map<RPtr, number[]>();
+  #size = 0;
+  // Generation for newly created slots, so that handles issued before a
+  // purge are never valid for slots created after it
+  #baseGen = 0;
+  #maxGen = 0;
+
+  get size(): number {
+    return this.#size;
+  }
+
+  keep(x: RHandle): number {
+    const ptr = handlePtr(x);
+
+    let slot = this.#free.pop();
+    if (slot === undefined) {
+      slot = this.#ptrs.length;
+      protect(ptr);
+      try {
+        this.#reserve(slot + 1);
+      } finally {
+        unprotect(1);
+      }
+      this.#ptrs.push(0);
+      this.#gens.push(this.#baseGen);
+    }
+
+    Module._SET_VECTOR_ELT(this.#list!, slot, ptr);
+    this.#ptrs[slot] = ptr;
+    this.#size++;
+
+    const slots = this.#slots.get(ptr);
+    if (slots) {
+      slots.push(slot);
+    } else {
+      this.#slots.set(ptr, [slot]);
+    }
+
+    return this.#gens[slot] * (HANDLE_SLOT_MASK + 1) + slot;
+  }
+
+  // Release an object by handle if given, otherwise release one of the
+  // slots holding the object. Returns `false` if the object is not found.
+  release(x: RHandle, handle?: number): boolean {
+    const ptr = handlePtr(x);
+    const slots = this.#slots.get(ptr);
+    if (!slots) {
+      return false;
+    }
+
+    let slot: number;
+    if (handle === undefined) {
+      slot = slots.pop()!;
+    } else {
+      slot = handle & HANDLE_SLOT_MASK;
+      const gen = Math.floor(handle / (HANDLE_SLOT_MASK + 1));
+      const loc = slots.lastIndexOf(slot);
+      if (loc < 0 || this.#gens[slot] !== gen) {
+        return false;
+      }
+      slots.splice(loc, 1);
+    }
+    if (slots.length === 0) {
+      this.#slots.delete(ptr);
+    }
 
+    Module._SET_VECTOR_ELT(this.#list!, slot, objs.null.ptr);
+    this.#ptrs[slot] = 0;
+    this.#maxGen = Math.max(this.#maxGen, ++this.#gens[slot]);
+    this.#free.push(slot);
+    this.#size--;
+    return true;
+  }
+
+  purge(): void {
+    if (this.#list !== null) {
+      Module._R_ReleaseObject(this.#list);
+    }
+    this.#list = null;
+    this.#capacity = 0;
+    this.#ptrs = [];
+    this.#gens = [];
+    this.#free = [];
+    this.#slots = new Map();
+    this.#size = 0;
+    this.#baseGen = ++this.#maxGen;
+  }
+
+  #reserve(n: number) {
+    if (n <= this.#capacity) {
+      return;
+    }
+    const capacity = Math.max(HANDLE_INIT_CAPACITY, 2 * this.#capacity);
+    if (capacity > HANDLE_SLOT_MASK + 1) {
+      throw new Error('Too many objects protected by shelter.');
+    }
+
+    const list = Module._Rf_allocVector(RTypeMap.list, capacity);
+    Module._R_PreserveObject(list);
+    for (let i = 0; i < this.#ptrs.length; i++) {
+      Module._SET_VECTOR_ELT(list, i, this.#ptrs[i] || objs.null.ptr);
+    }
+    if (this.#list !== null) {
+      Module._R_ReleaseObject(this.#list);
+    }
+
+    this.#list = list;
+    this.#capacity = capacity;
+  }
+}
+
+export const shelters = new Map<ShelterID, HandleTable>();
+
+// Use this for implicit protection of objects sent to the main
+// thread. Objects are stored in the shelter's handle table, returning a
+// handle that can later be used to release the object. Unprotection is
+// explicit through `Shelter.destroy()`.
+export function keep(shelter: ShelterID, x: RHandle): number | undefined {
   // TODO: Remove when shelter transition is complete
   if (shelter === undefined) {
-    return;
+    Module._R_PreserveObject(handlePtr(x));
+    return undefined;
   }
 
   if (isShelterID(shelter)) {
-    shelters.get(shelter)!.push(ptr);
-    return;
+    return shelters.get(shelter)!.keep(x);
   }
 
   throw new Error('Unexpected shelter type ' + typeof shelter);
@@ -56,32 +187,14 @@ export function keep(shelter: ShelterID, x: RHandle) {
 // Frees objects preserved with `keep()`. This method is called by
 // users in the main thread to release objects that were automatically
 // protected before being sent away.
-export function destroy(shelter: ShelterID, x: RHandle) {
-  const ptr = handlePtr(x);
-  Module._R_ReleaseObject(ptr);
-
-  const objs: RPtr[] = shelters.get(shelter)!;
-  const loc = objs.indexOf(ptr);
-
-  if (loc < 0) {
+export function destroy(shelter: ShelterID, x: RHandle, handle?: number) {
+  if (!shelters.get(shelter)!.release(x, handle)) {
     throw new Error("Can't find object in shelter.");
   }
-
-  objs.splice(loc, 1);
 }
 
 export function purge(shelter: ShelterID) {
-  const ptrs: RPtr[] = shelters.get(shelter)!;
-
-  for (const ptr of ptrs) {
-    try {
-      Module._R_ReleaseObject(ptr);
-    } catch (e) {
-      console.error(e);
-    }
-  }
-
-  shelters.set(shelter, []);
+  shelters.get(shelter)!.purge();
 }
 
 export interface ToJsOptions {
@@ -710,6 +823,20 @@ export class RList extends RObject {
     return obj.values.map((v, i) => [obj.names ? obj.names[i] : null, v]);
   }
 
+  /**
+   * Get a contiguous slice of the list's elements, for chunked iteration.
+   * @param {number} offset The zero-based index of the first element.
+   * @param {number} size The maximum number of elements to return.
+   * @returns {RObject[]} The slice of list elements.
+   */
+  getChunk(offset: number, size: number): RObject[] {
+    const start = Math.min(Math.max(offset, 0), this.length);
+    const end = Math.min(start + Math.max(size, 0), this.length);
+    return [...Array(end - start).keys()].map((i) => {
+      return RObject.wrap(Module._VECTOR_ELT(this.ptr, start + i));
+    });
+  }
+
   toJs(options: { depth: number } = { depth: 0 }, depth = 1): WebRDataJsNode {
     return {
       type: 'list',
@@ -961,6 +1088,21 @@ type TypedArray =
 
 export type atomicType = number | boolean | Complex | string;
 
+// Copy typed array data into a new R vector with a single bulk copy, when it
+// is already in the form R uses to store vectors of the given type
+function copyTypedArray(ptr: RPtr, kind: RType, values: unknown): boolean {
+  if (kind === 'raw' && values instanceof Uint8Array) {
+    Module.HEAPU8.set(values, Module._RAW(ptr));
+  } else if (kind === 'integer' && values instanceof Int32Array) {
+    Module.HEAP32.set(values, Module._INTEGER(ptr) / 4);
+  } else if (kind === 'double' && values instanceof Float64Array) {
+    Module.HEAPF64.set(values, Module._REAL(ptr) / 8);
+  } else {
+    return false;
+  }
+  return true;
+}
+
 abstract class RVectorAtomic<T extends atomicType> extends RObject {
   constructor(
     val: WebRDataAtomic<T>,
@@ -981,7 +1123,9 @@ abstract class RVectorAtomic<T extends atomicType> extends RObject {
       const ptr = Module._Rf_allocVector(RTypeMap[kind], values.length);
       protectInc(ptr, prot);
 
-      values.forEach(newSetter(ptr));
+      if (!copyTypedArray(ptr, kind, values)) {
+        values.forEach(newSetter(ptr));
+      }
       RObject.wrap(ptr).setNames(names);
 
       super(new RObjectBase(ptr));
@@ -1025,6 +1169,61 @@ abstract class RVectorAtomic<T extends atomicType> extends RObject {
 
   abstract toTypedArray(): TypedArray;
 
+  /**
+   * Copy a contiguous slice of the vector's data, for chunked iteration.
+   *
+   * Numeric data is returned as a typed array in the same form as
+   * {@link toTypedArray}, so that missing values are left encoded as R's `NA`
+   * values. Character vectors are returned as an array of strings, with
+   * missing values given as `null`.
+   * @param {number} offset The zero-based index of the first element.
+   * @param {number} size The maximum number of elements to return.
+   * @returns {TypedArray | (string | null)[]} The slice of vector data.
+   */
+  getChunk(offset: number, size: number): TypedArray | (string | null)[] {
+    const start = Math.min(Math.max(offset, 0), this.length);
+    const end = Math.min(start + Math.max(size, 0), this.length);
+
+    switch (this.type()) {
+      case 'logical': {
+        const data = Module._LOGICAL(this.ptr) / 4;
+        return Module.HEAP32.slice(data + start, data + end);
+      }
+      case 'integer': {
+        const data = Module._INTEGER(this.ptr) / 4;
+        return Module.HEAP32.slice(data + start, data + end);
+      }
+      case 'double': {
+        const data = Module._REAL(this.ptr) / 8;
+        return Module.HEAPF64.slice(data + start, data + end);
+      }
+      case 'complex': {
+        const data = Module._COMPLEX(this.ptr) / 8;
+        return Module.HEAPF64.slice(data + 2 * start, data + 2 * end);
+      }
+      case 'raw': {
+        const data = Module._RAW(this.ptr);
+        return Module.HEAPU8.slice(data + start, data + end);
+      }
+      case 'character': {
+        const vmax = Module._vmaxget();
+        try {
+          return [...Array(end - start).keys()].map((i) => {
+            const elt = Module._STRING_ELT(this.ptr, start + i);
+            if (elt === objs.naString.ptr) {
+              return null;
+            }
+            return Module.UTF8ToString(Module._Rf_translateCharUTF8(elt));
+          });
+        } finally {
+          Module._vmaxset(vmax);
+        }
+      }
+      default:
+        throw new Error(`Can't get chunk of atomic vector of type "${this.type()}"`);
+    }
+  }
+
   toArray(): (T | null)[] {
     const arr = this.toTypedArray();
     return this.detectMissing().map((m, idx) => (m ? null : (arr[idx] as T)));
@@ -1342,6 +1541,49 @@ function toWebRData(jsObj: WebRData): WebRData {
   return { names: null, values: [jsObj] };
 }
 
+/**
+ * Convert an R object into its msgpack encoded {@link WebRDataJs} tree.
+ *
+ * The conversion is performed natively in a single pass over the R object,
+ * with the same semantics as the recursive {@link RObject.toJs} methods.
+ * Extension values in the encoded data refer to R objects beyond the
+ * requested depth, listed in `refs`, or to values converted with
+ * {@link RObject.toJs}, listed in `fallback`.
+ * @internal
+ */
+export function toJsPacked(obj: RObject, options: ToJsOptions = { depth: 0 }): {
+  data: Uint8Array;
+  refs: RObject[];
+  fallback: WebRDataJs[];
+} {
+  const prot = { n: 0 };
+
+  try {
+    const fn = parseEvalBare('webr:::ffi_tojs_encode', objs.baseEnv);
+    const depth = protectInc(new RInteger([options.depth]), prot);
+    const call = Module._Rf_lang4(new RSymbol('.Call').ptr, fn.ptr, obj.ptr, depth.ptr);
+    protectInc(call, prot);
+
+    const res = RList.wrap(safeEval(call, objs.baseEnv));
+    protectInc(res, prot);
+
+    const elts = (i: number) => {
+      const list = Module._VECTOR_ELT(res.ptr, i);
+      return [...Array(Module._LENGTH(list)).keys()].map((j) => {
+        return RObject.wrap(Module._VECTOR_ELT(list, j));
+      });
+    };
+
+    return {
+      data: RRaw.wrap(Module._VECTOR_ELT(res.ptr, 0)).toTypedArray(),
+      refs: elts(1),
+      fallback: elts(2).map((v) => v.toJs()),
+    };
+  } finally {
+    unprotect(prot.n);
+  }
+}
+
 export function getRWorkerClass(type: RType | RCtor): typeof RObject {
   const typeClasses: { [key: string]: typeof RObject } = {
     object: RObject,
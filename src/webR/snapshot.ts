@@ -0,0 +1,116 @@
+/**
+ * Caching of warm-start snapshots, saved after running an R warm-up script.
+ * @module Snapshot
+ */
+import { IN_NODE } from './compat';
+import { digestString } from './utils';
+import type * as NodeFS from 'fs';
+import type * as NodeOS from 'os';
+import type * as NodePath from 'path';
+
+/**
+ * Options for starting webR from a snapshot of the state left by an R
+ * warm-up script.
+ */
+export interface WebRWarmupOptions {
+  /**
+   * R code to prepare a new webR instance, e.g. by installing and attaching
+   * packages or loading data.
+   */
+  script: string;
+
+  /**
+   * Additional directories in the virtual filesystem to be saved in the
+   * snapshot. Packages installed by the warm-up script are always saved.
+   * Default: `[]`.
+   */
+  paths?: string[];
+
+  /**
+   * A string used to identify the snapshot in the cache, along with the
+   * warm-up script and the versions of webR and R. Change the key to discard
+   * a cached snapshot, e.g. when packages in the webR repo have been updated.
+   * Default: `''`.
+   */
+  key?: string;
+
+  /**
+   * The directory where snapshots are cached, when running under Node.js. In
+   * a web browser, snapshots are cached using the Cache API.
+   * Default: `webr-snapshots` in the system temporary directory.
+   */
+  cacheDir?: string;
+}
+
+const SNAPSHOT_CACHE = 'webr-snapshots';
+
+/**
+ * Cache of warm-start snapshots, stored on disk under Node.js and with the
+ * Cache API in web browsers.
+ * @internal
+ */
+export class SnapshotCache {
+  readonly key: string;
+
+  constructor(readonly options: WebRWarmupOptions, versions: string[]) {
+    const { script, paths = [], key = '' } = options;
+    this.key = JSON.stringify([...versions, key, script, paths]);
+  }
+
+  async read(): Promise<Uint8Array | null> {
+    if (IN_NODE) {
+      const fs = require('fs') as typeof NodeFS;
+      try {
+        return new Uint8Array(await fs.promises.readFile(await this.#path()));
+      } catch {
+        return null;
+      }
+    }
+    if (typeof caches === 'undefined') {
+      return null;
+    }
+    const cache = await caches.open(SNAPSHOT_CACHE);
+    const response = await cache.match(await this.#url());
+    return response ? new Uint8Array(await response.arrayBuffer()) : null;
+  }
+
+  async write(data: Uint8Array): Promise<void> {
+    if (IN_NODE) {
+      const fs = require('fs') as typeof NodeFS;
+      const file = await this.#path();
+      const dir = this.#dir();
+      await fs.promises.mkdir(dir, { recursive: true });
+      // Write under a temporary name, so that concurrent readers never see a
+      // partially written snapshot
+      const tmp = `${file}.${Math.random().toString(36).slice(2)}`;
+      await fs.promises.writeFile(tmp, data);
+      await fs.promises.rename(tmp, file);
+      return;
+    }
+    if (typeof caches === 'undefined') {
+      return;
+    }
+    const cache = await caches.open(SNAPSHOT_CACHE);
+    await cache.put(await this.#url(), new Response(data));
+  }
+
+  #dir(): string {
+    const os = require('os') as typeof NodeOS;
+    const path = require('path') as typeof NodePath;
+    return this.options.cacheDir ?? path.join(os.tmpdir(), SNAPSHOT_CACHE);
+  }
+
+  async #name(): Promise<string> {
+    return `${await digestString(this.key)}.tar.gz`;
+  }
+
+  async #path(): Promise<string> {
+    const path = require('path') as typeof NodePath;
+    return path.join(this.#dir(), await this.#name());
+  }
+
+  // The Cache API requires keys with an http(s) URL
+  async #url(): Promise<string> {
+    return new URL(`${SNAPSHOT_CACHE}/${await this.#name()}`, globalThis.location.href).toString();
+  }
+}
@@ -2,6 +2,7 @@ import { IN_NODE } from './compat';
 import { WebRError } from './error';
 import { isComplex, isWebRDataJs } from './robj';
 import { RObjectBase } from './robj-worker';
+import type * as NodeCrypto from 'crypto';
 
 export type PromiseHandles<T = void> = {
   resolve: ResolveFn<T>;
@@ -46,7 +47,11 @@ export function replaceInObject<T>(
   if (test(obj)) {
     return replacer(obj, ...replacerArgs) as T;
   }
-  if (Array.isArray(obj) || ArrayBuffer.isView(obj)) {
+  if (ArrayBuffer.isView(obj)) {
+    // Typed array elements are numbers, there is nothing to replace
+    return obj;
+  }
+  if (Array.isArray(obj)) {
     return (obj as unknown[]).map((v) =>
       replaceInObject(v, test, replacer, ...replacerArgs)
     ) as T[];
@@ -176,3 +181,154 @@ export function base64ToBuffer(base64: string): ArrayBuffer {
   }
   return bytes.buffer;
 }
+
+/**
+ * A SHA-256 digest of a string, as 64 hexadecimal digits. Used to give cache
+ * entries names of fixed length that identify their keys.
+ * @param {string} str The string to hash.
+ * @returns {Promise<string>} The digest.
+ */
+export async function digestString(str: string): Promise<string> {
+  if (IN_NODE) {
+    return digestStringSync(str);
+  }
+  const digest = await crypto.subtle.digest('SHA-256', new TextEncoder().encode(str));
+  return Array.from(new Uint8Array(digest), (b) => b.toString(16).padStart(2, '0')).join('');
+}
+
+/**
+ * A SHA-256 digest of a string, computed synchronously (requires Node).
+ * @param {string} str The string to hash.
+ * @returns {string} The digest, as 64 hexadecimal digits.
+ */
+export function digestStringSync(str: string): string {
+  const nodeCrypto = require('crypto') as typeof NodeCrypto;
+  return nodeCrypto.createHash('sha256').update(str).digest('hex');
+}
+
+type DecompressionStreamConstructor = new (format: 'gzip') => TransformStream<Uint8Array, Uint8Array>;
+
+// Decompress a gzip response body as it arrives, into a single buffer sized
+// from an estimate of the compression ratio
+async function readGunzipped(
+  response: Response,
+  Decompression: DecompressionStreamConstructor
+): Promise<Uint8Array> {
+  const compressed = Number(response.headers.get('Content-Length')) || 0;
+  let out = new Uint8Array(Math.max(4 * compressed, 64 * 1024));
+  let length = 0;
+  const reader = response.body!.pipeThrough(new Decompression('gzip')).getReader();
+  for (;;) {
+    const { done, value } = await reader.read();
+    if (done) {
+      break;
+    }
+    if (length + value.length > out.length) {
+      const grown = new Uint8Array(Math.max(2 * out.length, length + value.length));
+      grown.set(out.subarray(0, length));
+      out = grown;
+    }
+    out.set(value, length);
+    length += value.length;
+  }
+  return out.subarray(0, length);
+}
+
+/**
+ * Download the contents of several URLs concurrently, with at most
+ * `concurrency` requests in flight at once.
+ *
+ * With `gunzip`, responses for URLs ending in `.gz` or `.tgz` are
+ * decompressed as they are received, where `DecompressionStream` is
+ * supported.
+ * @param {string[]} urls The URLs to download.
+ * @param {number} concurrency The largest number of concurrent requests.
+ * @param {boolean} [gunzip] Decompress gzip compressed responses.
+ * @returns {Promise<(Uint8Array | null)[]>} The contents of each URL, or
+ * `null` where the request failed.
+ */
+export async function fetchAll(
+  urls: string[],
+  concurrency: number,
+  gunzip = false
+): Promise<(Uint8Array | null)[]> {
+  const Decompression = (globalThis as {
+    DecompressionStream?: DecompressionStreamConstructor;
+  }).DecompressionStream;
+  const results: (Uint8Array | null)[] = urls.map(() => null);
+  if (typeof fetch === 'undefined') {
+    return results;
+  }
+  let next = 0;
+  const fetchNext = async (): Promise<void> => {
+    while (next < urls.length) {
+      const i = next++;
+      try {
+        const response = await fetch(urls[i]);
+        if (!response.ok) {
+          continue;
+        }
+        results[i] = gunzip && Decompression && response.body && /\.t?gz$/.test(urls[i])
+          ? await readGunzipped(response, Decompression)
+          : new Uint8Array(await response.arrayBuffer());
+      } catch {
+        // Failed requests are retried by the worker, when the image is mounted
+      }
+    }
+  };
+  const workers = Math.max(1, Math.min(concurrency, urls.length));
+  await Promise.all(Array.from({ length: workers }, fetchNext));
+  return results;
+}
+
+// Functions compiled from JavaScript code by `evalJs()`, keyed by argument
+// names and code, or `null` if the code is not a single expression
+const compiledJs = new Map<string, ((...args: unknown[]) => unknown) | null>();
+const COMPILED_JS_MAX = 256;
+
+// Code that would be evaluated differently as an expression, e.g. a
+// function declaration or a block, is never compiled
+const notExpression = /^\s*(function\b|class\b|async\s+function\b|\{)/;
+
+/**
+ * Evaluate JavaScript code in the global scope, with the given arguments
+ * available as variables.
+ *
+ * Code that is a single expression is compiled to a function the first time
+ * it is evaluated, and the function is cached for later evaluations of the
+ * same code. Other code, such as a sequence of statements, is evaluated with
+ * indirect `eval()` and can't be given arguments.
+ * @param {string} code The JavaScript code to evaluate.
+ * @param {object} [args] Values to make available to the code, by name.
+ * @returns {unknown} The result of evaluating the code.
+ */
+export function evalJs(code: string, args: { [name: string]: unknown } = {}): unknown {
+  const names = Object.keys(args);
+  const key = `${names.join(',')}\n${code}`;
+
+  let fn = compiledJs.get(key);
+  if (fn === undefined) {
+    fn = null;
+    if (!notExpression.test(code)) {
+      try {
+        fn = new Function(...names, `return (\n${code}\n);`) as (...args: unknown[]) => unknown;
+      } catch (e) {
+        if (!(e instanceof SyntaxError)) {
+          throw e;
+        }
+      }
+    }
+    if (compiledJs.size >= COMPILED_JS_MAX) {
+      compiledJs.delete(compiledJs.keys().next().value as string);
+    }
+    compiledJs.set(key, fn);
+  }
+
+  if (fn) {
+    return fn.apply(globalThis, names.map((name) => args[name]));
+  }
+  if (names.length > 0) {
+    throw new Error('Arguments can only be given when the code is a single JavaScript expression.');
+  }
+  return (0, eval)(code) as unknown;
+}
@@ -18,6 +18,23 @@ export interface CallRObjectMethodMessage extends Message {
     prop: string;
     args: WebRPayloadWorker[];
     shelter?: ShelterID; // TODO: Remove undefined
+    /** Further method calls, each made on the result of the previous call. */
+    pipeline?: RObjectMethodCall[];
+  };
+}
+
+/** @internal */
+export interface RObjectMethodCall {
+  prop: string;
+  args: WebRPayloadWorker[];
+}
+
+/** @internal */
+export interface ToJsRObjectMessage extends Message {
+  type: 'toJsRObject';
+  data: {
+    payload: WebRPayloadPtr;
+    options: { depth: number };
   };
 }
 
@@ -51,6 +68,26 @@ export interface InstallPackagesMessage extends Message {
   };
 }
 
+/**
+ * The configuration settings used when creating a session checkpoint.
+ */
+export interface CheckpointOptions {
+  /**
+   * Directories in the virtual filesystem to be restored on rollback.
+   * Filesystems mounted since the checkpoint are unmounted on rollback,
+   * wherever they are mounted.
+   * Default: The home directory, `/tmp`, and the library that packages are
+   * installed into, `.libPaths()[1]`.
+   */
+  paths?: string[];
+}
+
+/** @internal */
+export interface CheckpointMessage extends Message {
+  type: 'checkpoint';
+  data: CheckpointOptions;
+}
+
 /**
  * The configuration settings used when evaluating R code.
  */
@@ -199,6 +236,39 @@ export interface FSWriteFileMessage extends Message {
   };
 }
 
+/** @internal */
+export interface FSOpenStreamMessage extends Message {
+  type: 'openStream';
+  data: {
+    path: string;
+    flags: string;
+  };
+}
+
+/** @internal */
+export interface FSReadStreamMessage extends Message {
+  type: 'readStream';
+  data: {
+    fd: number;
+    length: number;
+  };
+}
+
+/** @internal */
+export interface FSWriteStreamMessage extends Message {
+  type: 'writeStream';
+  data: {
+    fd: number;
+    data: ArrayBufferView;
+  };
+}
+
+/** @internal */
+export interface FSCloseStreamMessage extends Message {
+  type: 'closeStream';
+  data: { fd: number };
+}
+
 /** @internal */
 export interface InvokeWasmFunctionMessage extends Message {
   type: 'invokeWasmFunction';
@@ -229,7 +299,7 @@ export interface ShelterMessage extends Message {
 /** @internal */
 export interface ShelterDestroyMessage extends Message {
   type: 'shelterDestroy';
-  data: { id: ShelterID; obj: WebRPayloadPtr };
+  data: { id: ShelterID; obj: WebRPayloadPtr[] };
 }
 
 export interface CanvasMessage extends Message {
@@ -0,0 +1,72 @@
+/**
+ * Worker script for the nodes of a webR cluster. Each node starts its own
+ * instance of webR, then evaluates tasks sent by the R `parallel` package.
+ * @module ClusterWorker
+ */
+import { IN_NODE } from './compat';
+import { WebR } from './webr-main';
+import { RRaw } from './robj-main';
+import type { ClusterMessage } from './cluster';
+import type { parentPort } from 'worker_threads';
+
+let webR: WebR | undefined;
+let queue = Promise.resolve();
+
+let reply: (msg: ClusterMessage, transfer?: Transferable[]) => void;
+
+async function handleMessage(msg: ClusterMessage) {
+  try {
+    switch (msg.type) {
+      case 'init': {
+        webR = new WebR(msg.options);
+        await webR.init();
+        // Console output from the node is not forwarded
+        void (async (instance: WebR) => {
+          for (;;) {
+            const output = await instance.read();
+            if (output.type === 'closed') {
+              return;
+            }
+          }
+        })(webR);
+        reply({ type: 'ready' });
+        break;
+      }
+      case 'eval': {
+        if (!webR) {
+          throw new Error('The webR cluster node has not been initialised.');
+        }
+        const shelter = await new webR.Shelter();
+        try {
+          const result = await shelter.evalR('webr:::cluster_work(task)', {
+            env: { task: msg.data },
+          }) as RRaw;
+          const data = await result.toTypedArray();
+          reply({ type: 'result', data }, [data.buffer]);
+        } finally {
+          await shelter.purge();
+        }
+        break;
+      }
+      default:
+        throw new Error(`Unsupported cluster message type '${(msg as { type: string }).type}'.`);
+    }
+  } catch (e) {
+    reply({ type: 'error', message: (e as Error).message });
+  }
+}
+
+// Messages posted through the webR `Worker` proxy are received with the
+// proxy's identifier, as `{ uuid, data }`
+function onMessage(message: { data: ClusterMessage }) {
+  queue = queue.then(() => handleMessage(message.data));
+}
+
+if (IN_NODE) {
+  const port = (require('worker_threads') as { parentPort: typeof parentPort }).parentPort!;
+  reply = (msg, transfer) => port.postMessage(msg, transfer as []);
+  port.on('message', onMessage);
+} else {
+  reply = (msg, transfer = []) => globalThis.postMessage(msg, { transfer });
+  globalThis.onmessage = (ev: MessageEvent<{ data: ClusterMessage }>) => onMessage(ev.data);
+}
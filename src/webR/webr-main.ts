@@ -3,22 +3,26 @@
  * @module WebR
  */
 
-import { ChannelMain } from './chan/channel';
+import { ChannelMain, EventStats } from './chan/channel';
+import { WebRMetrics, WorkerChannelMetrics } from './chan/metrics';
 import { newChannelMain, ChannelType } from './chan/channel-common';
-import { CloseWebSocketMessage, Message, PostMessageWorkerMessage, ProxyWebSocketMessage, ProxyWorkerMessage, SendWebSocketMessage, TerminateWorkerMessage } from './chan/message';
+import { CacheGetMessage, CachePutMessage, CloseWebSocketMessage, Message, PostMessageWorkerMessage, PrefetchMessage, ProxyWebSocketMessage, ProxyWorkerMessage, SendWebSocketMessage, TerminateWorkerMessage, WebSocketDoorbellMessage } from './chan/message';
 import { BASE_URL, PKG_BASE_URL, WEBR_VERSION, R_VERSION } from './config';
 import { EmPtr } from './emscripten';
 import { WebRPayloadPtr } from './payload';
-import { newRProxy, newRClassProxy } from './proxy';
+import { newRProxy, newRClassProxy, proxyReleaser, ShelterStats } from './proxy';
 import { isRObject, RCharacter, RComplex, RDouble } from './robj-main';
 import { REnvironment, RSymbol, RInteger, RList, RDataFrame } from './robj-main';
 import { RLogical, RNull, RObject, RPairlist, RRaw, RString, RCall } from './robj-main';
-import { replaceInObject } from './utils';
+import { fetchAll, promiseHandles, replaceInObject } from './utils';
+import { Ring } from './chan/queue';
 import * as RWorker from './robj-worker';
 import { WebRError, WebRPayloadError } from './error';
 
 import {
   CaptureRMessage,
+  CheckpointMessage,
+  CheckpointOptions,
   EvalRMessage,
   EvalRMessageOutputType,
   EvalRMessageRaw,
@@ -28,6 +32,10 @@ import {
   FSSyncfsMessage,
   FSReadFileMessage,
   FSWriteFileMessage,
+  FSOpenStreamMessage,
+  FSReadStreamMessage,
+  FSWriteStreamMessage,
+  FSCloseStreamMessage,
   InstallPackagesOptions,
   InvokeWasmFunctionMessage,
   NewShelterMessage,
@@ -38,12 +46,26 @@ import {
 } from './webr-chan';
 import { WebSocketMap } from './chan/proxy-websocket';
 import { WorkerMap } from './chan/proxy-worker';
+import { SnapshotCache, WebRWarmupOptions } from './snapshot';
+import { BrowserPackageCache, PackageCacheOptions } from './package-cache';
+import { IN_NODE } from './compat';
 
 export { Console, ConsoleCallbacks } from './console';
 export * from './robj-main';
 export * from './error';
 export * from './webr-chan';
 export { ChannelType } from './chan/channel-common';
+export type { ShelterStats } from './proxy';
+export type { EventStats } from './chan/channel';
+export type { WebRWarmupOptions } from './snapshot';
+export type { PackageCacheOptions } from './package-cache';
+export type {
+  ChannelMetrics,
+  HistogramSummary,
+  RequestMetrics,
+  WebRMetrics,
+  WorkerChannelMetrics,
+} from './chan/metrics';
 
 /**
  * The webR FS API for interacting with the Emscripten Virtual File System.
@@ -69,6 +91,29 @@ export interface WebRFS {
    * @returns {Promise<Uint8Array>} The content of the requested file.
    */
   readFile: (path: string, flags?: string) => Promise<Uint8Array>;
+  /**
+   * Read a file on the Emscripten virtual file system as a stream. Chunks of
+   * the file are requested from the webR worker as the stream is read, so
+   * that the file is never held in full on the main thread.
+   * @param {string} path Path of the file to read.
+   * @param {FSStreamOptions} [options] Options for reading the file.
+   * @returns {ReadableStream<Uint8Array>} A stream of chunks of the file.
+   */
+  createReadStream: (path: string, options?: FSStreamOptions) => ReadableStream<Uint8Array>;
+  /**
+   * Write a file on the Emscripten virtual file system from a stream. Each
+   * chunk is written before the next is accepted, so that large uploads are
+   * never held in full on the main thread.
+   *
+   * Chunks are written through the filesystem mounted at `path`. Writing to
+   * a path within a `NODEFS` mount stores the file directly on disk, rather
+   * than in the memory of the webR worker.
+   * @param {string} path Path of the file to write.
+   * @param {FSStreamOptions} [options] Options for writing the file.
+   * @returns {WritableStream<ArrayBufferView>} A stream accepting the file
+   * contents.
+   */
+  createWriteStream: (path: string, options?: FSStreamOptions) => WritableStream<ArrayBufferView>;
   /**
    * Remove a directory on the Emscripten virtual file system.
    * @param {string} path Path of the directory to remove.
@@ -89,6 +134,24 @@ export interface WebRFS {
   unlink: (path: string) => Promise<void>;
 }
 
+/** Options for streaming files to and from the Emscripten Virtual File System */
+export interface FSStreamOptions {
+  /**
+   * The size of the chunks moved between the main thread and the webR
+   * worker, in bytes.
+   * Default: `1` MiB.
+   */
+  chunkSize?: number;
+
+  /**
+   * Open the file with the specified flags, e.g. `'a'` to append to a file.
+   * Default: `'r'` when reading, `'w'` when writing.
+   */
+  flags?: string;
+}
+
+const FS_STREAM_CHUNK_SIZE = 1024 * 1024;
+
 /** A filesystem entry in the Emscripten Virtual File System */
 export type FSNode = {
   id: number;
@@ -127,6 +190,23 @@ export type FSMetaData = {
     end: number;
   }[],
   gzip?: boolean;
+  blocks?: FSBlockIndex;
+};
+
+/**
+ * The block index of a block-compressed filesystem image. File `start` and
+ * `end` offsets refer to the uncompressed data, which is split into blocks
+ * of `size` bytes, each compressed independently.
+ */
+export type FSBlockIndex = {
+  /** The uncompressed size of each block, other than the last. */
+  size: number;
+  compression: 'zlib' | 'none';
+  /**
+   * The offsets of each compressed block in the image, followed by the
+   * offset of the end of the final block.
+   */
+  offsets: number[];
 };
 
 /** Emscripten filesystem entry information, as given by `FS.analyzePath()` */
@@ -200,6 +280,44 @@ export interface WebROptions {
    * Default: `true`.
    */
   createLazyFilesystem?: boolean;
+
+  /**
+   * The longest interval, in milliseconds, between checks for events such as
+   * interrupts while R is waiting, e.g. in `Sys.sleep()`. The interval is
+   * shortened while events are arriving.
+   * Default: `100`.
+   */
+  eventPollInterval?: number;
+
+  /**
+   * If greater than zero, the interval in milliseconds at which communication
+   * channel metrics are reported. Reports are sent while the worker thread is
+   * active, and are received as messages of type `metrics` from the output
+   * queue, with data of type {@link WebRMetrics}.
+   * Default: `0`.
+   */
+  metricsInterval?: number;
+
+  /**
+   * Prepare R by running a warm-up script, such as one that installs and
+   * attaches packages, before `init()` resolves. The state left by the
+   * script is saved as a snapshot and cached, so that later webR instances
+   * started with the same options restore the snapshot rather than running
+   * the script again. See {@link WebRWarmupOptions}.
+   * Default: `null`.
+   */
+  warmup?: WebRWarmupOptions | null;
+
+  /**
+   * Cache downloaded filesystem images, such as those used to mount R
+   * packages, so that later sessions mount them without network access.
+   * Images are cached in a directory under Node.js, and using the Cache API
+   * in web browsers. In web browsers, the cache requires the
+   * `SharedArrayBuffer` or `RingBuffer` communication channel.
+   * See {@link PackageCacheOptions}.
+   * Default: `null`, images are not cached.
+   */
+  packageCache?: PackageCacheOptions | null;
 }
 
 const defaultEnv = {
@@ -222,8 +340,15 @@ const defaultOptions = {
   interactive: true,
   channelType: ChannelType.Automatic,
   createLazyFilesystem: true,
+  eventPollInterval: 100,
+  metricsInterval: 0,
+  warmup: null,
+  packageCache: null,
 };
 
+// Temporary location of a warm-start snapshot in the virtual filesystem
+const SNAPSHOT_FILE = '/tmp/.webr-snapshot.tar.gz';
+
 /**
  * The webR class is used to initialize and interact with the webR system.
  *
@@ -233,8 +358,10 @@ const defaultOptions = {
  */
 export class WebR {
   #chan: ChannelMain;
+  #config: Required<WebROptions>;
   #ws: WebSocketMap;
   #workers: WorkerMap;
+  #packageCache: BrowserPackageCache | null = null;
   #initialised: Promise<unknown>;
   globalShelter!: Shelter;
   version: string = WEBR_VERSION;
@@ -275,9 +402,14 @@ export class WebR {
         ...options.REnv,
       }
     };
+    this.#config = config;
     this.#chan = newChannelMain(config);
     this.#ws = new WebSocketMap(this.#chan);
     this.#workers = new WorkerMap(this.#chan);
+    if (config.packageCache && !IN_NODE) {
+      // Under Node.js the worker thread uses the cache directory itself
+      this.#packageCache = new BrowserPackageCache(config.packageCache);
+    }
 
     this.objs = {} as typeof this.objs;
     this.Shelter = newShelterProxy(this.#chan);
@@ -310,9 +442,47 @@ export class WebR {
       };
 
       void this.#handleSystemMessages();
+
+      if (config.warmup) {
+        await this.#warmStart(config.warmup);
+      }
     });
   }
 
+  /**
+   * Restore a cached warm-start snapshot, or run the warm-up script and save
+   * a new snapshot to the cache.
+   *
+   * Snapshots hold the R packages installed by the warm-up script, any other
+   * requested directories, and the R session state: attached packages,
+   * loaded namespaces, changed options and the global environment.
+   */
+  async #warmStart(options: WebRWarmupOptions) {
+    const cache = new SnapshotCache(options, [WEBR_VERSION, R_VERSION]);
+    const env = { file: SNAPSHOT_FILE, paths: options.paths ?? [] };
+
+    const cached = await cache.read();
+    if (cached) {
+      try {
+        await this.FS.writeFile(SNAPSHOT_FILE, cached);
+        await this.evalRVoid('webr:::snapshot_restore(file)', { env });
+        return;
+      } catch (e) {
+        // Fall back to running the warm-up script, replacing the snapshot
+        console.warn(`Can't restore webR snapshot, running the warm-up script instead: ${
+          (e as Error).message
+        }`);
+      }
+    }
+
+    await this.evalRVoid('webr:::snapshot_begin()');
+    await this.evalRVoid(options.script);
+    await this.evalRVoid('webr:::snapshot_save(file, paths)', { env });
+    const data = await this.FS.readFile(SNAPSHOT_FILE);
+    await this.FS.unlink(SNAPSHOT_FILE);
+    await cache.write(data);
+  }
+
   /**
    * @returns {Promise<void>} A promise that resolves once webR has been
    * initialised.
@@ -341,7 +511,17 @@ export class WebR {
           break;
         case 'proxyWebSocket': {
           const message = msg as ProxyWebSocketMessage;
-          this.#ws.new(message.data.uuid, message.data.url, message.data.protocol);
+          this.#ws.new(
+            message.data.uuid,
+            message.data.url,
+            message.data.protocol,
+            message.data.streams
+          );
+          break;
+        }
+        case 'websocketDoorbell': {
+          const message = msg as WebSocketDoorbellMessage;
+          this.#ws.doorbell(message.data.uuid);
           break;
         }
         case 'sendWebSocket': {
@@ -369,6 +549,33 @@ export class WebR {
           this.#workers.terminate(message.data.uuid);
           break;
         }
+        case 'cacheGet': {
+          const { key, handles } = (msg as CacheGetMessage).data;
+          if (this.#packageCache) {
+            this.#packageCache.get(key).then(handles!.resolve, handles!.reject);
+          } else {
+            handles!.resolve(null);
+          }
+          break;
+        }
+        case 'cachePut': {
+          const { key, data } = (msg as CachePutMessage).data;
+          void this.#packageCache?.put(key, data);
+          break;
+        }
+        case 'prefetch': {
+          const { urls, concurrency, gunzip, handles } = (msg as PrefetchMessage).data;
+          fetchAll(urls, concurrency, gunzip).then(handles!.resolve, handles!.reject);
+          break;
+        }
+        case 'metrics': {
+          const data: WebRMetrics = {
+            main: this.#chan.metrics(),
+            worker: msg.data as WorkerChannelMetrics,
+          };
+          this.#chan.outputQueue.put({ type: 'metrics', data });
+          break;
+        }
         case 'console.log':
           console.log(msg.data);
           break;
@@ -448,6 +655,67 @@ export class WebR {
     this.#chan.interrupt();
   }
 
+  /**
+   * Report the depth of the queue of events waiting to be collected by the
+   * worker thread, and the time taken for events to be collected.
+   * @returns {EventStats} Event queue statistics.
+   */
+  eventStats(): EventStats {
+    return this.#chan.eventStats();
+  }
+
+  /**
+   * Report metrics for the communication channel, from both the main and
+   * worker threads. Request latency is split into time spent executing the
+   * request in the worker thread and time spent queued or in transit, so that
+   * communication overhead can be distinguished from the cost of R evaluation.
+   *
+   * Worker metrics are collected by a request, which is handled once R is
+   * ready to receive input.
+   * @returns {Promise<WebRMetrics>} Channel metrics.
+   */
+  async metrics(): Promise<WebRMetrics> {
+    const payload = await this.#chan.request({ type: 'metrics' });
+    return {
+      main: this.#chan.metrics(),
+      worker: payload.obj as WorkerChannelMetrics,
+    };
+  }
+
+  /**
+   * Record the state of the R session, so that it can later be restored with
+   * {@link WebR.rollback}, e.g. between requests from different users.
+   *
+   * The checkpoint holds the global environment, the search path, loaded
+   * namespaces, options, environment variables, open connections and
+   * graphics devices, the working directory, and the contents of the
+   * directories given by `options.paths`, which by default include the
+   * package library. Creating a new checkpoint replaces
+   * any existing checkpoint.
+   *
+   * Objects in the global environment are not copied until they are
+   * modified, but changes made to environments and other reference objects
+   * in place, or to the internal state of loaded namespaces, are not undone.
+   * @param {CheckpointOptions} [options] Options for the checkpoint.
+   */
+  async checkpoint(options: CheckpointOptions = {}) {
+    const msg: CheckpointMessage = {
+      type: 'checkpoint',
+      data: { paths: options.paths },
+    };
+    await this.#chan.request(msg);
+  }
+
+  /**
+   * Restore the state of the R session recorded by {@link WebR.checkpoint}.
+   *
+   * The checkpoint is kept, so that the session can be rolled back to the
+   * same state repeatedly.
+   */
+  async rollback() {
+    await this.#chan.request({ type: 'rollback' });
+  }
+
   /**
    * Install a list of R packages from Wasm binary package repositories.
    * @param {string | string[]} packages An string or array of strings
@@ -467,9 +735,10 @@ export class WebR {
 
   /**
    * Destroy an R object reference.
-   * @param {RObject} x An R object reference.
+   * @param {RObject | RObject[]} x An R object reference, or an array of
+   * references to destroy in a single request.
    */
-  async destroy(x: RObject) {
+  async destroy(x: RObject | RObject[]) {
     await this.globalShelter.destroy(x);
   }
 
@@ -625,6 +894,78 @@ export class WebR {
       const payload = await this.#chan.request(msg);
       return payload.obj as Uint8Array;
     },
+    createReadStream: (path: string, options: FSStreamOptions = {}): ReadableStream<Uint8Array> => {
+      const { chunkSize = FS_STREAM_CHUNK_SIZE, flags = 'r' } = options;
+      let fd: number | null = null;
+      const close = async () => {
+        if (fd !== null) {
+          const msg: FSCloseStreamMessage = { type: 'closeStream', data: { fd } };
+          fd = null;
+          await this.#chan.request(msg);
+        }
+      };
+      return new ReadableStream<Uint8Array>({
+        start: async () => {
+          const msg: FSOpenStreamMessage = { type: 'openStream', data: { path, flags } };
+          fd = (await this.#chan.request(msg)).obj as number;
+        },
+        // Chunks are only requested when the stream's queue has room
+        pull: async (controller) => {
+          try {
+            const msg: FSReadStreamMessage = { type: 'readStream', data: { fd: fd!, length: chunkSize } };
+            const chunk = (await this.#chan.request(msg)).obj as Uint8Array;
+            if (chunk.length > 0) {
+              controller.enqueue(chunk);
+            } else {
+              await close();
+              controller.close();
+            }
+          } catch (e) {
+            await close();
+            throw e;
+          }
+        },
+        cancel: close,
+      }, { highWaterMark: 1 });
+    },
+    createWriteStream: (path: string, options: FSStreamOptions = {}): WritableStream<ArrayBufferView> => {
+      const { chunkSize = FS_STREAM_CHUNK_SIZE, flags = 'w' } = options;
+      let fd: number | null = null;
+      const close = async () => {
+        if (fd !== null) {
+          const msg: FSCloseStreamMessage = { type: 'closeStream', data: { fd } };
+          fd = null;
+          await this.#chan.request(msg);
+        }
+      };
+      return new WritableStream<ArrayBufferView>({
+        start: async () => {
+          const msg: FSOpenStreamMessage = { type: 'openStream', data: { path, flags } };
+          fd = (await this.#chan.request(msg)).obj as number;
+        },
+        write: async (chunk) => {
+          const bytes = new Uint8Array(chunk.buffer, chunk.byteOffset, chunk.byteLength);
+          try {
+            for (let offset = 0; offset < bytes.length; offset += chunkSize) {
+              // Copies are transferred, leaving the caller's buffer intact
+              const data = bytes.slice(offset, offset + chunkSize);
+              const msg: FSWriteStreamMessage = { type: 'writeStream', data: { fd: fd!, data } };
+              // The buffer is detached once transferred
+              const length = data.length;
+              const written = (await this.#chan.request(msg, [data.buffer as ArrayBuffer])).obj;
+              if (written !== length) {
+                throw new WebRError(`Short write to "${path}", ${String(written)} of ${length} bytes written.`);
+              }
+            }
+          } catch (e) {
+            await close();
+            throw e;
+          }
+        },
+        close,
+        abort: close,
+      }, { highWaterMark: 1 });
+    },
     rename: async (oldpath: string, newpath: string): Promise<void> => {
       const msg: FSRenameMessage = { type: 'rename', data: { oldpath, newpath } };
       await this.#chan.request(msg);
@@ -707,17 +1048,39 @@ export class Shelter {
       type: 'shelterPurge',
       data: this.#id,
     };
+    proxyReleaser(this.#chan).purge(this.#id);
     await this.#chan.request(msg);
   }
 
-  async destroy(x: RObject) {
+  /**
+   * Release R objects protected by the shelter.
+   *
+   * Multiple objects may be given as an array, released in a single request
+   * to the worker thread.
+   * @param {RObject | RObject[]} x The R object or objects to release.
+   */
+  async destroy(x: RObject | RObject[]) {
+    const objs = Array.isArray(x) ? x : [x];
     const msg: ShelterDestroyMessage = {
       type: 'shelterDestroy',
-      data: { id: this.#id, obj: x._payload },
+      data: { id: this.#id, obj: objs.map((obj) => obj._payload) },
     };
+    proxyReleaser(this.#chan).unregister(this.#id, msg.data.obj);
     await this.#chan.request(msg);
   }
 
+  /**
+   * Get counters for the R objects protected by the shelter.
+   *
+   * R objects are automatically released once their proxies are garbage
+   * collected on the main thread. Unreachable objects are released in
+   * batches, so that `pending` objects may still count towards `size()`.
+   * @returns {ShelterStats} The shelter's live, pending and released counts.
+   */
+  stats(): ShelterStats {
+    return proxyReleaser(this.#chan).stats(this.#id);
+  }
+
   async size(): Promise<number> {
     const msg: ShelterMessage = {
       type: 'shelterSize',
@@ -748,7 +1111,7 @@ export class Shelter {
       case 'raw':
         throw new WebRPayloadError('Unexpected payload type returned from evalR');
       default:
-        return newRProxy(this.#chan, payload);
+        return newRProxy(this.#chan, payload, this.#id);
     }
   }
 
@@ -793,13 +1156,13 @@ export class Shelter {
           output: { type: string; data: any }[];
           images: ImageBitmap[];
         };
-        const result = newRProxy(this.#chan, data.result);
+        const result = newRProxy(this.#chan, data.result, this.#id);
         const output = data.output;
         const images = data.images;
 
         for (let i = 0; i < output.length; ++i) {
           if (output[i].type !== 'stdout' && output[i].type !== 'stderr') {
-            output[i].data = newRProxy(this.#chan, output[i].data as WebRPayloadPtr);
+            output[i].data = newRProxy(this.#chan, output[i].data as WebRPayloadPtr, this.#id);
           }
         }
 
@@ -820,3 +1183,439 @@ function newShelterProxy(chan: ChannelMain) {
     new(): Promise<Shelter>;
   };
 }
+
+/**
+ * A filesystem to be mounted in every instance of a {@link WebRPool}.
+ */
+export type WebRPoolMount<T extends FSType = FSType> = {
+  type: T;
+  options: FSMountOptions<T>;
+  mountpoint: string;
+};
+
+/**
+ * The configuration settings to be used when starting a pool of webR
+ * instances. Options inherited from {@link WebROptions} are shared by every
+ * instance in the pool.
+ */
+export interface WebRPoolOptions extends WebROptions {
+  /**
+   * The number of webR instances to start.
+   * Default: The number of logical processors, or `4` if unknown.
+   */
+  size?: number;
+
+  /**
+   * Filesystems to mount in every instance once started, e.g. filesystem
+   * images containing R packages. Mountpoints are created if they do not
+   * already exist.
+   * Default: `[]`.
+   */
+  mounts?: WebRPoolMount[];
+}
+
+/** Options for scheduling a task with a {@link WebRPool}. */
+export interface WebRPoolTaskOptions {
+  /**
+   * Run the task with the same instance as earlier tasks given the same
+   * session key, so that R state such as global variables is kept between
+   * them. Tasks without a session key may run with any instance.
+   */
+  session?: string;
+}
+
+/** Statistics for an instance in a {@link WebRPool}. */
+export interface WebRPoolInstanceStats {
+  /** Tasks waiting in the instance's queue. */
+  queued: number;
+  /** Whether the instance is running a task. */
+  running: boolean;
+  /** Tasks completed by the instance. */
+  completed: number;
+  /** Tasks taken by the instance from the queue of another instance. */
+  stolen: number;
+  /** Sessions assigned to the instance. */
+  sessions: number;
+  /** Fraction of time spent running tasks since the pool was started. */
+  utilisation: number;
+}
+
+/** Statistics for a {@link WebRPool}. */
+export interface WebRPoolStats {
+  /** Tasks waiting in any queue. */
+  queued: number;
+  /** Instances running a task. */
+  running: number;
+  /** Tasks completed by any instance. */
+  completed: number;
+  /** Tasks taken by an instance from the queue of another instance. */
+  stolen: number;
+  /** Mean utilisation of the instances in the pool. */
+  utilisation: number;
+  instances: WebRPoolInstanceStats[];
+}
+
+type WebRPoolTask = {
+  seq: number;
+  run: (webR: WebR) => Promise<unknown>;
+  resolve: (value: unknown) => void;
+  reject: (reason?: any) => void;
+};
+
+class WebRPoolInstance {
+  ready = false;
+  failed = false;
+  running = false;
+  current: WebRPoolTask | null = null;
+  completed = 0;
+  stolen = 0;
+  sessions = 0;
+  busyTime = 0;
+  // Tasks for a session may only run with this instance, others may be stolen
+  pinned = new Ring<WebRPoolTask>();
+  shared = new Ring<WebRPoolTask>();
+
+  constructor(readonly webR: WebR) {}
+
+  get queued() {
+    return this.pinned.length + this.shared.length;
+  }
+
+  get load() {
+    return this.queued + (this.running ? 1 : 0);
+  }
+}
+
+/**
+ * A pool of webR instances, each running R in its own worker thread.
+ *
+ * Tasks are queued with the least loaded instance. An instance with an empty
+ * queue steals the most recently queued task from the instance with the
+ * longest queue, so that work is balanced across instances when tasks take
+ * differing amounts of time. Tasks given a session key always run with the
+ * same instance, and are never stolen.
+ *
+ * Console output from the instances is discarded. Use
+ * {@link WebRPool.captureR} to collect the output of evaluated R code.
+ */
+export class WebRPool {
+  #instances: WebRPoolInstance[];
+  #sessions = new Map<string, WebRPoolInstance>();
+  #owners = new WeakMap<RObject, WebR>();
+  #initialised: Promise<void>;
+  #closed = false;
+  #seq = 0;
+  #start = performance.now();
+
+  constructor(options: WebRPoolOptions = {}) {
+    const { size = defaultPoolSize(), mounts = [], ...webROptions } = options;
+    if (!Number.isInteger(size) || size < 1) {
+      throw new WebRError('A webR pool must contain at least one instance.');
+    }
+    this.#instances = Array.from({ length: size }, () => {
+      return new WebRPoolInstance(new WebR(webROptions));
+    });
+    this.#initialised = Promise.all(
+      this.#instances.map((instance) => this.#initInstance(instance, mounts).catch((e) => {
+        this.#failInstance(instance, e as Error);
+        throw e;
+      }))
+    ).then(() => undefined);
+  }
+
+  // Tasks can no longer run with an instance that failed to start. Its
+  // pinned tasks are rejected, and its other tasks are given to the
+  // remaining instances.
+  #failInstance(instance: WebRPoolInstance, e: Error) {
+    instance.failed = true;
+    const error = new WebRError(`A webR instance in the pool failed to start: ${e.message}`);
+    for (let task = instance.pinned.shift(); task; task = instance.pinned.shift()) {
+      task.reject(error);
+    }
+    for (let task = instance.shared.shift(); task; task = instance.shared.shift()) {
+      const other = this.#leastLoaded();
+      if (other) {
+        other.shared.push(task);
+      } else {
+        task.reject(error);
+      }
+    }
+    this.#instances.forEach((other) => this.#schedule(other));
+  }
+
+  async #initInstance(instance: WebRPoolInstance, mounts: WebRPoolMount[]) {
+    const webR = instance.webR;
+    await webR.init();
+    void (async () => {
+      for (;;) {
+        const msg = await webR.read();
+        if (msg.type === 'closed') {
+          return;
+        }
+      }
+    })();
+
+    for (const { type, options, mountpoint } of mounts) {
+      if (!(await webR.FS.analyzePath(mountpoint)).exists) {
+        await webR.FS.mkdir(mountpoint);
+      }
+      await webR.FS.mount(type, options, mountpoint);
+    }
+
+    instance.ready = true;
+    this.#schedule(instance);
+  }
+
+  /**
+   * @returns {Promise<void>} A promise that resolves once every instance in
+   * the pool has been initialised.
+   */
+  async init() {
+    return this.#initialised;
+  }
+
+  /** The number of webR instances in the pool. */
+  get size() {
+    return this.#instances.length;
+  }
+
+  /**
+   * Schedule a task to run with an instance from the pool.
+   *
+   * Each instance runs a single task at a time. R objects created by a task
+   * belong to the instance running it.
+   * @param {function} fn A function performing the task, given the webR
+   * instance to use.
+   * @param {WebRPoolTaskOptions} [options] Options for scheduling the task.
+   * @returns {Promise<T>} The result of the task.
+   */
+  run<T>(fn: (webR: WebR) => Promise<T>, options: WebRPoolTaskOptions = {}): Promise<T> {
+    if (this.#closed) {
+      return Promise.reject(new WebRError('The webR pool has been closed.'));
+    }
+    const { resolve, reject, promise } = promiseHandles<T>();
+    const task: WebRPoolTask = {
+      seq: this.#seq++,
+      run: fn,
+      resolve: resolve as (value: unknown) => void,
+      reject,
+    };
+
+    const unavailable = new WebRError('No webR instance in the pool is able to run tasks.');
+    if (options.session !== undefined) {
+      let instance = this.#sessions.get(options.session);
+      if (!instance) {
+        instance = this.#leastLoaded();
+        if (!instance) {
+          return Promise.reject(unavailable);
+        }
+        instance.sessions++;
+        this.#sessions.set(options.session, instance);
+      }
+      if (instance.failed) {
+        return Promise.reject(unavailable);
+      }
+      instance.pinned.push(task);
+      this.#schedule(instance);
+    } else {
+      const instance = this.#leastLoaded();
+      if (!instance) {
+        return Promise.reject(unavailable);
+      }
+      instance.shared.push(task);
+      // Any idle instance may take the task
+      this.#instances.forEach((instance) => this.#schedule(instance));
+    }
+    return promise;
+  }
+
+  /**
+   * Stop assigning tasks with the given session key to the same instance.
+   * @param {string} session The session key.
+   */
+  endSession(session: string) {
+    const instance = this.#sessions.get(session);
+    if (instance) {
+      instance.sessions--;
+      this.#sessions.delete(session);
+    }
+  }
+
+  /**
+   * Evaluate the given R code with an instance from the pool.
+   *
+   * The result is a reference to an R object belonging to the instance that
+   * evaluated the code. It can be released with {@link WebRPool.destroy}.
+   * @param {string} code The R code to evaluate.
+   * @param {EvalROptions & WebRPoolTaskOptions} [options] Options for the
+   * execution environment and for scheduling the evaluation.
+   * @returns {Promise<RObject>} The result of the computation.
+   */
+  async evalR(code: string, options: EvalROptions & WebRPoolTaskOptions = {}): Promise<RObject> {
+    const { session, ...evalOptions } = options;
+    return this.run(async (webR) => {
+      const result = await webR.evalR(code, evalOptions);
+      this.#owners.set(result, webR);
+      return result;
+    }, { session });
+  }
+
+  /**
+   * Evaluate the given R code with an instance from the pool, capturing
+   * output and conditions.
+   *
+   * R objects in the returned value belong to the instance that evaluated the
+   * code, and can be released with {@link WebRPool.destroy}.
+   * @param {string} code The R code to evaluate.
+   * @param {EvalROptions & WebRPoolTaskOptions} [options] Options for the
+   * execution environment and for scheduling the evaluation.
+   * @returns {Promise<{
+   *   result: RObject,
+   *   output: { type: string; data: any }[],
+   *   images: ImageBitmap[]
+   * }>} An object containing the result of the computation, an array of output,
+   *   and an array of captured plots.
+   */
+  async captureR(code: string, options: EvalROptions & WebRPoolTaskOptions = {}): Promise<{
+    result: RObject;
+    output: { type: string; data: any }[];
+    images: ImageBitmap[];
+  }> {
+    const { session, ...evalOptions } = options;
+    return this.run(async (webR) => {
+      const captured = await webR.globalShelter.captureR(code, evalOptions);
+      this.#owners.set(captured.result, webR);
+      captured.output.forEach((out) => {
+        if (isRObject(out.data)) {
+          this.#owners.set(out.data, webR);
+        }
+      });
+      return captured;
+    }, { session });
+  }
+
+  /**
+   * Destroy R object references returned by {@link WebRPool.evalR} or
+   * {@link WebRPool.captureR}.
+   * @param {RObject | RObject[]} x An R object reference, or an array of
+   * references.
+   */
+  async destroy(x: RObject | RObject[]) {
+    const objs = Array.isArray(x) ? x : [x];
+    await Promise.all(objs.map((obj) => {
+      const webR = this.#owners.get(obj);
+      if (!webR) {
+        throw new WebRError('R object reference does not belong to an instance in this pool.');
+      }
+      this.#owners.delete(obj);
+      return webR.destroy(obj);
+    }));
+  }
+
+  /**
+   * Report queue depth and utilisation of the instances in the pool.
+   * @returns {WebRPoolStats} Statistics for the pool and each instance.
+   */
+  stats(): WebRPoolStats {
+    const now = performance.now();
+    const elapsed = Math.max(now - this.#start, 1);
+    const instances = this.#instances.map((instance) => ({
+      queued: instance.queued,
+      running: instance.running,
+      completed: instance.completed,
+      stolen: instance.stolen,
+      sessions: instance.sessions,
+      utilisation: Math.min(instance.busyTime / elapsed, 1),
+    }));
+    const sum = (fn: (stats: WebRPoolInstanceStats) => number) => {
+      return instances.reduce((total, stats) => total + fn(stats), 0);
+    };
+    return {
+      queued: sum((stats) => stats.queued),
+      running: sum((stats) => (stats.running ? 1 : 0)),
+      completed: sum((stats) => stats.completed),
+      stolen: sum((stats) => stats.stolen),
+      utilisation: sum((stats) => stats.utilisation) / instances.length,
+      instances,
+    };
+  }
+
+  /**
+   * Close the pool, terminating every instance. Running and queued tasks are
+   * rejected.
+   */
+  close() {
+    this.#closed = true;
+    const error = new WebRError('The webR pool has been closed.');
+    for (const instance of this.#instances) {
+      instance.current?.reject(error);
+      for (let task = instance.pinned.shift(); task; task = instance.pinned.shift()) {
+        task.reject(error);
+      }
+      for (let task = instance.shared.shift(); task; task = instance.shared.shift()) {
+        task.reject(error);
+      }
+      instance.webR.close();
+    }
+  }
+
+  #leastLoaded(): WebRPoolInstance | undefined {
+    return this.#instances.reduce<WebRPoolInstance | undefined>((least, instance) => {
+      return !instance.failed && (!least || instance.load < least.load) ? instance : least;
+    }, undefined);
+  }
+
+  // Take the oldest task queued for the instance, otherwise steal the newest
+  // stealable task from the instance with the most of them
+  #next(instance: WebRPoolInstance): WebRPoolTask | undefined {
+    const pinned = instance.pinned.peek();
+    const shared = instance.shared.peek();
+    if (pinned && (!shared || pinned.seq < shared.seq)) {
+      return instance.pinned.shift();
+    }
+    if (shared) {
+      return instance.shared.shift();
+    }
+
+    let victim: WebRPoolInstance | undefined;
+    for (const other of this.#instances) {
+      if (other.shared.length > (victim?.shared.length ?? 0)) {
+        victim = other;
+      }
+    }
+    if (victim) {
+      instance.stolen++;
+      return victim.shared.pop();
+    }
+    return undefined;
+  }
+
+  #schedule(instance: WebRPoolInstance) {
+    if (!instance.ready || instance.running || this.#closed) {
+      return;
+    }
+    const task = this.#next(instance);
+    if (!task) {
+      return;
+    }
+
+    instance.running = true;
+    instance.current = task;
+    const start = performance.now();
+    void Promise.resolve()
+      .then(() => task.run(instance.webR))
+      // Record the task as completed before its result is delivered
+      .finally(() => {
+        instance.busyTime += performance.now() - start;
+        instance.completed++;
+        instance.running = false;
+        instance.current = null;
+      })
+      .then(task.resolve, task.reject)
+      .finally(() => this.#schedule(instance));
+  }
+}
+
+function defaultPoolSize(): number {
+  return (typeof navigator !== 'undefined' && navigator.hardwareConcurrency) || 4;
+}
@@ -5,17 +5,30 @@ import { EvalResponse, Message, Request, newResponse } from './chan/message';
 import { FSAnalyzeInfo, FSMountOptions, FSNode, WebROptions } from './webr-main';
 import { EmPtr, Module } from './emscripten';
 import { IN_NODE } from './compat';
-import { replaceInObject, throwUnreachable } from './utils';
+import { evalJs, replaceInObject, throwUnreachable } from './utils';
 import { WebRPayloadRaw, WebRPayloadPtr, WebRPayloadWorker, isWebRPayloadPtr } from './payload';
 import { RPtr, RType, RCtor, WebRData, WebRDataRaw } from './robj';
 import { protect, protectInc, unprotect, parseEvalBare, UnwindProtectException, safeEval } from './utils-r';
 import { generateUUID } from './chan/task-common';
-import { mountFS, mountImageUrl, mountImagePath, mountDriveFS } from './mount';
+import {
+  fetchRepoMetadata,
+  mountFS,
+  mountImageUrl,
+  mountImagePath,
+  mountDriveFS,
+  prefetchImageUrls,
+  setImageCache,
+  unmountFS,
+} from './mount';
+import { ClusterNodes } from './cluster';
+import { FSCheckpoint } from './checkpoint';
+import { ChannelImageCache, NodeImageCache } from './package-cache';
 import type { parentPort } from 'worker_threads';
 
 import {
   CallRObjectMethodMessage,
   CaptureRMessage,
+  CheckpointMessage,
   EvalROptions,
   EvalRMessage,
   EvalRMessageRaw,
@@ -23,14 +36,20 @@ import {
   FSReadFileMessage,
   FSMountMessage,
   FSWriteFileMessage,
+  FSOpenStreamMessage,
+  FSReadStreamMessage,
+  FSWriteStreamMessage,
+  FSCloseStreamMessage,
   InvokeWasmFunctionMessage,
   NewRObjectMessage,
   ShelterMessage,
   ShelterDestroyMessage,
+  ToJsRObjectMessage,
   InstallPackagesMessage,
   FSSyncfsMessage,
   FSRenameMessage,
   FSAnalyzePathMessage,
+  RObjectMethodCall,
 } from './webr-chan';
 
 import {
@@ -48,6 +67,7 @@ import {
   RRaw,
   RString,
   RSymbol,
+  HandleTable,
   destroy,
   getRWorkerClass,
   initPersistentObjects,
@@ -56,11 +76,16 @@ import {
   objs,
   purge,
   shelters,
+  toJsPacked,
 } from './robj-worker';
 
 let initialised = false;
 let resolved = false;
 let chan: ChannelWorker | undefined;
+let fsCheckpoint: FSCheckpoint | undefined;
+
+// Files opened for streaming to or from the main thread, by file descriptor
+const fsStreams = new Map<number, FS.FSStream>();
 
 // Make webR Worker R objects available in WorkerGlobalScope
 Object.assign(globalThis, {
@@ -120,18 +145,58 @@ if (IN_NODE) {
 type XHRResponse = {
   status: number;
   response: string | ArrayBuffer;
+  headers?: { [name: string]: string };
 };
 
 let _config: Required<WebROptions>;
 
+// While R waits, e.g. in `Sys.sleep()`, events are polled every
+// `R_wait_usec` microseconds. The interval is shortened when events arrive,
+// then backed off to the configured maximum while no events are seen.
+const MIN_EVENT_POLL_INTERVAL = 5;
+let eventPollInterval = 0;
+
+function setEventPollInterval(interval: number) {
+  if (interval !== eventPollInterval) {
+    eventPollInterval = interval;
+    Module.setValue(Module._R_wait_usec, Math.round(interval * 1000), 'i32');
+  }
+}
+
+function adaptEventPollInterval(handled: number) {
+  const max = _config.eventPollInterval;
+  setEventPollInterval(handled > 0
+    ? Math.min(MIN_EVENT_POLL_INTERVAL, max)
+    : Math.min(eventPollInterval * 2, max)
+  );
+}
+
+// When `metricsInterval` is set, channel metrics are reported to the main
+// thread as system messages while the worker is active
+let lastMetricsReport = 0;
+
+function reportMetrics() {
+  const interval = _config.metricsInterval;
+  const now = performance.now();
+  if (chan && interval > 0 && now - lastMetricsReport >= interval) {
+    lastMetricsReport = now;
+    chan.writeSystem({ type: 'metrics', data: chan.metrics() });
+  }
+}
+
 function dispatch(msg: Message): void {
   switch (msg.type) {
     case 'request': {
       const req = msg as Request;
       const reqMsg = req.data.msg;
+      const start = performance.now();
 
-      const write = (resp: WebRPayloadWorker, transferables?: [Transferable]) =>
-        chan?.write(newResponse(req.data.uuid, { type: 'payload', data: resp }, transferables));
+      const write = (resp: WebRPayloadWorker, transferables?: [Transferable]) => {
+        const response = newResponse(req.data.uuid, { type: 'payload', data: resp }, transferables);
+        response.data.time = performance.now() - start;
+        chan?.write(response, transferables);
+        reportMetrics();
+      };
       try {
         switch (reqMsg.type) {
           case 'analyzePath': {
@@ -176,10 +241,11 @@ function dispatch(msg: Message): void {
             const msg = reqMsg as FSMountMessage;
             const type = msg.data.type;
             const mountpoint = msg.data.mountpoint;
-            if (type === "IDBFS" && _config.channelType == ChannelType.SharedArrayBuffer) {
+            if (type === "IDBFS" && _config.channelType !== ChannelType.PostMessage) {
               throw new Error(
                 'The `IDBFS` filesystem type is not supported under the `SharedArrayBuffer` ' +
-                'communication channel. The `PostMessage` communication channel must be used.'
+                'or `RingBuffer` communication channels. The `PostMessage` communication ' +
+                'channel must be used.'
               );
             }
 
@@ -236,14 +302,70 @@ function dispatch(msg: Message): void {
           case 'writeFile': {
             const msg = reqMsg as FSWriteFileMessage;
             const reqData = msg.data;
-            // FIXME: Use a replacer + reviver to transfer Uint8Array
-            const data = Uint8Array.from(Object.values(reqData.data));
+            // Typed arrays are received as views, possibly of a shared buffer
+            const data = ArrayBuffer.isView(reqData.data)
+              ? new Uint8Array(reqData.data.buffer, reqData.data.byteOffset, reqData.data.byteLength)
+              : Uint8Array.from(Object.values(reqData.data));
             write({
               obj: Module.FS.writeFile(reqData.path, data, { flags: reqData.flags }),
               payloadType: 'raw',
             });
             break;
           }
+          case 'openStream': {
+            const msg = reqMsg as FSOpenStreamMessage;
+            const stream = Module.FS.open(msg.data.path, msg.data.flags);
+            const fd = stream.fd as number;
+            fsStreams.set(fd, stream);
+            write({ obj: fd, payloadType: 'raw' });
+            break;
+          }
+          case 'readStream': {
+            const msg = reqMsg as FSReadStreamMessage;
+            const stream = fsStreams.get(msg.data.fd);
+            if (!stream) {
+              throw new Error(`No open filesystem stream with descriptor ${msg.data.fd}.`);
+            }
+            const buffer = new Uint8Array(msg.data.length);
+            const n = Module.FS.read(stream, buffer, 0, buffer.length);
+            const out = { obj: n < buffer.length ? buffer.slice(0, n) : buffer, payloadType: 'raw' };
+            write(out as WebRPayloadRaw, [out.obj.buffer]);
+            break;
+          }
+          case 'writeStream': {
+            const msg = reqMsg as FSWriteStreamMessage;
+            const stream = fsStreams.get(msg.data.fd);
+            if (!stream) {
+              throw new Error(`No open filesystem stream with descriptor ${msg.data.fd}.`);
+            }
+            // Typed arrays are received as views, possibly of a shared buffer
+            const chunk = msg.data.data;
+            if (!ArrayBuffer.isView(chunk)) {
+              throw new TypeError('Filesystem stream data must be a typed array.');
+            }
+            const data = new Uint8Array(chunk.buffer, chunk.byteOffset, chunk.byteLength);
+            // Filesystems may write less than requested, e.g. NODEFS
+            let written = 0;
+            while (written < data.length) {
+              const n = Module.FS.write(stream, data, written, data.length - written);
+              if (n <= 0) {
+                throw new Error(`Can't write to filesystem stream with descriptor ${msg.data.fd}.`);
+              }
+              written += n;
+            }
+            write({ obj: written, payloadType: 'raw' });
+            break;
+          }
+          case 'closeStream': {
+            const msg = reqMsg as FSCloseStreamMessage;
+            const stream = fsStreams.get(msg.data.fd);
+            if (stream) {
+              fsStreams.delete(msg.data.fd);
+              Module.FS.close(stream);
+            }
+            write({ obj: null, payloadType: 'raw' });
+            break;
+          }
           case 'unlink': {
             const msg = reqMsg as FSMessage;
             write({
@@ -263,7 +385,7 @@ function dispatch(msg: Message): void {
 
           case 'newShelter': {
             const id = generateUUID();
-            shelters.set(id, []);
+            shelters.set(id, new HandleTable());
 
             write({
               payloadType: 'raw',
@@ -274,7 +396,7 @@ function dispatch(msg: Message): void {
 
           case 'shelterSize': {
             const msg = reqMsg as ShelterMessage;
-            const size = shelters.get(msg.data)!.length;
+            const size = shelters.get(msg.data)!.size;
 
             write({ payloadType: 'raw', obj: size });
             break;
@@ -290,7 +412,17 @@ function dispatch(msg: Message): void {
 
           case 'shelterDestroy': {
             const msg = reqMsg as ShelterDestroyMessage;
-            destroy(msg.data.id, msg.data.obj.obj.ptr);
+            const missing = msg.data.obj.filter((payload) => {
+              try {
+                destroy(msg.data.id, payload.obj.ptr, payload.obj.handle);
+                return false;
+              } catch {
+                return true;
+              }
+            });
+            if (missing.length > 0) {
+              throw new Error("Can't find object in shelter.");
+            }
 
             write({ payloadType: 'raw', obj: null });
             break;
@@ -309,7 +441,7 @@ function dispatch(msg: Message): void {
               protectInc(capture.output, prot);
 
               const result = capture.result;
-              keep(shelter, result);
+              const handle = keep(shelter, result);
 
               const n = capture.output.length;
               const output: any[] = [];
@@ -323,12 +455,12 @@ function dispatch(msg: Message): void {
                   const msg = (data as RString).toString();
                   output.push({ type, data: msg });
                 } else {
-                  keep(shelter, data);
                   const payload = {
                     obj: {
                       ptr: data.ptr,
                       type: data.type(),
                       methods: RObject.getMethods(data),
+                      handle: keep(shelter, data),
                     },
                     payloadType: 'ptr',
                   } as WebRPayloadPtr;
@@ -342,6 +474,7 @@ function dispatch(msg: Message): void {
                   ptr: result.ptr,
                   type: result.type(),
                   methods: RObject.getMethods(result),
+                  handle,
                 },
               } as WebRPayloadPtr;
 
@@ -363,13 +496,14 @@ function dispatch(msg: Message): void {
             const msg = reqMsg as EvalRMessage;
 
             const result = evalR(msg.data.code, msg.data.options);
-            keep(msg.data.shelter, result);
+            const handle = keep(msg.data.shelter, result);
 
             write({
               obj: {
                 type: result.type(),
                 ptr: result.ptr,
                 methods: RObject.getMethods(result),
+                handle,
               },
               payloadType: 'ptr',
             });
@@ -489,7 +623,7 @@ function dispatch(msg: Message): void {
             const msg = reqMsg as NewRObjectMessage;
 
             const payload = newRObject(msg.data.args, msg.data.objType);
-            keep(msg.data.shelter, payload.obj.ptr);
+            payload.obj.handle = keep(msg.data.shelter, payload.obj.ptr);
 
             write(payload);
             break;
@@ -500,7 +634,7 @@ function dispatch(msg: Message): void {
             const data = msg.data;
             const obj = data.payload ? RObject.wrap(data.payload.obj.ptr) : RObject;
 
-            const payload = callRObjectMethod(obj, data.prop, data.args);
+            const payload = callRObjectMethod(obj, data.prop, data.args, data.pipeline);
             if (isWebRPayloadPtr(payload)) {
               // TODO: Remove `!`
               keep(data.shelter!, payload.obj.ptr);
@@ -510,6 +644,26 @@ function dispatch(msg: Message): void {
             break;
           }
 
+          case 'toJsRObject': {
+            const msg = reqMsg as ToJsRObjectMessage;
+            const obj = RObject.wrap(msg.data.payload.obj.ptr);
+            const packed = toJsPacked(obj, msg.data.options);
+
+            const out = {
+              obj: {
+                data: packed.data,
+                refs: packed.refs.map((ref) => ({
+                  obj: { type: ref.type(), ptr: ref.ptr, methods: RObject.getMethods(ref) },
+                  payloadType: 'ptr',
+                })),
+                fallback: packed.fallback,
+              },
+              payloadType: 'raw',
+            };
+            write(out as WebRPayloadRaw, [packed.data.buffer]);
+            break;
+          }
+
           case 'invokeWasmFunction': {
             const msg = reqMsg as InvokeWasmFunctionMessage;
             const res = Module.getWasmTableEntry(msg.data.ptr)(...msg.data.args);
@@ -520,6 +674,14 @@ function dispatch(msg: Message): void {
             break;
           }
 
+          case 'metrics': {
+            write({
+              obj: chan?.metrics(),
+              payloadType: 'raw',
+            });
+            break;
+          }
+
           case 'installPackages': {
             const msg = reqMsg as InstallPackagesMessage;
             let pkgs = msg.data.name;
@@ -539,6 +701,28 @@ function dispatch(msg: Message): void {
             });
             break;
           }
+          case 'checkpoint': {
+            const msg = reqMsg as CheckpointMessage;
+            const lib = (evalR('webr:::session_checkpoint()') as RCharacter).toString();
+            fsCheckpoint = new FSCheckpoint(msg.data.paths ?? [_config.homedir, '/tmp', lib]);
+            write({ obj: null, payloadType: 'raw' });
+            break;
+          }
+          case 'rollback': {
+            if (!fsCheckpoint) {
+              throw new Error('No session checkpoint has been created.');
+            }
+            // Restore files first, so that the working directory exists
+            for (const path of fsCheckpoint.rollback()) {
+              chan?.writeSystem({
+                type: 'console.warn',
+                data: `Can't roll back changes to "${path}", a file loaded on demand.`,
+              });
+            }
+            evalR('webr:::session_rollback()');
+            write({ obj: null, payloadType: 'raw' });
+            break;
+          }
           default:
             throw new Error('Unknown event `' + reqMsg.type + '`');
         }
@@ -616,12 +800,14 @@ function downloadFileContent(url: string, headers: Array<string> = [], maxRedire
     request.send(null);
 
     let status: number;
+    let responseHeaders: { [name: string]: string } = {};
 
     if (IN_NODE) {
       const parsed = JSON.parse(String(request.status)) as {
         data: { statusCode: number; headers: Record<string, string> }
       };
       status = parsed.data.statusCode;
+      responseHeaders = parsed.data.headers ?? {};
 
       // Follow 3xx redirects
       if (status >= 300 && status < 400) {
@@ -647,10 +833,19 @@ function downloadFileContent(url: string, headers: Array<string> = [], maxRedire
       }
     } else {
       status = request.status;
+      request.getAllResponseHeaders().trim().split(/[\r\n]+/).forEach((line) => {
+        const sep = line.indexOf(': ');
+        if (sep > 0) {
+          responseHeaders[line.slice(0, sep).toLowerCase()] = line.slice(sep + 2);
+        }
+      });
     }
 
     if (status >= 200 && status < 300) {
-      return { status: status, response: request.response as ArrayBuffer };
+      return { status: status, response: request.response as ArrayBuffer, headers: responseHeaders };
+    } else if (status === 304) {
+      // Not modified, in response to a conditional request
+      return { status: status, response: '', headers: responseHeaders };
     } else {
       const responseText = new TextDecoder().decode(request.response as ArrayBuffer);
       console.error(`Error fetching ${url} - ${responseText}`);
@@ -680,8 +875,41 @@ function newRObject(args: WebRData[], objType: RType | RCtor): WebRPayloadPtr {
 function callRObjectMethod(
   obj: RObject | typeof RObject,
   prop: string,
-  args: WebRPayloadWorker[]
+  args: WebRPayloadWorker[],
+  pipeline: RObjectMethodCall[] = []
 ): WebRPayloadWorker {
+  // Evaluate a pipeline of method calls, with intermediate results protected
+  // until the final result has been returned
+  const prot = { n: 0 };
+  let res: WebRData;
+  try {
+    res = invokeRObjectMethod(obj, prop, args);
+    for (const call of pipeline) {
+      if (!isRObject(res)) {
+        throw new TypeError(`Can't call method \`${call.prop}\` of a value that is not an R object`);
+      }
+      protectInc(res, prot);
+      res = invokeRObjectMethod(res, call.prop, call.args);
+    }
+  } finally {
+    unprotect(prot.n);
+  }
+
+  const ret = replaceInObject(res, isRObject, (obj: RObject) => {
+    return {
+      obj: { type: obj.type(), ptr: obj.ptr, methods: RObject.getMethods(obj) },
+      payloadType: 'ptr',
+    };
+  }) as WebRDataRaw;
+
+  return { obj: ret, payloadType: 'raw' };
+}
+
+function invokeRObjectMethod(
+  obj: RObject | typeof RObject,
+  prop: string,
+  args: WebRPayloadWorker[]
+): WebRData {
   if (!(prop in obj)) {
     throw new ReferenceError(`${prop} is not defined`);
   }
@@ -691,7 +919,7 @@ function callRObjectMethod(
     throw Error('Requested property cannot be invoked');
   }
 
-  const res = (fn as (...args: unknown[]) => unknown).apply(
+  return (fn as (...args: unknown[]) => unknown).apply(
     obj,
     args.map((arg) => {
       if (arg.payloadType === 'ptr') {
@@ -702,15 +930,6 @@ function callRObjectMethod(
       );
     })
   ) as WebRData;
-
-  const ret = replaceInObject(res, isRObject, (obj: RObject) => {
-    return {
-      obj: { type: obj.type(), ptr: obj.ptr, methods: RObject.getMethods(obj) },
-      payloadType: 'ptr',
-    };
-  }) as WebRDataRaw;
-
-  return { obj: ret, payloadType: 'raw' };
 }
 
 function captureR(expr: string | RObject, options: EvalROptions = {}): {
@@ -894,6 +1113,34 @@ function evalR(expr: string | RObject, options: EvalROptions = {}): RObject {
   }
 }
 
+/**
+ * Convert a named list of R objects into arguments for `evalJs()`.
+ *
+ * Raw, integer and double vectors are given as typed arrays, copied out of
+ * WebAssembly memory in a single operation, with missing values left encoded
+ * as R's `NA` values. Other R objects are given as `RObject` references when
+ * the code runs in the worker thread, and converted using `toJs()` when the
+ * code runs on the main thread.
+ */
+function evalJsArgs(ptr: RPtr, main: boolean): { [name: string]: unknown } {
+  const list = RList.wrap(ptr);
+  const names = list.names();
+  const args: { [name: string]: unknown } = {};
+  for (let i = 0; i < list.length; i++) {
+    const name = names?.[i];
+    if (!name || !/^[A-Za-z_$][\w$]*$/.test(name)) {
+      throw new Error('`args` must be a named list, with names that are valid JavaScript identifiers.');
+    }
+    const obj = RObject.wrap(Module._VECTOR_ELT(ptr, i));
+    if (obj instanceof RRaw || obj instanceof RInteger || obj instanceof RDouble) {
+      args[name] = obj.toTypedArray();
+    } else {
+      args[name] = main ? obj.toJs() : obj;
+    }
+  }
+  return args;
+}
+
 function init(config: Required<WebROptions>) {
   _config = config;
 
@@ -932,6 +1179,9 @@ function init(config: Required<WebROptions>) {
     // Hook Emscripten's FS.mount() to handle ArrayBuffer data from the channel
     Module.FS._mount = Module.FS.mount;
     Module.FS.mount = mountFS;
+    // Hook FS.unmount() to release resources held by mounted images
+    Module.FS._unmount = Module.FS.unmount;
+    Module.FS.unmount = unmountFS;
   });
 
   chan?.setDispatchHandler(dispatch);
@@ -946,11 +1196,21 @@ function init(config: Required<WebROptions>) {
     captureR: captureR,
     channel: chan,
     canvas: {},
+    cluster: new ClusterNodes(`${_config.baseUrl}webr-cluster-worker.js`, {
+      RArgs: ['--quiet'],
+      REnv: _config.REnv,
+      baseUrl: _config.baseUrl,
+      repoUrl: _config.repoUrl,
+      homedir: _config.homedir,
+      interactive: false,
+      channelType: _config.channelType,
+    }),
 
     resolveInit: () => {
       initPersistentObjects();
       chan?.setInterrupt(Module._Rf_onintr);
       Module.setValue(Module._R_Interactive, _config.interactive ? 1 : 0, 'i8');
+      setEventPollInterval(_config.eventPollInterval);
       evalR(`options(webr_pkg_repos="${_config.repoUrl}")`);
       chan?.resolve();
       resolved = true;
@@ -969,7 +1229,11 @@ function init(config: Required<WebROptions>) {
     },
 
     handleEvents: () => {
-      chan?.handleEvents();
+      if (chan) {
+        adaptEventPollInterval(chan.handleEvents());
+        chan.flushOutput(true);
+        reportMetrics();
+      }
     },
 
     dataViewer: (ptr: RPtr, title: string) => {
@@ -977,12 +1241,17 @@ function init(config: Required<WebROptions>) {
       chan?.write({ type: 'view', data: { data, title } });
     },
 
-    evalJs: (code: RPtr, await = false): RPtr => {
+    evalJs: (code: RPtr, await = 0, args: RPtr = 0): RPtr => {
       try {
         let result = null;
+        const src = Module.UTF8ToString(code);
+        const jsArgs = args ? evalJsArgs(args, !!await) : {};
         if (await) {
           // Run JS on main thread and block until the result resolves
-          const response = chan?.syncRequest({ type: 'eval-await', data: Module.UTF8ToString(code) }) as EvalResponse;
+          const response = chan?.syncRequest({
+            type: 'eval-await',
+            data: { code: src, args: jsArgs },
+          }) as EvalResponse;
           if (!response) {
             throw new Error('Empty sync response for `evalJs`.');
           } else if (response.data.error) {
@@ -992,7 +1261,7 @@ function init(config: Required<WebROptions>) {
           }
         } else {
           // Run JS in the webR worker thread
-          result = (0, eval)(Module.UTF8ToString(code)) as WebRData;
+          result = evalJs(src, jsArgs) as WebRData;
         }
         return (new RObject(result)).ptr;
       } catch (e) {
@@ -1023,16 +1292,33 @@ function init(config: Required<WebROptions>) {
 
   Module.locateFile = (path: string) => _config.baseUrl + path;
   Module.downloadFileContent = downloadFileContent;
+  if (_config.packageCache) {
+    setImageCache(IN_NODE
+      ? new NodeImageCache(_config.packageCache)
+      : chan ? new ChannelImageCache(chan) : null);
+  }
   Module.mountImageUrl = mountImageUrl;
   Module.mountImagePath = mountImagePath;
+  Module.prefetchImageUrls = (urls: string[], hashes: string[], concurrency: number) => {
+    // Images are downloaded by the main thread, which can make concurrent
+    // requests while the worker is blocked
+    prefetchImageUrls(urls, hashes, (pending, gunzip) => {
+      if (!chan) {
+        throw new Error('The webR communication channel has not been initialised.');
+      }
+      const msg = { type: 'prefetch', data: { urls: pending, concurrency, gunzip } };
+      return chan.syncRequest(msg).data as (Uint8Array | null)[];
+    });
+  };
   Module.mountDriveFS = mountDriveFS;
+  Module.fetchRepoMetadata = fetchRepoMetadata;
 
   Module.print = (text: string) => {
-    chan?.write({ type: 'stdout', data: text });
+    chan?.writeOutput('stdout', text);
   };
 
   Module.printErr = (text: string) => {
-    chan?.write({ type: 'stderr', data: text });
+    chan?.writeOutput('stderr', text);
   };
 
   // eslint-disable-next-line @typescript-eslint/no-unsafe-member-access